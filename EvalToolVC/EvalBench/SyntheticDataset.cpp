@@ -0,0 +1,173 @@
+#include "SyntheticDataset.h"
+#include "../EvalTool/FlowIO.h"
+#include "../EvalTool/FsUtils.h"
+#include "../EvalTool/Resampler.h"
+
+#include <stdio.h>
+
+namespace SyntheticDataset
+{
+	static const float UNKNOWN = 1e10f;
+
+	// smooth random texture
+	static cv::Mat make_texture(cv::Size size, cv::RNG& rng)
+	{
+		cv::Mat coarse(std::max(size.height / 16, 2), std::max(size.width / 16, 2), CV_8UC3);
+		rng.fill(coarse, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+		cv::Mat texture;
+		cv::resize(coarse, texture, size, 0, 0, cv::INTER_CUBIC);
+		return texture;
+	}
+
+	// ellipse mask and the flow moving the ellipse by fg and the rest by bg
+	static void make_layer(cv::Size size, cv::Point2f center, cv::Point2f axes, cv::Point2f fg, cv::Point2f bg, cv::Mat& mask, cv::Mat& flow)
+	{
+		mask.create(size, CV_8U);
+		flow.create(size, CV_32FC2);
+		for (int y = 0; y < size.height; y++)
+		{
+			uchar* m = mask.ptr<uchar>(y);
+			float* f = flow.ptr<float>(y);
+			for (int x = 0; x < size.width; x++)
+			{
+				const float ex = (x - center.x) / axes.x, ey = (y - center.y) / axes.y;
+				m[x] = ex * ex + ey * ey <= 1 ? 255 : 0;
+				const cv::Point2f d = m[x] ? fg : bg;
+				const float tx = x + d.x, ty = y + d.y;
+				const bool inside = tx >= 0 && ty >= 0 && tx <= size.width - 1 && ty <= size.height - 1;
+				f[2 * x] = inside ? d.x : UNKNOWN;
+				f[2 * x + 1] = inside ? d.y : UNKNOWN;
+			}
+		}
+	}
+
+	Pair MakePair(cv::Size size, cv::RNG& rng)
+	{
+		const float w = (float)size.width, h = (float)size.height;
+		const cv::Point2f axes(w * rng.uniform(0.15f, 0.3f), h * rng.uniform(0.15f, 0.3f));
+		const cv::Point2f center1(w * rng.uniform(0.35f, 0.65f), h * rng.uniform(0.35f, 0.65f));
+		const cv::Point2f fg(w * rng.uniform(-0.1f, 0.1f), h * rng.uniform(-0.1f, 0.1f));
+		const cv::Point2f bg(w * rng.uniform(-0.03f, 0.03f), h * rng.uniform(-0.03f, 0.03f));
+
+		Pair p;
+		make_layer(size, center1, axes, fg, bg, p.mask1, p.flow1);
+		make_layer(size, center1 + fg, axes, -fg, -bg, p.mask2, p.flow2);
+
+		// image 2 shows the background and foreground textures moved by their motions
+		cv::Mat background = make_texture(size, rng), foreground = make_texture(size, rng);
+		p.image1 = background.clone();
+		foreground.copyTo(p.image1, p.mask1);
+		p.image2.create(size, CV_8UC3);
+		for (int y = 0; y < size.height; y++)
+		for (int x = 0; x < size.width; x++)
+		{
+			const bool isFg = p.mask2.at<uchar>(y, x) != 0;
+			const cv::Point2f d = isFg ? -fg : -bg;
+			const int sx = std::min(std::max(cvRound(x + d.x), 0), size.width - 1);
+			const int sy = std::min(std::max(cvRound(y + d.y), 0), size.height - 1);
+			p.image2.at<cv::Vec3b>(y, x) = (isFg ? foreground : background).at<cv::Vec3b>(sy, sx);
+		}
+		return p;
+	}
+
+	// adds noise to the known pixels of a flow
+	static cv::Mat noisy_flow(const cv::Mat& flow, float sigma, cv::RNG& rng)
+	{
+		cv::Mat noise(flow.size(), CV_32FC2);
+		rng.fill(noise, cv::RNG::NORMAL, cv::Scalar::all(0), cv::Scalar::all(sigma));
+		cv::Mat out = flow.clone();
+		for (int y = 0; y < flow.rows; y++)
+		{
+			float* f = out.ptr<float>(y);
+			const float* n = noise.ptr<float>(y);
+			for (int x = 0; x < flow.cols * 2; x += 2)
+			if (!FlowIO::unknown_flow(f[x], f[x + 1])) {
+				f[x] += n[x];
+				f[x + 1] += n[x + 1];
+			}
+		}
+		return out;
+	}
+
+	// the mask with its boundary shifted by a few pixels
+	static cv::Mat noisy_mask(const cv::Mat& mask, cv::RNG& rng)
+	{
+		cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(5, 5));
+		cv::Mat out;
+		if (rng.uniform(0, 2))
+			cv::dilate(mask, out, kernel);
+		else
+			cv::erode(mask, out, kernel);
+		return out;
+	}
+
+	Pair MakeResult(const Pair& gt, double resultScale, cv::RNG& rng)
+	{
+		Pair r;
+		r.flow1 = noisy_flow(gt.flow1, 1.0f, rng);
+		r.flow2 = noisy_flow(gt.flow2, 1.0f, rng);
+		r.mask1 = noisy_mask(gt.mask1, rng);
+		r.mask2 = noisy_mask(gt.mask2, rng);
+		if (resultScale != 1.0)
+		{
+			const cv::Size size1(cvRound(gt.flow1.cols * resultScale), cvRound(gt.flow1.rows * resultScale));
+			const cv::Size size2(cvRound(gt.flow2.cols * resultScale), cvRound(gt.flow2.rows * resultScale));
+			cv::Mat flow1 = r.flow1;
+			Resampler::ResizeFlow(flow1, r.flow1, r.flow2.size(), size1, size2);
+			Resampler::ResizeFlow(r.flow2, r.flow2, flow1.size(), size2, size1);
+			Resampler::ResizeMask(r.mask1, r.mask1, size1);
+			Resampler::ResizeMask(r.mask2, r.mask2, size2);
+		}
+		return r;
+	}
+
+	static bool write_text(const std::string& path, const std::string& text)
+	{
+		FILE* fp = fopen(path.c_str(), "w");
+		if (fp == NULL)
+			return false;
+		bool ok = fputs(text.c_str(), fp) >= 0;
+		return (fclose(fp) == 0) && ok;
+	}
+
+	bool Generate(const std::string& root, const Options& options)
+	{
+		const std::string datasetDir = FsUtil::JoinPath(FsUtil::JoinPath(root, "Dataset"), "Synthetic");
+		const std::string resultsDir = FsUtil::JoinPath(FsUtil::JoinPath(root, "Results"), "Synthetic");
+		FsUtil::MakeDirectory(root);
+		FsUtil::MakeDirectory(FsUtil::JoinPath(root, "Dataset"));
+		FsUtil::MakeDirectory(FsUtil::JoinPath(root, "Results"));
+		FsUtil::MakeDirectory(datasetDir);
+		FsUtil::MakeDirectory(resultsDir);
+
+		cv::RNG rng(options.seed);
+		for (int i = 0; i < options.pairs; i++)
+		{
+			char name[32];
+			sprintf(name, "pair_%04d", i);
+			const std::string gtDir = FsUtil::JoinPath(datasetDir, name);
+			const std::string resDir = FsUtil::JoinPath(resultsDir, name);
+			FsUtil::MakeDirectory(gtDir);
+			FsUtil::MakeDirectory(resDir);
+
+			Pair gt = MakePair(options.size, rng);
+			Pair res = MakeResult(gt, options.resultScale, rng);
+
+			bool ok = write_text(FsUtil::JoinPath(gtDir, "pair.txt"), "Image1,Image2\nimage1.png,image2.png\n");
+			ok = ok && write_text(FsUtil::JoinPath(gtDir, "flip_gt.txt"), i % 10 == 0 ? "1" : "0");
+			ok = ok && cv::imwrite(FsUtil::JoinPath(gtDir, "image1.png"), gt.image1);
+			ok = ok && cv::imwrite(FsUtil::JoinPath(gtDir, "image2.png"), gt.image2);
+			ok = ok && cv::imwrite(FsUtil::JoinPath(gtDir, "mask1.png"), gt.mask1);
+			ok = ok && cv::imwrite(FsUtil::JoinPath(gtDir, "mask2.png"), gt.mask2);
+			ok = ok && cv::imwrite(FsUtil::JoinPath(resDir, "mask1.png"), res.mask1);
+			ok = ok && cv::imwrite(FsUtil::JoinPath(resDir, "mask2.png"), res.mask2);
+			if (!ok)
+				return false;
+			FlowIO::WriteFlowFile(gt.flow1, FsUtil::JoinPath(gtDir, "flow1.flo").c_str());
+			FlowIO::WriteFlowFile(gt.flow2, FsUtil::JoinPath(gtDir, "flow2.flo").c_str());
+			FlowIO::WriteFlowFile(res.flow1, FsUtil::JoinPath(resDir, "flow1.flo").c_str());
+			FlowIO::WriteFlowFile(res.flow2, FsUtil::JoinPath(resDir, "flow2.flo").c_str());
+		}
+		return true;
+	}
+}
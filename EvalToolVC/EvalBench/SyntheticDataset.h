@@ -0,0 +1,39 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+
+// Synthetic image pairs in the layout of the TSS dataset, for benchmarking at any
+// resolution and number of pairs. Each pair shows a textured elliptic foreground
+// moving over a textured background with its own motion; flows of pixels whose
+// target leaves the frame are unknown.
+namespace SyntheticDataset
+{
+	struct Pair
+	{
+		cv::Mat image1, image2;   // CV_8UC3
+		cv::Mat flow1, flow2;     // CV_32FC2 ground truth, 1 to 2 and 2 to 1
+		cv::Mat mask1, mask2;     // CV_8U foreground masks (0/255)
+	};
+
+	// Ground truth of one pair.
+	Pair MakePair(cv::Size size, cv::RNG& rng);
+
+	// A method's result for a pair: the ground truth with noise on the flows and the
+	// masks, resized by resultScale as results of lower resolution are.
+	Pair MakeResult(const Pair& gt, double resultScale, cv::RNG& rng);
+
+	struct Options
+	{
+		int pairs;
+		cv::Size size;
+		double resultScale;
+		int seed;
+
+		Options() : pairs(20), size(640, 480), resultScale(0.5), seed(0) {}
+	};
+
+	// Writes <root>/Dataset/Synthetic/pair_NNNN with flow1.flo, flow2.flo, mask1.png,
+	// mask2.png, image1.png, image2.png, pair.txt and flip_gt.txt, and the matching
+	// results to <root>/Results/Synthetic/pair_NNNN. Returns false on a write error.
+	bool Generate(const std::string& root, const Options& options);
+}
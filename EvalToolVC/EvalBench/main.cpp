@@ -0,0 +1,403 @@
+#include <opencv2/opencv.hpp>
+#include <limits>
+#include <map>
+#include <stdlib.h>
+
+#include "../EvalTool/FlowIO.h"
+#include "../EvalTool/FlowKernels.h"
+#include "../EvalTool/Resampler.h"
+#include "../EvalTool/CvUtils.h"
+#include "../EvalTool/FsUtils.h"
+#include "../EvalTool/PackedMask.h"
+#include "SyntheticDataset.h"
+#include "../EvalTool/ArgsParser.h"
+
+using namespace std;
+
+// Sums all flow values so that every page of a (possibly mapped) flow is actually read.
+double touch_flow(const cv::Mat& flow)
+{
+	double sum = 0;
+	for (int y = 0; y < flow.rows; y++)
+	{
+		const float* p = flow.ptr<float>(y);
+		for (int x = 0; x < flow.cols * 2; x++)
+			sum += p[x];
+	}
+	return sum;
+}
+
+template <typename Func>
+double measure_msec(int repeat, Func func)
+{
+	int64 st = cv::getTickCount();
+	for (int i = 0; i < repeat; i++)
+		func();
+	return 1000.0 * (cv::getTickCount() - st) / cv::getTickFrequency() / repeat;
+}
+
+void bench_flow_readers(string flowFile, int repeat)
+{
+	int width = 0, height = 0;
+	if (!FlowIO::ProbeFlowFile(flowFile.c_str(), &width, &height))
+	{
+		printf("Not a valid flow file: %s\n", flowFile.c_str());
+		return;
+	}
+	printf("Flow file : %s (%d x %d)\n", flowFile.c_str(), width, height);
+
+	volatile double sink = 0;
+	double tProbe = measure_msec(repeat, [&]{
+		int w, h;
+		FlowIO::ProbeFlowFile(flowFile.c_str(), &w, &h);
+	});
+	double tRead = measure_msec(repeat, [&]{
+		cv::Mat flow;
+		FlowIO::ReadFlowFile(flow, flowFile.c_str());
+		sink = sink + touch_flow(flow);
+	});
+	double tMap = measure_msec(repeat, [&]{
+		cv::Mat flow;
+		FlowIO::MapFlowFile(flow, flowFile.c_str());
+		sink = sink + touch_flow(flow);
+	});
+
+	printf("%-16s %10s\n", "Reader", "msec");
+	printf("%-16s %10.3lf\n", "ProbeFlowFile", tProbe);
+	printf("%-16s %10.3lf\n", "ReadFlowFile", tRead);
+	printf("%-16s %10.3lf\n", "MapFlowFile", tMap);
+}
+
+// The endpoint error as computed with OpenCV operations before FlowKernels, kept as the reference.
+cv::Mat flow_error_reference(cv::Mat flow, cv::Mat flowGT)
+{
+	cv::Mat ch[2];
+	cv::split(flowGT, ch);
+	cv::Mat validGT = (cv::abs(ch[0]) <= 1e9) & (cv::abs(ch[1]) <= 1e9);
+	cv::split(flow, ch);
+	cv::Mat valid = (cv::abs(ch[0]) <= 1e9) & (cv::abs(ch[1]) <= 1e9);
+
+	cv::Mat m = flow - flowGT;
+	m = m.mul(m);
+	m = m.reshape(1, flow.rows * flow.cols);
+	cv::reduce(m, m, 1, cv::REDUCE_SUM);
+	m = m.reshape(1, flow.rows);
+	cv::sqrt(m, m);
+	cv::bitwise_xor(validGT, valid, valid);
+	m.setTo(cv::Scalar(1000), valid);
+	return m;
+}
+
+// Random flow in [-range, range] with about 1% of unknown (1e10 or NaN) pixels.
+cv::Mat make_random_flow(cv::Size size, float range, cv::RNG& rng)
+{
+	cv::Mat flow(size, CV_32FC2);
+	rng.fill(flow, cv::RNG::UNIFORM, -range, range);
+	for (int i = 0; i < (int)flow.total() / 100; i++)
+	{
+		cv::Vec2f& f = flow.at<cv::Vec2f>(rng.uniform(0, size.height), rng.uniform(0, size.width));
+		f[rng.uniform(0, 2)] = rng.uniform(0, 2) ? 1e10f : std::numeric_limits<float>::quiet_NaN();
+	}
+	return flow;
+}
+
+void bench_flow_kernels(int repeat)
+{
+	const cv::Size sizes[] = { cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080), cv::Size(3840, 2160) };
+	const FlowKernels::Isa supported = FlowKernels::GetSupportedIsa();
+	cv::RNG rng(0);
+
+	printf("%-12s %-10s %10s %10s\n", "Size", "Kernel", "msec", "Mpix/s");
+	for (const cv::Size& size : sizes)
+	{
+		cv::Mat flow = make_random_flow(size, 20, rng);
+		cv::Mat flowGT = make_random_flow(size, 20, rng);
+		double mpix = size.area() / 1e6;
+		char label[32];
+		sprintf(label, "%dx%d", size.width, size.height);
+
+		cv::Mat ref;
+		double t = measure_msec(repeat, [&]{ ref = flow_error_reference(flow, flowGT); });
+		printf("%-12s %-10s %10.3lf %10.1lf\n", label, "OpenCV", t, mpix / t * 1000);
+
+		for (int isa = FlowKernels::ISA_SCALAR; isa <= supported; isa++)
+		{
+			FlowKernels::SetIsa((FlowKernels::Isa)isa);
+			cv::Mat err, validGT, valid;
+			t = measure_msec(repeat, [&]{ FlowKernels::ComputeFlowError(flow, flowGT, err, validGT, valid); });
+
+			// both are NaN where the flows are unknown on both sides
+			cv::Mat diff = (err != ref) & (err == err);
+			printf("%-12s %-10s %10.3lf %10.1lf %s\n", label, FlowKernels::IsaName((FlowKernels::Isa)isa), t, mpix / t * 1000,
+				cv::countNonZero(diff) == 0 ? "" : "MISMATCH");
+		}
+		FlowKernels::SetIsa(supported);
+	}
+}
+
+// Flow resizing as done with OpenCV operations before Resampler, kept as the reference.
+cv::Mat resize_flow_reference(cv::Mat flow, cv::Size oldSize2, cv::Size newSize1, cv::Size newSize2)
+{
+	const cv::Size oldSize1 = flow.size();
+	cv::Mat valid1, resized1;
+	CvUtils::ComputeValidFlowMask(flow).convertTo(valid1, CV_32F, 1.0 / 255);
+	cv::resize(valid1, valid1, newSize1, 0, 0, cv::INTER_LINEAR);
+	cv::resize(flow, resized1, newSize1, 0, 0, cv::INTER_LINEAR);
+
+	cv::Mat newGrid = CvUtils::CreateMeshgrid<float>(newSize1.width, newSize1.height);
+	cv::Mat oldGrid = newGrid.mul(cv::Scalar((double)oldSize1.width / newSize1.width, (double)oldSize1.height / newSize1.height));
+	resized1 = resized1 + oldGrid;
+	resized1 = resized1.mul(cv::Scalar((double)newSize2.width / oldSize2.width, (double)newSize2.height / oldSize2.height)) - newGrid;
+	resized1.setTo(cv::Scalar(1e10), valid1 != 1.0);
+	return resized1;
+}
+
+// number of values that differ bitwise, so that NaN at the same place counts as equal
+int count_bit_differences(const cv::Mat& a, const cv::Mat& b)
+{
+	if (a.size() != b.size() || a.type() != b.type())
+		return -1;
+	int n = 0;
+	for (int y = 0; y < a.rows; y++)
+	{
+		const uchar* p = a.ptr<uchar>(y);
+		const uchar* q = b.ptr<uchar>(y);
+		for (size_t i = 0; i < a.cols * a.elemSize(); i++)
+			n += p[i] != q[i];
+	}
+	return n;
+}
+
+void bench_resampler(int repeat)
+{
+	// scales of the flows and masks, including the exact halving that cv::resize treats as area filter
+	const cv::Size src(1920, 1080);
+	const cv::Size sizes[] = { cv::Size(640, 480), cv::Size(960, 540), cv::Size(1280, 720), cv::Size(2560, 1440) };
+	cv::RNG rng(0);
+	cv::Mat flow = make_random_flow(src, 20, rng);
+	cv::Mat mask(src, CV_8U);
+	rng.fill(mask, cv::RNG::UNIFORM, 0, 256);
+	cv::GaussianBlur(mask, mask, cv::Size(7, 7), 0);
+
+	printf("\n%-12s %-10s %10s %10s\n", "Resize to", "Resampler", "msec", "OpenCV");
+	for (const cv::Size& size : sizes)
+	{
+		char label[32];
+		sprintf(label, "%dx%d", size.width, size.height);
+
+		cv::Mat ref, out;
+		double tRef = measure_msec(repeat, [&]{ ref = resize_flow_reference(flow, src, size, size); });
+		double t = measure_msec(repeat, [&]{ Resampler::ResizeFlow(flow, out, src, size, size); });
+		printf("%-12s %-10s %10.3lf %10.3lf %s\n", label, "flow", t, tRef, count_bit_differences(out, ref) == 0 ? "" : "MISMATCH");
+
+		tRef = measure_msec(repeat, [&]{ cv::resize(mask, ref, size, 0); ref = ref > 128; });
+		t = measure_msec(repeat, [&]{ Resampler::ResizeMask(mask, out, size); });
+		printf("%-12s %-10s %10.3lf %10.3lf %s\n", label, "mask", t, tRef, count_bit_differences(out, ref) == 0 ? "" : "MISMATCH");
+	}
+}
+
+// One measurement of the suite, as written by -output and compared by -baseline
+struct BenchResult
+{
+	string name;
+	int width, height;
+	double msec;
+};
+
+string result_key(const string& name, int width, int height)
+{
+	char size[32];
+	sprintf(size, "@%dx%d", width, height);
+	return name + size;
+}
+
+bool write_results(const string& file, const std::vector<BenchResult>& results)
+{
+	FILE* fp = fopen(file.c_str(), "w");
+	if (fp == NULL)
+		return false;
+	fprintf(fp, "benchmark,width,height,msec\n");
+	for (const BenchResult& r : results)
+		fprintf(fp, "%s,%d,%d,%.4lf\n", r.name.c_str(), r.width, r.height, r.msec);
+	return fclose(fp) == 0;
+}
+
+bool read_results(const string& file, std::map<string, double>& results)
+{
+	FILE* fp = fopen(file.c_str(), "r");
+	if (fp == NULL)
+		return false;
+	char line[512], name[256];
+	int width, height;
+	double msec;
+	while (fgets(line, sizeof(line), fp))
+	if (sscanf(line, "%255[^,],%d,%d,%lf", name, &width, &height, &msec) == 4)
+		results[result_key(name, width, height)] = msec;
+	fclose(fp);
+	return true;
+}
+
+// Times the main steps of the evaluation on synthetic pairs of several resolutions and,
+// if evalTool is given, a full evaluation run of the EvalTool executable on a generated dataset.
+std::vector<BenchResult> run_suite(int repeat, const string& evalTool, const string& workDir, int pairs)
+{
+	const cv::Size sizes[] = { cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080) };
+	std::vector<BenchResult> results;
+	auto add = [&](const char* name, cv::Size size, double msec)
+	{
+		BenchResult r = { name, size.width, size.height, msec };
+		results.push_back(r);
+		printf("%-16s %-12s %10.3lf\n", name, result_key("", size.width, size.height).c_str() + 1, msec);
+	};
+
+	FsUtil::MakeDirectory(workDir);
+	cv::RNG rng(0);
+	printf("%-16s %-12s %10s\n", "Benchmark", "Size", "msec");
+	for (const cv::Size& size : sizes)
+	{
+		SyntheticDataset::Pair gt = SyntheticDataset::MakePair(size, rng);
+		SyntheticDataset::Pair res = SyntheticDataset::MakeResult(gt, 0.5, rng);
+		SyntheticDataset::Pair full = SyntheticDataset::MakeResult(gt, 1.0, rng);
+
+		const string flowFile = FsUtil::JoinPath(workDir, "bench.flo");
+		FlowIO::WriteFlowFile(gt.flow1, flowFile.c_str());
+		add("ReadFlowFile", size, measure_msec(repeat, [&]{
+			cv::Mat flow;
+			FlowIO::ReadFlowFile(flow, flowFile.c_str());
+		}));
+
+		// the work of compute_score for one direction: mask counts and flow accuracy
+		cv::Mat_<double> thresholds(50, 1);
+		for (int i = 0; i < 50; i++)
+			thresholds(i) = (i + 1) / 100.0 * std::max(size.width, size.height);
+		cv::Mat validGT = CvUtils::ComputeValidFlowMask(gt.flow1);
+		PackedMask packedGT(gt.mask1);
+		add("compute_score", size, measure_msec(repeat, [&]{
+			CompareMasks(packedGT, PackedMask(full.mask1));
+			CvUtils::ComputeFlowAccuracy(full.flow1, gt.flow1, thresholds, validGT);
+		}));
+
+		add("ResizeFlowPair", size, measure_msec(repeat, [&]{
+			cv::Mat flow1 = res.flow1, flow2 = res.flow2;
+			CvUtils::ResizeFlowPair(flow1, flow2, gt.flow1.size(), gt.flow2.size());
+		}));
+		add("warpImage", size, measure_msec(repeat, [&]{ CvUtils::warpImage(gt.flow1, gt.image2); }));
+		add("MotionToColor", size, measure_msec(repeat, [&]{ FlowIO::MotionToColor(gt.flow1, -1, cv::Scalar(), 1); }));
+	}
+
+	if (!evalTool.empty())
+	{
+		SyntheticDataset::Options options;
+		options.pairs = pairs;
+		const string root = FsUtil::JoinPath(workDir, "eval");
+		if (!SyntheticDataset::Generate(root, options))
+		{
+			printf("Failed to generate the dataset in %s\n", root.c_str());
+			return results;
+		}
+		string command = "\"" + evalTool + "\" -mode evaluation -resultsDir \"" + FsUtil::JoinPath(FsUtil::JoinPath(root, "Results"), "Synthetic") +
+			"\" -datasetDir \"" + FsUtil::JoinPath(FsUtil::JoinPath(root, "Dataset"), "Synthetic") + "\"";
+#ifdef _WIN32
+		command = "\"" + command + " > NUL\"";   // cmd.exe strips the outer quotes
+#else
+		command += " > /dev/null";
+#endif
+		int status = 0;
+		double t = measure_msec(std::max(repeat / 10, 1), [&]{ status |= system(command.c_str()); });
+		if (status != 0)
+			printf("EvalTool failed: %s\n", command.c_str());
+		else
+			add("run_evaluation", options.size, t);
+	}
+	return results;
+}
+
+// Prints the change of each result against the baseline and returns false if any
+// benchmark became slower by more than tolerance percent.
+bool compare_results(const std::vector<BenchResult>& results, const std::map<string, double>& baseline, double tolerance)
+{
+	bool ok = true;
+	printf("\n%-16s %-12s %10s %10s %8s\n", "Benchmark", "Size", "msec", "Baseline", "Change");
+	for (const BenchResult& r : results)
+	{
+		const string key = result_key(r.name, r.width, r.height);
+		auto it = baseline.find(key);
+		if (it == baseline.end())
+			continue;
+		const double change = 100.0 * (r.msec - it->second) / it->second;
+		const bool regression = change > tolerance;
+		ok = ok && !regression;
+		printf("%-16s %-12s %10.3lf %10.3lf %+7.1lf%%%s\n", r.name.c_str(), key.c_str() + r.name.size() + 1, r.msec, it->second, change, regression ? " REGRESSION" : "");
+	}
+	return ok;
+}
+
+int main(int argn, char** args)
+{
+	ArgsParser argParser(argn, args);
+
+	std::string flowFile = "";
+	int repeat = 20;
+	argParser.TryGetArgment("repeat", repeat);
+
+	std::string generateDir = "";
+	if (argParser.TryGetArgment("generate", generateDir))
+	{
+		SyntheticDataset::Options options;
+		argParser.TryGetArgment("pairs", options.pairs);
+		argParser.TryGetArgment("width", options.size.width);
+		argParser.TryGetArgment("height", options.size.height);
+		argParser.TryGetArgment("resultScale", options.resultScale);
+		argParser.TryGetArgment("seed", options.seed);
+		printf("Generating %d pairs of %dx%d in %s\n", options.pairs, options.size.width, options.size.height, generateDir.c_str());
+		return SyntheticDataset::Generate(generateDir, options) ? 0 : 1;
+	}
+
+	bool suite = false;
+	argParser.TryGetArgment("suite", suite);
+	if (suite)
+	{
+		std::string evalTool = "", workDir = "bench_work", output = "", baselineFile = "";
+		int pairs = 20;
+		double tolerance = 10;
+		argParser.TryGetArgment("evalTool", evalTool);
+		argParser.TryGetArgment("workDir", workDir);
+		argParser.TryGetArgment("pairs", pairs);
+		argParser.TryGetArgment("output", output);
+		argParser.TryGetArgment("baseline", baselineFile);
+		argParser.TryGetArgment("tolerance", tolerance);
+
+		std::vector<BenchResult> results = run_suite(repeat, evalTool, workDir, pairs);
+		if (!output.empty() && !write_results(output, results))
+			printf("Failed to write %s\n", output.c_str());
+
+		std::map<string, double> baseline;
+		if (!baselineFile.empty())
+		{
+			if (!read_results(baselineFile, baseline)) {
+				printf("Failed to read the baseline %s\n", baselineFile.c_str());
+				return 1;
+			}
+			return compare_results(results, baseline, tolerance) ? 0 : 2;
+		}
+		return 0;
+	}
+
+	bool kernels = false;
+	argParser.TryGetArgment("kernels", kernels);
+	if (kernels)
+	{
+		bench_flow_kernels(repeat);
+		bench_resampler(repeat);
+		return 0;
+	}
+
+	if (!argParser.TryGetArgment("flow", flowFile)){
+		std::cout << "Please specify a .flo file by -flow argment, -kernels 1 to benchmark the flow kernels," << std::endl;
+		std::cout << "-suite 1 to run the benchmark suite, or -generate <dir> to create a synthetic dataset." << std::endl;
+		return 1;
+	}
+
+	bench_flow_readers(flowFile, repeat);
+	return 0;
+}
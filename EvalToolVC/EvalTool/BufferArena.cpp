@@ -0,0 +1,82 @@
+#include "BufferArena.h"
+
+#include <atomic>
+
+namespace BufferArena
+{
+	cv::Mat Arena::Get(int slot, cv::Size size, int type)
+	{
+		if (slot >= (int)blocks.size())
+			blocks.resize(slot + 1);
+		const size_t bytes = (size_t)size.area() * CV_ELEM_SIZE(type);
+		cv::Mat& block = blocks[slot];
+		requests++;
+		if (block.total() < bytes)
+		{
+			regrowths += !block.empty();
+			allocations++;
+			// release the old buffer first, so that both are not held at once
+			block.release();
+			block.create((int)((bytes + 4095) / 4096), 4096, CV_8U);
+		}
+		return cv::Mat(size, type, block.data);
+	}
+
+	long long Arena::Bytes() const
+	{
+		long long bytes = 0;
+		for (const cv::Mat& block : blocks)
+			bytes += (long long)block.total();
+		return bytes;
+	}
+
+	static std::atomic<long long> matAllocations(0), matBytes(0);
+
+	// Forwards to the allocator it replaces, counting the buffers it allocates. Images over
+	// user data are not counted.
+	class CountingAllocator : public cv::MatAllocator
+	{
+		cv::MatAllocator* base;
+
+	public:
+		explicit CountingAllocator(cv::MatAllocator* base) : base(base) {}
+
+		cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usageFlags) const
+		{
+			cv::UMatData* u = base->allocate(dims, sizes, type, data, step, flags, usageFlags);
+			if (u != NULL && data == NULL)
+			{
+				matAllocations++;
+				matBytes += (long long)u->size;
+			}
+			return u;
+		}
+		bool allocate(cv::UMatData* u, int accessFlags, cv::UMatUsageFlags usageFlags) const
+		{
+			return base->allocate(u, accessFlags, usageFlags);
+		}
+		void deallocate(cv::UMatData* u) const
+		{
+			base->deallocate(u);
+		}
+	};
+
+	void CountMatAllocations()
+	{
+		// installed once and never freed: images allocated through it may outlive any caller
+		static CountingAllocator* allocator = NULL;
+		if (allocator == NULL)
+		{
+			allocator = new CountingAllocator(cv::Mat::getDefaultAllocator());
+			cv::Mat::setDefaultAllocator(allocator);
+		}
+	}
+
+	Counters MatAllocations()
+	{
+		Counters c;
+		c.allocations = matAllocations;
+		c.bytes = matBytes;
+		return c;
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Reuse of the large temporary images of the evaluation across pairs, and counters of
+// cv::Mat allocations to check that a run reaches a steady state without them.
+namespace BufferArena
+{
+	// Scratch images of one thread. Each slot keeps one buffer that grows to the largest
+	// image requested from it and is reused by later requests, so that once the largest
+	// pair has been seen, requests no longer allocate. Not thread-safe: one arena per worker.
+	class Arena
+	{
+		std::vector<cv::Mat> blocks;
+		long long requests, allocations, regrowths;
+
+		Arena(const Arena&);
+		Arena& operator=(const Arena&);
+
+	public:
+		Arena() : requests(0), allocations(0), regrowths(0) {}
+
+		// A continuous image over the buffer of a slot. It stays valid until the slot is
+		// requested again or the arena is destroyed; its contents are undefined.
+		cv::Mat Get(int slot, cv::Size size, int type);
+
+		long long Requests() const { return requests; }
+		long long Allocations() const { return allocations; }   // buffers allocated, including regrowths
+		long long Regrowths() const { return regrowths; }       // buffers replaced by larger ones
+		long long Bytes() const;                                // size of all buffers
+	};
+
+	struct Counters
+	{
+		long long allocations, bytes;
+
+		Counters() : allocations(0), bytes(0) {}
+	};
+
+	// Makes the default cv::Mat allocator count the allocations from now on.
+	void CountMatAllocations();
+
+	// cv::Mat allocations since CountMatAllocations
+	Counters MatAllocations();
+}
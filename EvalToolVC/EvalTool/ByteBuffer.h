@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <string.h>
+
+// Appends plain values and length-prefixed strings to a byte buffer, in the layout of the cache files.
+class BufferWriter
+{
+public:
+	std::vector<unsigned char> buffer;
+
+	template <typename T>
+	void Put(const T& value)
+	{
+		const unsigned char* p = (const unsigned char*)&value;
+		buffer.insert(buffer.end(), p, p + sizeof(T));
+	}
+	void PutBytes(const void* data, size_t size)
+	{
+		const unsigned char* p = (const unsigned char*)data;
+		buffer.insert(buffer.end(), p, p + size);
+	}
+	void PutString(const std::string& str)
+	{
+		Put((int)str.size());
+		buffer.insert(buffer.end(), str.begin(), str.end());
+	}
+};
+
+// Reads what BufferWriter wrote. 'ok' turns false at the first read past the end.
+class BufferReader
+{
+	const unsigned char* p;
+	const unsigned char* end;
+
+public:
+	bool ok;
+
+	BufferReader(const unsigned char* begin, const unsigned char* end) : p(begin), end(end), ok(true) {}
+
+	template <typename T>
+	T Get()
+	{
+		T value = T();
+		GetBytes(&value, sizeof(T));
+		return value;
+	}
+	bool GetBytes(void* data, size_t size)
+	{
+		if (!ok || (size_t)(end - p) < size) {
+			ok = false;
+			return false;
+		}
+		memcpy(data, p, size);
+		p += size;
+		return true;
+	}
+	std::string GetString()
+	{
+		int len = Get<int>();
+		if (!ok || len < 0 || end - p < len) {
+			ok = false;
+			return std::string();
+		}
+		std::string str((const char*)p, len);
+		p += len;
+		return str;
+	}
+	bool AtEnd() const { return p == end; }
+};
@@ -1,12 +1,19 @@
 #pragma once
 
 #include <vector>
-#include <opencv2\opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <opencv2/opencv.hpp>
 #include <fstream>
 
+#include "FlowKernels.h"
+#include "ParallelUtils.h"
+#include "Resampler.h"
+#include "EpeHistogram.h"
+
 namespace CvUtils
 {
-	cv::Mat channelDot(const cv::Mat& m1, const cv::Mat& m2)
+	inline cv::Mat channelDot(const cv::Mat& m1, const cv::Mat& m2)
 	{
 		cv::Mat m1m2 = m1.mul(m2);
 		m1m2 = m1m2.reshape(1, m1.rows*m1.cols);
@@ -14,37 +21,110 @@ namespace CvUtils
 		cv::reduce(m1m2, m1m2dot, 1, cv::REDUCE_SUM);
 		return m1m2dot.reshape(1, m1.rows);
 	}
-	cv::Mat channelSum(const cv::Mat& m1)
+	inline cv::Mat channelSum(const cv::Mat& m1)
 	{
 		cv::Mat m = m1.reshape(1, m1.rows*m1.cols);
 		cv::reduce(m, m, 1, cv::REDUCE_SUM);
 		return m.reshape(1, m1.rows);
 	}
 
-	cv::Mat ComputeValidFlowMask(cv::Mat flow)
+	inline cv::Mat ComputeValidFlowMask(cv::Mat flow)
 	{
-		cv::Mat u, v;
-		cv::extractChannel(flow, u, 0);
-		cv::extractChannel(flow, v, 1);
-		return (cv::abs(u) <= 1e9) & (cv::abs(v) <= 1e9);
+		cv::Mat valid;
+		FlowKernels::ComputeValidFlowMask(flow, valid);
+		return valid;
 	}
-	cv::Mat computeFlowError(cv::Mat flow, cv::Mat flowGT)
+	inline cv::Mat computeFlowError(cv::Mat flow, cv::Mat flowGT)
 	{
-		cv::Mat m = flow - flowGT;
-		cv::Mat validGT = ComputeValidFlowMask(flowGT);
-		cv::Mat valid = ComputeValidFlowMask(flow);
-		m = channelSum(m.mul(m));
-		cv::sqrt(m, m);
+		cv::Mat m, validGT, valid;
+		FlowKernels::ComputeFlowError(flow, flowGT, m, validGT, valid);
+		return m;
+	}
 
-		//m.setTo(cv::Scalar(0), ~validGT);
-		cv::bitwise_xor(validGT, valid, valid);
-		m.setTo(cv::Scalar(1000), valid);
+	// Counts behind ComputeFlowAccuracy, accumulated over horizontal bands of a flow so that
+	// a flow can be scored without holding it whole. Any split into bands gives the counts of
+	// the whole flow.
+	class FlowAccuracyCounter
+	{
+		std::vector<std::pair<float, int>> order;   // thresholds in increasing order, with their index
+		std::vector<float> edges;
+		std::vector<int64> hist;   // hist[k]: GT-valid pixels whose error exceeds exactly k of the sorted thresholds
+		int64 validSize;
+		unsigned* errorHist;
+		std::vector<float> err;
+		std::vector<uchar> validRow;
+
+	public:
+		// errorHist, if given, receives the EpeHistogram::NUM_BINS bins of the errors of the GT-valid pixels.
+		explicit FlowAccuracyCounter(cv::Mat thresholds, unsigned* errorHist = NULL) : validSize(0), errorHist(errorHist)
+		{
+			// Thresholds are compared in float precision as with (error > t) on a CV_32F image.
+			const int T = (int)thresholds.total();
+			order.resize(T);
+			for (int i = 0; i < T; i++)
+				order[i] = std::make_pair((float)thresholds.at<double>(i), i);
+			std::sort(order.begin(), order.end());
+			edges.resize(T);
+			for (int i = 0; i < T; i++)
+				edges[i] = order[i].first;
+			hist.assign(T + 1, 0);
+			if (errorHist)
+				std::fill(errorHist, errorHist + EpeHistogram::NUM_BINS, 0u);
+		}
 
-		return m;
+		// Adds the rows of a band; validGT optionally gives ComputeValidFlowMask(flowGT).
+		void Add(cv::Mat flow, cv::Mat flowGT, cv::Mat validGT = cv::Mat())
+		{
+			CV_Assert(flow.type() == CV_32FC2 && flowGT.type() == CV_32FC2 && flow.size() == flowGT.size());
+			CV_Assert(validGT.empty() || (validGT.type() == CV_8U && validGT.size() == flowGT.size()));
+
+			err.resize(flow.cols);
+			validRow.resize(flow.cols);
+			for (int y = 0; y < flow.rows; y++)
+			{
+				const uchar* vg = validGT.empty() ? &validRow[0] : validGT.ptr<uchar>(y);
+				FlowKernels::FlowErrorRow(flow.ptr<float>(y), flowGT.ptr<float>(y), flow.cols, &err[0], validGT.empty() ? &validRow[0] : NULL, NULL);
+				for (int x = 0; x < flow.cols; x++)
+				{
+					if (!vg[x])
+						continue;
+					validSize++;
+					hist[std::lower_bound(edges.begin(), edges.end(), err[x]) - edges.begin()]++;
+					if (errorHist)
+						errorHist[EpeHistogram::Bin(err[x])]++;
+				}
+			}
+		}
+
+		cv::Mat_<double> Accuracy() const
+		{
+			const int T = (int)order.size();
+			cv::Mat_<double> accuracy(T, 1);
+			int64 exceed = validSize - hist[0];
+			for (int j = 0; j < T; j++)
+			{
+				accuracy(order[j].second) = 1.0 - (double)exceed / (double)validSize;
+				exceed -= hist[j + 1];
+			}
+			return accuracy;
+		}
+	};
+
+	// Flow accuracy for each threshold, i.e., the rate of GT-valid pixels whose error
+	// by computeFlowError is not greater than the threshold. Errors are computed and
+	// binned into a cumulative histogram over the thresholds in a single pass, so the
+	// result is identical to comparing the error image against every threshold.
+	// validGT optionally gives a precomputed ComputeValidFlowMask(flowGT). errorHist, if
+	// given, receives the EpeHistogram::NUM_BINS bins of the errors of the GT-valid pixels.
+	inline cv::Mat_<double> ComputeFlowAccuracy(cv::Mat flow, cv::Mat flowGT, cv::Mat thresholds, cv::Mat validGT = cv::Mat(), unsigned* errorHist = NULL)
+	{
+		FlowAccuracyCounter counter(thresholds, errorHist);
+		counter.Add(flow, flowGT, validGT);
+		return counter.Accuracy();
 	}
 
 	template <typename T>
-	cv::Mat CreateMeshgrid(int width, int height, int u_st = 0, int v_st = 0)
+	inline cv::Mat CreateMeshgrid(int width, int height, int u_st = 0, int v_st = 0)
 	{
 		cv::Mat grid = cv::Mat_<cv::Vec<T, 2>>(height, width);
 		for (int y = 0; y < height; y++)
@@ -52,49 +132,101 @@ namespace CvUtils
 			grid.at<cv::Vec<T, 2>>(y, x) = cv::Vec<T, 2>(x + u_st, y + v_st);
 		return grid;
 	}
-	void ResizeFlow(const cv::Mat fi1, cv::Mat& resized1, cv::Size oldSize1, cv::Size oldSize2, cv::Size newSize1, cv::Size newSize2)
+	// Resizes a flow to newSize1 and rescales it for a target frame resized from oldSize2
+	// to newSize2, in a single pass (see Resampler::ResizeFlow).
+	inline void ResizeFlow(const cv::Mat fi1, cv::Mat& resized1, cv::Size oldSize1, cv::Size oldSize2, cv::Size newSize1, cv::Size newSize2, int numThreads = 1)
 	{
-		cv::Mat valid1;
-		ComputeValidFlowMask(fi1).convertTo(valid1, CV_32F, 1.0 / 255);
-		cv::resize(valid1, valid1, newSize1, 0, 0, cv::INTER_LINEAR);
-
-		cv::resize(fi1, resized1, newSize1, 0, 0, cv::INTER_LINEAR);
-
-		cv::Mat newGrid = CreateMeshgrid<float>(newSize1.width, newSize1.height);
-		cv::Mat oldGrid = newGrid.mul(cv::Scalar((double)oldSize1.width / newSize1.width, (double)oldSize1.height / newSize1.height));
-
-		resized1 = resized1 + oldGrid;
-		resized1 = resized1.mul(cv::Scalar((double)newSize2.width / oldSize2.width, (double)newSize2.height / oldSize2.height)) - newGrid;
-
-		// set the mixture flows at known/unknown boundary pixels to unknown
-		resized1.setTo(cv::Scalar(1e10), valid1 != 1.0);
+		CV_Assert(fi1.size() == oldSize1);
+		Resampler::ResizeFlow(fi1, resized1, oldSize2, newSize1, newSize2, numThreads);
 	}
-	void ResizeFlowPair(cv::Mat& flow1, cv::Mat& flow2, cv::Size& newSize1, cv::Size& newSize2)
+	inline void ResizeFlowPair(cv::Mat& flow1, cv::Mat& flow2, const cv::Size& newSize1, const cv::Size& newSize2, int numThreads = 1)
 	{
 		const cv::Size oldSize1 = flow1.size();
 		const cv::Size oldSize2 = flow2.size();
 
 		if (oldSize1 != newSize1 || oldSize2 != newSize2)
 		{
-			ResizeFlow(flow1, flow1, oldSize1, oldSize2, newSize1, newSize2);
-			ResizeFlow(flow2, flow2, oldSize2, oldSize1, newSize2, newSize1);
+			ResizeFlow(flow1, flow1, oldSize1, oldSize2, newSize1, newSize2, numThreads);
+			ResizeFlow(flow2, flow2, oldSize2, oldSize1, newSize2, newSize1, numThreads);
 		}
 	}
 
-	cv::Mat warpImage(cv::Mat flowMap, cv::Mat image, cv::Scalar borderValue = cv::Scalar())
+	// Absolute sampling map (x + u, y + v) of a flow, built once and reused for every
+	// image or flow warped by the same field. The map is built in row bands on up to
+	// numThreads threads. With fixedPoint it is converted to CV_16SC2 with an
+	// interpolation table, the same 1/32-pixel positions remap uses internally for
+	// float maps, so bilinear results are unchanged and remap skips the conversion.
+	class WarpMap
 	{
-		cv::Mat_<float> map_x, map_y;
-		cv::extractChannel(flowMap, map_x, 0);
-		cv::extractChannel(flowMap, map_y, 1);
-		for (int y = 0; y < map_x.rows; y++)
-		for (int x = 0; x < map_x.cols; x++){
-			map_x.at<float>(y, x) += x;
-			map_y.at<float>(y, x) += y;
+		cv::Mat map1, map2;
+
+	public:
+		WarpMap() {}
+		explicit WarpMap(cv::Mat flow, bool fixedPoint = false, int numThreads = 1) { Build(flow, fixedPoint, numThreads); }
+
+		void Build(cv::Mat flow, bool fixedPoint = false, int numThreads = 1)
+		{
+			CV_Assert(flow.type() == CV_32FC2);
+			const int BAND_ROWS = 16;
+			map1.create(flow.size(), CV_32FC2);
+			map2 = cv::Mat();
+			ParallelUtils::ParallelFor((flow.rows + BAND_ROWS - 1) / BAND_ROWS, numThreads, [&](int band)
+			{
+				const int y1 = std::min(flow.rows, (band + 1) * BAND_ROWS);
+				for (int y = band * BAND_ROWS; y < y1; y++)
+					FlowKernels::WarpMapRow(flow.ptr<float>(y), flow.cols, y, map1.ptr<float>(y));
+			});
+			if (fixedPoint)
+				cv::convertMaps(map1.clone(), cv::Mat(), map1, map2, CV_16SC2);
 		}
 
-		cv::Mat img;
-		cv::remap(image, img, map_x, map_y, cv::INTER_LINEAR, cv::BORDER_CONSTANT, borderValue);
-		return img;
+		bool empty() const { return map1.empty(); }
+		cv::Size size() const { return map1.size(); }
+
+		cv::Mat Warp(cv::Mat image, cv::Scalar borderValue = cv::Scalar()) const
+		{
+			cv::Mat img;
+			cv::remap(image, img, map1, map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT, borderValue);
+			return img;
+		}
+	};
+
+	inline cv::Mat warpImage(cv::Mat flowMap, cv::Mat image, cv::Scalar borderValue = cv::Scalar())
+	{
+		return WarpMap(flowMap).Warp(image, borderValue);
+	}
+
+	// Forward-backward consistency mask of a flow against the reverse flow: 255 where
+	// the flow and the negated reverse flow sampled at its target differ by less than
+	// thres, 0 elsewhere. Equals computeFlowError(flow, -warpImage(flow, reverse, 1e10)) < thres
+	// without the intermediate images. Rows are processed in bands on up to numThreads threads.
+	// mask is written in place when it already has the size of the flow. With an OpenCV whose
+	// remap the kernel does not match, the mask is computed with the intermediate images.
+	inline void ComputeConsistencyMask(cv::Mat flow, cv::Mat reverse, double thres, cv::Mat& mask, int numThreads = 1)
+	{
+		CV_Assert(flow.type() == CV_32FC2 && reverse.type() == CV_32FC2);
+		if (!FlowKernels::ConsistencyMatchesOpenCV())
+		{
+			FlowKernels::ConsistencyMaskOpenCV(flow, reverse, thres, mask);
+			return;
+		}
+		const int BAND_ROWS = 16;
+		mask.create(flow.size(), CV_8U);
+		const size_t reverseStep = reverse.step / sizeof(float);
+		ParallelUtils::ParallelFor((flow.rows + BAND_ROWS - 1) / BAND_ROWS, numThreads, [&](int band)
+		{
+			const int y1 = std::min(flow.rows, (band + 1) * BAND_ROWS);
+			for (int y = band * BAND_ROWS; y < y1; y++)
+				FlowKernels::ConsistencyMaskRow(flow.ptr<float>(y), flow.cols, y, reverse.ptr<float>(), reverseStep,
+					reverse.cols, reverse.rows, (float)thres, mask.ptr<uchar>(y));
+		});
+	}
+
+	inline cv::Mat ComputeConsistencyMask(cv::Mat flow, cv::Mat reverse, double thres, int numThreads = 1)
+	{
+		cv::Mat mask;
+		ComputeConsistencyMask(flow, reverse, thres, mask, numThreads);
+		return mask;
 	}
 
 	template <typename T>
@@ -102,9 +234,9 @@ namespace CvUtils
 	{
 		return (T)std::stod(str);
 	}
-	template <> float convertStringToValue(std::string str) { return std::stof(str); }
-	template <> int convertStringToValue(std::string str) { return std::stoi(str); }
-	template <> std::string convertStringToValue(std::string str) { return str; }
+	template <> inline float convertStringToValue(std::string str) { return std::stof(str); }
+	template <> inline int convertStringToValue(std::string str) { return std::stoi(str); }
+	template <> inline std::string convertStringToValue(std::string str) { return str; }
 
 
 
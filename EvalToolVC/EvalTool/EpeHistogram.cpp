@@ -0,0 +1,65 @@
+#include "EpeHistogram.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace EpeHistogram
+{
+	// lower edge of a bin; the upper edge is that of the next one. Bins from infinity up
+	// have NaN edges, so errors there never count as within a threshold.
+	static float bin_edge(int bin)
+	{
+		if (bin >= NUM_BINS)
+			return std::numeric_limits<float>::quiet_NaN();
+		unsigned bits = (unsigned)bin << 15;
+		float edge;
+		memcpy(&edge, &bits, sizeof(edge));
+		return edge;
+	}
+
+	void Histogram::Build(const unsigned* dense)
+	{
+		valid = 0;
+		bins.clear();
+		counts.clear();
+		for (int b = 0; b < NUM_BINS; b++)
+		if (dense[b] > 0)
+		{
+			bins.push_back((unsigned short)b);
+			counts.push_back(dense[b]);
+			valid += dense[b];
+		}
+	}
+
+	std::vector<double> Histogram::Accuracy(const std::vector<float>& thresholds) const
+	{
+		const int T = (int)thresholds.size();
+		std::vector<double> accuracy(T, 0.0);
+		if (valid <= 0)
+			return accuracy;
+
+		// one sweep over the bins in the order of the thresholds
+		std::vector<int> order(T);
+		for (int i = 0; i < T; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](int a, int b){ return thresholds[a] < thresholds[b]; });
+
+		const int nb = (int)bins.size();
+		long long within = 0;
+		int k = 0;
+		for (int i : order)
+		{
+			const float t = thresholds[i];
+			while (k < nb && bin_edge(bins[k] + 1) <= t)
+				within += counts[k++];
+			double partial = 0;
+			if (k < nb && bin_edge(bins[k]) <= t)
+			{
+				const double lo = bin_edge(bins[k]), hi = bin_edge(bins[k] + 1);
+				partial = counts[k] * (t - lo) / (hi - lo);
+			}
+			accuracy[i] = (within + partial) / (double)valid;
+		}
+		return accuracy;
+	}
+}
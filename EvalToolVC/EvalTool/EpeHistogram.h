@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <string.h>
+
+// Histogram of the end-point errors of the GT-valid pixels of one flow, fine enough to
+// compute the flow accuracy for any threshold afterwards (-saveHistograms, -mode rescore).
+//
+// A bin holds the errors whose float representation shares the upper 16 bits, i.e. the
+// exponent and the top 8 bits of the mantissa, so the bins are 1/256 of an octave wide
+// (0.4% of the error) at any scale, and there are at most 65536 of them.
+namespace EpeHistogram
+{
+	const int NUM_BINS = 1 << 16;
+
+	// bin of a non-negative error
+	inline int Bin(float err)
+	{
+		unsigned bits;
+		memcpy(&bits, &err, sizeof(bits));
+		return (int)(bits >> 15) & (NUM_BINS - 1);
+	}
+
+	struct Histogram
+	{
+		long long valid;                    // GT-valid pixels, 0 if there was no flow
+		double scale;                       // image size that relative thresholds refer to
+		std::vector<unsigned short> bins;   // non-empty bins in increasing order
+		std::vector<unsigned> counts;       // pixels of each of them
+
+		Histogram() : valid(0), scale(0) {}
+
+		// Keeps the non-empty bins of a dense histogram of NUM_BINS counts.
+		void Build(const unsigned* dense);
+
+		// Rate of pixels whose error is not greater than each threshold (in pixels). The
+		// pixels of the bin a threshold falls into are split linearly over the bin.
+		std::vector<double> Accuracy(const std::vector<float>& thresholds) const;
+	};
+}
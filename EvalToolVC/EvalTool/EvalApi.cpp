@@ -0,0 +1,150 @@
+#include "EvalApi.h"
+#include "Evaluation.h"
+#include "PairData.h"
+
+#include <memory>
+
+static_assert(EVALTOOL_NUM_THRESHOLDS == Evaluation::NUM_THRESHOLDS, "threshold count of the C interface");
+
+struct evaltool_evaluator
+{
+	Evaluation::Evaluator evaluator;
+
+	explicit evaltool_evaluator(const Evaluation::Options& options) : evaluator(options) {}
+};
+
+struct evaltool_gt
+{
+	GTCache::PairGT gt;
+};
+
+// Wraps a caller buffer without copying it. Returns false for an invalid view.
+static bool flow_view(const evaltool_flow* view, cv::Mat& flow)
+{
+	flow = cv::Mat();
+	if (!view || !view->data)
+		return true;
+	const size_t minStride = (size_t)view->width * 2 * sizeof(float);
+	const size_t stride = view->stride ? view->stride : minStride;
+	if (view->width <= 0 || view->height <= 0 || stride < minStride || stride % sizeof(float) != 0)
+		return false;
+	flow = cv::Mat(view->height, view->width, CV_32FC2, (void*)view->data, stride);
+	return true;
+}
+
+static bool mask_view(const evaltool_mask* view, cv::Mat& mask)
+{
+	mask = cv::Mat();
+	if (!view || !view->data)
+		return true;
+	const size_t stride = view->stride ? view->stride : (size_t)view->width;
+	if (view->width <= 0 || view->height <= 0 || stride < (size_t)view->width)
+		return false;
+	mask = cv::Mat(view->height, view->width, CV_8U, (void*)view->data, stride);
+	return true;
+}
+
+void evaltool_default_options(evaltool_options* options)
+{
+	if (!options)
+		return;
+	options->auto_flip = 0;
+	options->use_prec = 0;
+	options->num_threads = 1;
+}
+
+evaltool_evaluator* evaltool_create(const evaltool_options* options)
+{
+	evaltool_options o;
+	evaltool_default_options(&o);
+	if (options)
+		o = *options;
+
+	Evaluation::Options eo;
+	eo.autoFlip = o.auto_flip != 0;
+	eo.usePrec = o.use_prec != 0;
+	eo.numThreads = std::max(o.num_threads, 1);
+	try
+	{
+		return new evaltool_evaluator(eo);
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+void evaltool_destroy(evaltool_evaluator* evaluator)
+{
+	delete evaluator;
+}
+
+evaltool_gt* evaltool_gt_create(const evaltool_flow* flow1, const evaltool_flow* flow2,
+	const evaltool_mask* mask1, const evaltool_mask* mask2, int flip)
+{
+	cv::Mat f1, f2, m1, m2;
+	if (!flow_view(flow1, f1) || !flow_view(flow2, f2) || !mask_view(mask1, m1) || !mask_view(mask2, m2))
+		return NULL;
+	try
+	{
+		std::unique_ptr<evaltool_gt> gt(new evaltool_gt);
+		// masks are packed into new buffers unless they are not 0/255, flows are referenced
+		Evaluation::MakeGroundTruth(f1.clone(), f2.clone(), m1, m2, flip, gt->gt);
+		if (!gt->gt.mask1.empty()) gt->gt.mask1 = gt->gt.mask1.clone();
+		if (!gt->gt.mask2.empty()) gt->gt.mask2 = gt->gt.mask2.clone();
+		return gt.release();
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+evaltool_gt* evaltool_gt_load(const char* dir)
+{
+	if (!dir)
+		return NULL;
+	try
+	{
+		std::unique_ptr<evaltool_gt> gt(new evaltool_gt);
+		if (PairData::LoadGroundTruth(dir, gt->gt))
+			return gt.release();
+	}
+	catch (...)
+	{
+	}
+	return NULL;
+}
+
+void evaltool_gt_destroy(evaltool_gt* gt)
+{
+	delete gt;
+}
+
+int evaltool_evaluate(const evaltool_evaluator* evaluator, const evaltool_gt* gt,
+	const evaltool_flow* flow1, const evaltool_flow* flow2,
+	const evaltool_mask* mask1, const evaltool_mask* mask2, evaltool_scores* scores)
+{
+	cv::Mat f1, f2, m1, m2;
+	if (!evaluator || !gt || !scores ||
+		!flow_view(flow1, f1) || !flow_view(flow2, f2) || !mask_view(mask1, m1) || !mask_view(mask2, m2))
+		return EVALTOOL_INVALID_ARGUMENT;
+	if (gt->gt.empty())
+		return EVALTOOL_EMPTY_GT;
+
+	try
+	{
+		ScoreCache::PairScore s = evaluator->evaluator.Evaluate(gt->gt, f1, f2, m1, m2);
+		scores->flip = s.flip;
+		for (int i = 0; i <= EVALTOOL_NUM_THRESHOLDS; i++)
+		{
+			scores->score1[i] = s.score1(i);
+			scores->score2[i] = s.score2(i);
+		}
+		return EVALTOOL_OK;
+	}
+	catch (...)
+	{
+		return EVALTOOL_FAILED;
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <stddef.h>
+
+// C interface of the evaluation library (EvalLib), for scoring flows and masks held in memory
+// by the caller without writing them to files. All functions may be called from any thread;
+// an evaluator and a ground truth may be shared by concurrent evaluations.
+//
+// Flows are CV_32FC2 images: width * height interleaved (u, v) floats per row, rows stride
+// bytes apart (0: width * 8). Masks are 8-bit images, non-zero for the foreground, rows stride
+// bytes apart (0: width). Buffers passed to evaltool_evaluate are only read and not retained.
+
+#ifdef _WIN32
+#ifdef EVALTOOL_EXPORTS
+#define EVALTOOL_API __declspec(dllexport)
+#else
+#define EVALTOOL_API __declspec(dllimport)
+#endif
+#else
+#define EVALTOOL_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// number of flow accuracy thresholds, 1% to 50% of the image size
+#define EVALTOOL_NUM_THRESHOLDS 50
+
+enum evaltool_status
+{
+	EVALTOOL_OK = 0,
+	EVALTOOL_INVALID_ARGUMENT = 1,   // a NULL handle or a view with an invalid size or stride
+	EVALTOOL_EMPTY_GT = 2,           // the ground truth lacks a flow or a mask
+	EVALTOOL_FAILED = 3              // the evaluation raised an error
+};
+
+typedef struct evaltool_evaluator evaltool_evaluator;
+typedef struct evaltool_gt evaltool_gt;
+
+typedef struct evaltool_options
+{
+	int auto_flip;     // -autoFlip
+	int use_prec;      // -usePrec
+	int num_threads;   // threads used within one evaluation
+} evaltool_options;
+
+typedef struct evaltool_flow
+{
+	const float* data;   // NULL: no flow
+	int width, height;
+	size_t stride;
+} evaltool_flow;
+
+typedef struct evaltool_mask
+{
+	const unsigned char* data;   // NULL: no mask, one is computed from the flows
+	int width, height;
+	size_t stride;
+} evaltool_mask;
+
+// Scores of a pair as in scores.csv: the segmentation score, then the flow accuracies.
+typedef struct evaltool_scores
+{
+	int flip;   // flip_gt.txt of the pair
+	double score1[EVALTOOL_NUM_THRESHOLDS + 1];   // 1 to 2
+	double score2[EVALTOOL_NUM_THRESHOLDS + 1];   // 2 to 1
+} evaltool_scores;
+
+EVALTOOL_API void evaltool_default_options(evaltool_options* options);
+
+// NULL options: the defaults. Returns NULL on an error.
+EVALTOOL_API evaltool_evaluator* evaltool_create(const evaltool_options* options);
+EVALTOOL_API void evaltool_destroy(evaltool_evaluator* evaluator);
+
+// Ground truth of a pair from memory. The buffers are copied, so they may be released afterwards.
+EVALTOOL_API evaltool_gt* evaltool_gt_create(const evaltool_flow* flow1, const evaltool_flow* flow2,
+	const evaltool_mask* mask1, const evaltool_mask* mask2, int flip);
+
+// Ground truth of a pair directory of the dataset, NULL if it lacks a flow or a mask.
+EVALTOOL_API evaltool_gt* evaltool_gt_load(const char* dir);
+EVALTOOL_API void evaltool_gt_destroy(evaltool_gt* gt);
+
+// Scores the flows and masks of a pair against its ground truth. Any of them may be NULL,
+// and the flows are scored only as a pair.
+EVALTOOL_API int evaltool_evaluate(const evaltool_evaluator* evaluator, const evaltool_gt* gt,
+	const evaltool_flow* flow1, const evaltool_flow* flow2,
+	const evaltool_mask* mask1, const evaltool_mask* mask2, evaltool_scores* scores);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+// Messages between -mode serve and its clients, sent as LocalSocket messages. Values are
+// little-endian; an int is 4 bytes, a double 8, and a string is an int length followed by
+// its bytes.
+//
+// Request:
+//   int type, followed by
+//   EVALUATE_DIR    string: a results directory as seen by the server (pair directories
+//                   holding flow1.flo, flow2.flo and optionally mask1.png and mask2.png)
+//   EVALUATE_FLOWS  int: number of pairs, then for each pair
+//                     string: pair name, as in the dataset
+//                     flow1, flow2: int rows, int cols, rows * cols * 2 floats (u, v)
+//                     mask1, mask2: int rows, int cols, rows * cols bytes (rows 0: no mask)
+//                   flows with rows 0 are scored as missing
+//   STATUS, SHUTDOWN  nothing
+//
+// Reply:
+//   int status (0: ok, otherwise the request failed), string message
+//   for an evaluation that succeeded, then
+//     int usePrec: 1 if the segmentation score is the precision (SegPrec), 0 for IoU (SegIUR)
+//     int autoFlip: 1 if given masks were flipped when their inverse matched better
+//     int T: number of flow accuracy thresholds (1% to T% of the image size)
+//     int N: number of scored pairs (pairs that are not in the dataset are skipped)
+//     N times: string pair name, string image 1, string image 2, int flip,
+//              (T + 1) doubles for 1 to 2 and (T + 1) doubles for 2 to 1
+//              (the segmentation score, then the flow accuracies)
+//     int number of pairs without flip,
+//     (T + 1) doubles: averages over all pairs, (T + 1) doubles: over the pairs without flip
+//   These are the rows and averages of scores.csv.
+namespace EvalProtocol
+{
+	enum RequestType
+	{
+		EVALUATE_DIR = 1,
+		EVALUATE_FLOWS = 2,
+		STATUS = 3,
+		SHUTDOWN = 4
+	};
+}
@@ -0,0 +1,178 @@
+#include "Evaluation.h"
+#include "CvUtils.h"
+#include "Resampler.h"
+#include "Profiler.h"
+
+namespace Evaluation
+{
+	// arena slots of Evaluate
+	enum { FLOW1_SLOT, FLOW2_SLOT, MASK1_SLOT, MASK2_SLOT, HIST_SLOT };
+
+	// hist, if given, receives the error histogram of the flow (empty if there is no flow)
+	static cv::Mat_<double> compute_score(double maskScore, const cv::Mat& flowGT, const cv::Mat& flow, const cv::Mat& thresholds, const cv::Mat& validGT, EpeHistogram::Histogram* hist, BufferArena::Arena* arena)
+	{
+		cv::Mat_<double> s(thresholds.rows + 1, thresholds.cols);
+		s = 0;
+		s.at<double>(0) = maskScore;
+
+		if (!flow.empty())
+		{
+			std::vector<unsigned> dense;
+			unsigned* errorHist = NULL;
+			if (hist && arena)
+				errorHist = (unsigned*)arena->Get(HIST_SLOT, cv::Size(EpeHistogram::NUM_BINS, 1), CV_32S).data;
+			else if (hist)
+			{
+				dense.resize(EpeHistogram::NUM_BINS);
+				errorHist = &dense[0];
+			}
+			cv::Mat_<double> accuracy = CvUtils::ComputeFlowAccuracy(flow, flowGT, thresholds, validGT, errorHist);
+			if (hist)
+				hist->Build(errorHist);
+
+			for (int i = 0; i < thresholds.rows; i++)
+				s.at<double>(i + 1) = accuracy(i);
+		}
+
+		return s;
+	}
+
+	Evaluator::Evaluator(const Options& options) : options(options), thresholds(NUM_THRESHOLDS, 1)
+	{
+		for (int i = 0; i < NUM_THRESHOLDS; i++)
+			thresholds(i) = i + 1;
+	}
+
+	MaskScore Evaluator::ScoreMask(const PackedMask& packedGT, const cv::Mat& maskGT, const cv::Mat& mask) const
+	{
+		MaskCounts c = !packedGT.empty() ? CompareMasks(packedGT, PackedMask(mask)) : CompareMasks(maskGT, mask);
+
+		MaskScore s;
+		if (options.usePrec)
+		{
+			// Precision (accurate pixel rate)
+			s.score = 1.0 - (double)c.diff / c.area;
+			s.inverted = 1.0 - (double)c.diffInv / c.area;
+		}
+		else
+		{
+			// Intersection-over-union
+			s.score = (double)c.inter / c.uni;
+			s.inverted = (double)c.interInv / c.uniInv;
+		}
+		return s;
+	}
+
+	bool Evaluator::ShouldFlip(const MaskScore& s1, const MaskScore& s2)
+	{
+		return s1.score + s2.score < s1.inverted + s2.inverted;
+	}
+
+	ScoreCache::PairScore Evaluator::Evaluate(const GTCache::PairGT& gt, const cv::Mat& flow1In, const cv::Mat& flow2In, const cv::Mat& mask1In, const cv::Mat& mask2In, BufferArena::Arena* arena) const
+	{
+		ScoreCache::PairScore result;
+		if (gt.empty())
+			return result;
+
+		const cv::Mat &flowGT1 = gt.flow1, &flowGT2 = gt.flow2;
+
+		// Resized and computed images go to new buffers or to the arena, so the caller's
+		// flows and masks are never modified.
+		auto scratch = [&](int slot, cv::Size size, int type){ return arena ? arena->Get(slot, size, type) : cv::Mat(); };
+		cv::Mat flow1 = flow1In, flow2 = flow2In, mask1 = mask1In, mask2 = mask2In;
+		{
+			Profiler::Scope scope("resize");
+			if (!mask1.empty() && mask1.size() != gt.MaskSize1())
+			{
+				cv::Mat resized = scratch(MASK1_SLOT, gt.MaskSize1(), CV_8U);
+				Resampler::ResizeMask(mask1, resized, gt.MaskSize1(), 128, options.numThreads);
+				mask1 = resized;
+			}
+			if (!mask2.empty() && mask2.size() != gt.MaskSize2())
+			{
+				cv::Mat resized = scratch(MASK2_SLOT, gt.MaskSize2(), CV_8U);
+				Resampler::ResizeMask(mask2, resized, gt.MaskSize2(), 128, options.numThreads);
+				mask2 = resized;
+			}
+
+			if (flow1.empty() || flow2.empty())
+			{
+				flow1 = cv::Mat();
+				flow2 = cv::Mat();
+			}
+			else if (flow1.size() != flowGT1.size() || flow2.size() != flowGT2.size())
+			{
+				// as CvUtils::ResizeFlowPair
+				cv::Mat resized1 = scratch(FLOW1_SLOT, flowGT1.size(), CV_32FC2);
+				cv::Mat resized2 = scratch(FLOW2_SLOT, flowGT2.size(), CV_32FC2);
+				CvUtils::ResizeFlow(flow1, resized1, flow1.size(), flow2.size(), flowGT1.size(), flowGT2.size(), options.numThreads);
+				CvUtils::ResizeFlow(flow2, resized2, flow2.size(), flow1.size(), flowGT2.size(), flowGT1.size(), options.numThreads);
+				flow1 = resized1;
+				flow2 = resized2;
+			}
+		}
+
+		// autoFlip applies only to given masks, not to masks computed from flows.
+		const bool hasMasks = !mask1.empty() && !mask2.empty();
+		if (!hasMasks && !flow1.empty())
+		{
+			Profiler::Scope scope("mask from flow");
+			mask1 = scratch(MASK1_SLOT, flow1.size(), CV_8U);
+			mask2 = scratch(MASK2_SLOT, flow2.size(), CV_8U);
+			ComputeMaskFromFlow(flow1, flow2, mask1, mask2, CONSISTENCY_THRESHOLD, options.numThreads);
+		}
+		else if (!hasMasks)
+		{
+			mask1 = cv::Mat();
+			mask2 = cv::Mat();
+		}
+
+		MaskScore maskScore1, maskScore2;
+		{
+			Profiler::Scope scope("mask score/flip");
+			if (!mask1.empty()) maskScore1 = ScoreMask(gt.packedMask1, gt.mask1, mask1);
+			if (!mask2.empty()) maskScore2 = ScoreMask(gt.packedMask2, gt.mask2, mask2);
+			if (options.autoFlip && hasMasks && ShouldFlip(maskScore1, maskScore2))
+			{
+				std::swap(maskScore1.score, maskScore1.inverted);
+				std::swap(maskScore2.score, maskScore2.inverted);
+			}
+		}
+
+		Profiler::Scope scope("flow score");
+		result.hist1.scale = (double)std::max(flowGT2.rows, flowGT2.cols);
+		result.hist2.scale = (double)std::max(flowGT1.rows, flowGT1.cols);
+		result.score1 = compute_score(maskScore1.score, flowGT1, flow1, thresholds / 100.0 * result.hist1.scale, gt.valid1, options.keepHistograms ? &result.hist1 : NULL, arena);
+		result.score2 = compute_score(maskScore2.score, flowGT2, flow2, thresholds / 100.0 * result.hist2.scale, gt.valid2, options.keepHistograms ? &result.hist2 : NULL, arena);
+		result.name1 = gt.name1;
+		result.name2 = gt.name2;
+		result.flip = gt.flip;
+		result.valid = true;
+		return result;
+	}
+
+	void ComputeMaskFromFlow(const cv::Mat& flow1, const cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2, double thres, int numThreads)
+	{
+		if (flow1.empty() || flow2.empty()){
+			mask1 = cv::Mat();
+			mask2 = cv::Mat();
+			return;
+		}
+
+		CvUtils::ComputeConsistencyMask(flow1, flow2, thres, mask1, numThreads);
+		CvUtils::ComputeConsistencyMask(flow2, flow1, thres, mask2, numThreads);
+	}
+
+	void MakeGroundTruth(const cv::Mat& flow1, const cv::Mat& flow2, const cv::Mat& mask1, const cv::Mat& mask2, int flip, GTCache::PairGT& gt)
+	{
+		gt = GTCache::PairGT();
+		gt.SetMasks(mask1, mask2);
+		gt.flip = flip;
+		if (flow1.empty() || flow2.empty())
+			return;
+		gt.flow1 = flow1;
+		gt.flow2 = flow2;
+		gt.valid1 = CvUtils::ComputeValidFlowMask(gt.flow1);
+		gt.valid2 = CvUtils::ComputeValidFlowMask(gt.flow2);
+	}
+}
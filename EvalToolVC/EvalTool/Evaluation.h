@@ -0,0 +1,73 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+#include "GTCache.h"
+#include "PackedMask.h"
+#include "ScoreCache.h"
+#include "BufferArena.h"
+
+// Scoring of the flows and masks of one image pair against its ground truth, independent
+// of how either was loaded. An Evaluator holds its options and is not modified by Evaluate,
+// so one instance may score pairs from any number of threads. Flows and masks are only
+// read, and may be views over caller-owned buffers with any row stride.
+namespace Evaluation
+{
+	// number of flow accuracy thresholds, 1% to 50% of the image size
+	const int NUM_THRESHOLDS = 50;
+
+	// flows that disagree with the reverse flow by more than this many pixels are background
+	const double CONSISTENCY_THRESHOLD = 20;
+
+	struct Options
+	{
+		bool autoFlip;          // flip given masks when their inverse matches the GT better
+		bool usePrec;           // score masks by precision instead of intersection-over-union
+		bool keepHistograms;    // fill PairScore::hist1 and hist2 (-saveHistograms)
+		int numThreads;         // threads used within one pair (resizing, masks from flows)
+
+		Options() : autoFlip(false), usePrec(false), keepHistograms(false), numThreads(1) {}
+	};
+
+	// Segmentation score of a mask and of its inverse, as used by autoFlip
+	struct MaskScore
+	{
+		double score, inverted;
+
+		MaskScore() : score(0), inverted(0) {}
+	};
+
+	class Evaluator
+	{
+		Options options;
+		cv::Mat_<double> thresholds;   // 1...NUM_THRESHOLDS
+
+	public:
+		explicit Evaluator(const Options& options = Options());
+
+		const Options& GetOptions() const { return options; }
+
+		// flow accuracy thresholds in percent of the image size
+		const cv::Mat_<double>& Thresholds() const { return thresholds; }
+
+		// Scores a pair: resizes the flows and masks to the GT, computes masks from the flows
+		// when either mask is missing, and applies autoFlip. Flows are scored only as a pair.
+		// Returns an invalid score if the GT is empty. With an arena (one per calling thread),
+		// the resized flows and masks and the other large temporaries are taken from it.
+		ScoreCache::PairScore Evaluate(const GTCache::PairGT& gt, const cv::Mat& flow1, const cv::Mat& flow2, const cv::Mat& mask1, const cv::Mat& mask2, BufferArena::Arena* arena = NULL) const;
+
+		// Scores a mask against the GT mask. A packed GT mask gives all counts from one pass over
+		// the bits of both masks; GT masks that are not 0/255 are compared as 8-bit images.
+		MaskScore ScoreMask(const PackedMask& packedGT, const cv::Mat& maskGT, const cv::Mat& mask) const;
+
+		// Decides from the scores of both masks whether the foreground labels should be flipped.
+		static bool ShouldFlip(const MaskScore& s1, const MaskScore& s2);
+	};
+
+	// Forward-backward consistency masks of a flow pair, used when no masks are given.
+	// mask1 and mask2 are written in place if they already have the size of the flows.
+	void ComputeMaskFromFlow(const cv::Mat& flow1, const cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2, double thres, int numThreads = 1);
+
+	// Builds the ground truth of a pair from decoded flows and masks, as PairData::DecodeGroundTruth
+	// does from files. The flows are referenced, not copied.
+	void MakeGroundTruth(const cv::Mat& flow1, const cv::Mat& flow2, const cv::Mat& mask1, const cv::Mat& mask2, int flip, GTCache::PairGT& gt);
+}
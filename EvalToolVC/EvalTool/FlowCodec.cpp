@@ -0,0 +1,396 @@
+#include "FlowCodec.h"
+#include "FlowIO.h"
+#include "ParallelUtils.h"
+
+#include <string.h>
+#include <stdint.h>
+
+namespace FlowCodec
+{
+	static const unsigned char TAG[4] = { 'C', 'F', 'L', 'O' };
+	static const unsigned char VERSION = 1;
+	static const float UNKNOWN = 1e10f;
+
+	// rANS with 12-bit probabilities and a 32-bit state renormalized bytewise
+	static const int PROB_BITS = 12;
+	static const uint32_t PROB_SCALE = 1u << PROB_BITS;
+	static const uint32_t RANS_L = 1u << 23;
+
+	// kinds of coded planes
+	enum { PLANE_CONSTANT = 0, PLANE_RANS = 1, PLANE_RAW = 2 };
+
+	static inline void put_u32(std::vector<unsigned char>& out, uint32_t v)
+	{
+		for (int i = 0; i < 4; i++)
+			out.push_back((unsigned char)(v >> (8 * i)));
+	}
+
+	static inline uint32_t get_u32(const unsigned char* p)
+	{
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	static inline uint32_t zigzag(int32_t d)
+	{
+		return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+	}
+
+	static inline int32_t unzigzag(uint32_t u)
+	{
+		return (int32_t)((u >> 1) ^ (0u - (u & 1)));
+	}
+
+	// frequencies summing to PROB_SCALE, at least 1 for every symbol present
+	static void normalize_freqs(const uint32_t counts[256], size_t n, uint32_t freqs[256])
+	{
+		int64_t sum = 0;
+		int maxSym = 0;
+		for (int s = 0; s < 256; s++)
+		{
+			freqs[s] = counts[s] ? std::max<uint32_t>(1, (uint32_t)((uint64_t)counts[s] * PROB_SCALE / n)) : 0;
+			sum += freqs[s];
+			if (freqs[s] > freqs[maxSym])
+				maxSym = s;
+		}
+		int64_t diff = (int64_t)PROB_SCALE - sum;
+		if (diff > 0)
+			freqs[maxSym] += (uint32_t)diff;
+		while (diff < 0)
+		{
+			int s = 0;
+			for (int t = 1; t < 256; t++)
+			if (freqs[t] > freqs[s])
+				s = t;
+			uint32_t dec = (uint32_t)std::min<int64_t>(freqs[s] - 1, -diff);
+			freqs[s] -= dec;
+			diff += dec;
+		}
+	}
+
+	static void encode_plane(const unsigned char* data, size_t n, std::vector<unsigned char>& out)
+	{
+		uint32_t counts[256] = { 0 };
+		for (size_t i = 0; i < n; i++)
+			counts[data[i]]++;
+
+		int numSymbols = 0;
+		for (int s = 0; s < 256; s++)
+			numSymbols += counts[s] != 0;
+		if (numSymbols <= 1)
+		{
+			out.push_back(PLANE_CONSTANT);
+			out.push_back(n > 0 ? data[0] : 0);
+			return;
+		}
+
+		uint32_t freqs[256], cum[257];
+		normalize_freqs(counts, n, freqs);
+		cum[0] = 0;
+		for (int s = 0; s < 256; s++)
+			cum[s + 1] = cum[s] + freqs[s];
+
+		// symbols are coded in reverse so that the decoder reads them forward
+		std::vector<unsigned char> buf(n * 2 + 16);
+		unsigned char* end = buf.data() + buf.size();
+		unsigned char* ptr = end;
+		uint32_t x = RANS_L;
+		for (size_t i = n; i-- > 0;)
+		{
+			const uint32_t f = freqs[data[i]];
+			const uint32_t xMax = ((RANS_L >> PROB_BITS) << 8) * f;
+			while (x >= xMax) {
+				*--ptr = (unsigned char)x;
+				x >>= 8;
+			}
+			x = ((x / f) << PROB_BITS) + (x % f) + cum[data[i]];
+		}
+		ptr -= 4;
+		for (int i = 0; i < 4; i++)
+			ptr[i] = (unsigned char)(x >> (8 * i));
+
+		const size_t codedSize = end - ptr;
+		const size_t tableSize = 2 + 3 * numSymbols;
+		if (codedSize + tableSize + 4 >= n)
+		{
+			out.push_back(PLANE_RAW);
+			out.insert(out.end(), data, data + n);
+			return;
+		}
+
+		out.push_back(PLANE_RANS);
+		out.push_back((unsigned char)(numSymbols - 1));
+		out.push_back(0);
+		for (int s = 0; s < 256; s++)
+		if (freqs[s])
+		{
+			out.push_back((unsigned char)s);
+			out.push_back((unsigned char)freqs[s]);
+			out.push_back((unsigned char)(freqs[s] >> 8));
+		}
+		put_u32(out, (uint32_t)codedSize);
+		out.insert(out.end(), ptr, end);
+	}
+
+	// Decodes a plane of n bytes starting at p and advances p. Returns false if the data are broken.
+	static bool decode_plane(const unsigned char*& p, const unsigned char* end, unsigned char* data, size_t n)
+	{
+		if (p >= end)
+			return false;
+		const int kind = *p++;
+		if (kind == PLANE_CONSTANT)
+		{
+			if (p >= end)
+				return false;
+			memset(data, *p++, n);
+			return true;
+		}
+		if (kind == PLANE_RAW)
+		{
+			if ((size_t)(end - p) < n)
+				return false;
+			memcpy(data, p, n);
+			p += n;
+			return true;
+		}
+		if (kind != PLANE_RANS || end - p < 2)
+			return false;
+
+		const int numSymbols = p[0] + 1;
+		p += 2;
+		if (end - p < 3 * numSymbols + 4)
+			return false;
+		uint32_t freqs[256] = { 0 }, cum[256] = { 0 };
+		unsigned char slotSymbols[PROB_SCALE];
+		uint32_t total = 0;
+		for (int i = 0; i < numSymbols; i++, p += 3)
+		{
+			const int s = p[0];
+			const uint32_t f = p[1] | ((uint32_t)p[2] << 8);
+			if (f == 0 || freqs[s] != 0 || total + f > PROB_SCALE)
+				return false;
+			freqs[s] = f;
+			cum[s] = total;
+			memset(slotSymbols + total, s, f);
+			total += f;
+		}
+		if (total != PROB_SCALE)
+			return false;
+
+		const uint32_t codedSize = get_u32(p);
+		p += 4;
+		if (codedSize < 4 || (size_t)(end - p) < codedSize)
+			return false;
+		const unsigned char* in = p + 4;
+		const unsigned char* inEnd = p + codedSize;
+		uint32_t x = get_u32(p);
+		for (size_t i = 0; i < n; i++)
+		{
+			const uint32_t slot = x & (PROB_SCALE - 1);
+			const unsigned char s = slotSymbols[slot];
+			data[i] = s;
+			x = freqs[s] * (x >> PROB_BITS) + slot - cum[s];
+			while (x < RANS_L)
+			{
+				if (in >= inEnd)
+					return false;
+				x = (x << 8) | *in++;
+			}
+		}
+		p = inEnd;
+		return in == inEnd && x == RANS_L;
+	}
+
+	// integer coded for a value: its bit pattern, or its multiple of the step
+	static inline uint32_t value_bits(float v, float step)
+	{
+		if (step <= 0)
+		{
+			uint32_t bits;
+			memcpy(&bits, &v, sizeof(bits));
+			return bits;
+		}
+		const double q = std::min(std::max((double)v / step, -1073741824.0), 1073741824.0);
+		return (uint32_t)cvRound(q);
+	}
+
+	static inline float bits_value(uint32_t bits, float step)
+	{
+		if (step <= 0)
+		{
+			float v;
+			memcpy(&v, &bits, sizeof(v));
+			return v;
+		}
+		return (int32_t)bits * step;
+	}
+
+	static void encode_block(const cv::Mat& flow, int y0, int y1, float step, std::vector<unsigned char>& out)
+	{
+		const int width = flow.cols, rows = y1 - y0;
+		const size_t bitmapRow = (width + 7) / 8;
+		const size_t n = (size_t)width * rows;
+		std::vector<unsigned char> planes(bitmapRow * rows + 8 * n, 0);
+		unsigned char* bitmap = planes.data();
+		unsigned char* bytes = bitmap + bitmapRow * rows;
+
+		for (int y = y0; y < y1; y++)
+		{
+			const float* f = flow.ptr<float>(y);
+			unsigned char* bits = bitmap + (y - y0) * bitmapRow;
+			const size_t i0 = (size_t)(y - y0) * width;
+			uint32_t prev[2] = { 0, 0 };
+			for (int x = 0; x < width; x++, f += 2)
+			{
+				const bool unknown = FlowIO::unknown_flow(f[0], f[1]);
+				if (unknown)
+					bits[x >> 3] |= (unsigned char)(1 << (x & 7));
+				for (int c = 0; c < 2; c++)
+				{
+					// unknown values are coded as 0, which keeps the differences small
+					const uint32_t v = unknown ? 0 : value_bits(f[c], step);
+					const uint32_t r = zigzag((int32_t)(v - prev[c]));
+					prev[c] = v;
+					for (int b = 0; b < 4; b++)
+						bytes[(c * 4 + b) * n + i0 + x] = (unsigned char)(r >> (8 * b));
+				}
+			}
+		}
+
+		encode_plane(bitmap, bitmapRow * rows, out);
+		for (int p = 0; p < 8; p++)
+			encode_plane(bytes + p * n, n, out);
+	}
+
+	static bool decode_block(const unsigned char* p, const unsigned char* end, cv::Mat& flow, int y0, int y1, float step)
+	{
+		const int width = flow.cols, rows = y1 - y0;
+		const size_t bitmapRow = (width + 7) / 8;
+		const size_t n = (size_t)width * rows;
+		std::vector<unsigned char> planes(bitmapRow * rows + 8 * n);
+		unsigned char* bitmap = planes.data();
+		unsigned char* bytes = bitmap + bitmapRow * rows;
+
+		if (!decode_plane(p, end, bitmap, bitmapRow * rows))
+			return false;
+		for (int i = 0; i < 8; i++)
+		if (!decode_plane(p, end, bytes + i * n, n))
+			return false;
+		if (p != end)
+			return false;
+
+		for (int y = y0; y < y1; y++)
+		{
+			float* f = flow.ptr<float>(y);
+			const unsigned char* bits = bitmap + (y - y0) * bitmapRow;
+			const size_t i0 = (size_t)(y - y0) * width;
+			uint32_t prev[2] = { 0, 0 };
+			for (int x = 0; x < width; x++, f += 2)
+			{
+				const bool unknown = (bits[x >> 3] >> (x & 7)) & 1;
+				for (int c = 0; c < 2; c++)
+				{
+					const unsigned char* b = bytes + c * 4 * n + i0 + x;
+					const uint32_t r = b[0] | ((uint32_t)b[n] << 8) | ((uint32_t)b[2 * n] << 16) | ((uint32_t)b[3 * n] << 24);
+					prev[c] += (uint32_t)unzigzag(r);
+					f[c] = unknown ? UNKNOWN : bits_value(prev[c], step);
+				}
+			}
+		}
+		return true;
+	}
+
+	bool IsCompressed(const unsigned char* data, size_t size)
+	{
+		return data != NULL && size >= 4 && memcmp(data, TAG, 4) == 0;
+	}
+
+	bool CheckHeader(const unsigned char* data, size_t size, long long fileSize, int& width, int& height)
+	{
+		if (size < HEADER_SIZE || !IsCompressed(data, size) || data[4] != VERSION || data[5] > 1)
+			return false;
+		width = (int)get_u32(data + 8);
+		height = (int)get_u32(data + 12);
+		const int rowsPerBlock = (int)get_u32(data + 20);
+		const int numBlocks = (int)get_u32(data + 24);
+		if (width < 1 || width > 99999 || height < 1 || height > 99999 || rowsPerBlock < 1)
+			return false;
+		if (numBlocks != (height + rowsPerBlock - 1) / rowsPerBlock)
+			return false;
+
+		const long long tableEnd = HEADER_SIZE + 4LL * numBlocks;
+		if (fileSize < tableEnd)
+			return false;
+		if ((long long)size < tableEnd)
+			return true;   // only the header is available
+		long long total = tableEnd;
+		for (int b = 0; b < numBlocks; b++)
+			total += get_u32(data + HEADER_SIZE + 4 * b);
+		return total == fileSize;
+	}
+
+	void Encode(const cv::Mat& flow, std::vector<unsigned char>& out, const Options& options, int numThreads)
+	{
+		CV_Assert(flow.type() == CV_32FC2);
+		const int rowsPerBlock = std::max(options.rowsPerBlock, 1);
+		const float step = std::max(options.step, 0.0f);
+		const int numBlocks = (flow.rows + rowsPerBlock - 1) / rowsPerBlock;
+
+		std::vector<std::vector<unsigned char> > blocks(numBlocks);
+		ParallelUtils::ParallelFor(numBlocks, numThreads, [&](int b)
+		{
+			encode_block(flow, b * rowsPerBlock, std::min(flow.rows, (b + 1) * rowsPerBlock), step, blocks[b]);
+		});
+
+		out.clear();
+		out.insert(out.end(), TAG, TAG + 4);
+		out.push_back(VERSION);
+		out.push_back(step > 0 ? 1 : 0);
+		out.push_back(0);
+		out.push_back(0);
+		put_u32(out, (uint32_t)flow.cols);
+		put_u32(out, (uint32_t)flow.rows);
+		uint32_t stepBits;
+		memcpy(&stepBits, &step, sizeof(stepBits));
+		put_u32(out, stepBits);
+		put_u32(out, (uint32_t)rowsPerBlock);
+		put_u32(out, (uint32_t)numBlocks);
+		put_u32(out, 0);
+		for (const auto& block : blocks)
+			put_u32(out, (uint32_t)block.size());
+		for (const auto& block : blocks)
+			out.insert(out.end(), block.begin(), block.end());
+	}
+
+	bool Decode(const unsigned char* data, size_t size, cv::Mat& flow, int numThreads)
+	{
+		int width, height;
+		if (!CheckHeader(data, size, (long long)size, width, height))
+			return false;
+		float step;
+		const uint32_t stepBits = get_u32(data + 16);
+		memcpy(&step, &stepBits, sizeof(step));
+		if (data[5] == 0)
+			step = 0;
+		else if (!(step > 0))
+			return false;
+		const int rowsPerBlock = (int)get_u32(data + 20);
+		const int numBlocks = (int)get_u32(data + 24);
+
+		std::vector<size_t> offsets(numBlocks + 1);
+		offsets[0] = HEADER_SIZE + 4 * (size_t)numBlocks;
+		for (int b = 0; b < numBlocks; b++)
+			offsets[b + 1] = offsets[b] + get_u32(data + HEADER_SIZE + 4 * b);
+
+		cv::Mat decoded(height, width, CV_32FC2);
+		std::vector<char> ok(numBlocks, 0);
+		ParallelUtils::ParallelFor(numBlocks, numThreads, [&](int b)
+		{
+			ok[b] = decode_block(data + offsets[b], data + offsets[b + 1], decoded, b * rowsPerBlock, std::min(height, (b + 1) * rowsPerBlock), step);
+		});
+		for (char o : ok)
+		if (!o)
+			return false;
+		flow = decoded;
+		return true;
+	}
+}
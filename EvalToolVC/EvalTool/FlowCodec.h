@@ -0,0 +1,52 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Compressed container for 2-band flow images, read by FlowIO wherever a .flo file is expected.
+//
+//  bytes  contents
+//
+//  0-3     tag: "CFLO"
+//  4       version (1)
+//  5       mode: 0 lossless, 1 quantized
+//  6-7     reserved (0)
+//  8-11    width as an integer
+//  12-15   height as an integer
+//  16-19   quantization step as a float (0 if lossless)
+//  20-23   rows per block as an integer
+//  24-27   number of blocks as an integer
+//  28-31   reserved (0)
+//  32-     compressed size of each block as an unsigned integer, then the blocks
+//
+// Blocks of rows are coded independently, so they are encoded and decoded in parallel.
+// A block holds the bitmap of its unknown flows and, for each of u and v, the four byte
+// planes of the differences between horizontally adjacent values, each plane entropy
+// coded with its own order-0 rANS table. Lossless mode codes the bit patterns of the
+// floats; quantized mode codes the values rounded to multiples of the step.
+// Unknown flows are decoded as 1e10.
+namespace FlowCodec
+{
+	struct Options
+	{
+		float step;          // quantization step in pixels, 0 for lossless
+		int rowsPerBlock;
+
+		Options() : step(0), rowsPerBlock(64) {}
+	};
+
+	// size of the fixed header in bytes
+	const int HEADER_SIZE = 32;
+
+	// true if data starts with the tag of the container
+	bool IsCompressed(const unsigned char* data, size_t size);
+
+	// Checks the header in the first 'size' bytes of a container of fileSize bytes. If they
+	// include the block table, the block sizes also have to add up to fileSize.
+	bool CheckHeader(const unsigned char* data, size_t size, long long fileSize, int& width, int& height);
+
+	// Compresses a CV_32FC2 flow, on numThreads workers (<= 0: one per core).
+	void Encode(const cv::Mat& flow, std::vector<unsigned char>& out, const Options& options = Options(), int numThreads = 1);
+
+	// Decodes a whole container into a new CV_32FC2 image. Returns false if the data are broken.
+	bool Decode(const unsigned char* data, size_t size, cv::Mat& flow, int numThreads = 1);
+}
@@ -18,6 +18,8 @@
 //          the float values for u and v, interleaved, in row order, i.e.,
 //          u[row0,col0], v[row0,col0], u[row0,col1], v[row0,col1], ...
 //
+// The readers below also accept the compressed container of FlowCodec.h in place of a .flo file.
+//
 
 
 // first four bytes, should be the same in little endian
@@ -28,7 +30,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include "flowIO.h"
+#include <cmath>
+#include "FlowIO.h"
+#include "MappedFile.h"
+#include "ParallelUtils.h"
+#include "FlowCodec.h"
 
 using namespace FlowIO;
 
@@ -71,6 +77,9 @@ void makecolorwheel()
 	for (i = 0; i < MR; i++) setcols(255, 0, 255 - 255 * i / MR, k++);
 }
 
+// The color wheel is built during static initialization, before any thread renders with it.
+static struct ColorWheelInit { ColorWheelInit() { makecolorwheel(); } } colorWheelInit;
+
 void FlowIO::computeColor(float fx, float fy, uchar *pix)
 {
 	if (ncols == 0)
@@ -100,7 +109,7 @@ void FlowIO::computeColor(float fx, float fy, uchar *pix)
 bool FlowIO::unknown_flow(float u, float v) {
 	return (fabs(u) >  FlowIO::UNKNOWN_FLOW_THRESH)
 	|| (fabs(v) >  FlowIO::UNKNOWN_FLOW_THRESH)
-	|| isnan(u) || isnan(v);
+	|| std::isnan(u) || std::isnan(v);
 }
 
 bool FlowIO::unknown_flow(float *f) {
@@ -136,7 +145,23 @@ void FlowIO::ReadFlowFile(cv::Mat& img, const char* filename)
     FILE *stream = fopen(filename, "rb");
     if (stream == 0)
         throw CError("ReadFlowFile: could not open %s", filename);
-    
+
+    // compressed container: read it whole and decode
+    unsigned char tagBytes[4];
+    if (fread(tagBytes, 1, 4, stream) == 4 && FlowCodec::IsCompressed(tagBytes, 4))
+    {
+	fseek(stream, 0, SEEK_END);
+	long size = ftell(stream);
+	std::vector<unsigned char> data(size > 0 ? size : 0);
+	fseek(stream, 0, SEEK_SET);
+	bool ok = fread(data.data(), 1, data.size(), stream) == data.size();
+	fclose(stream);
+	if (!ok || !FlowCodec::Decode(data.data(), data.size(), img))
+	    throw CError("ReadFlowFile(%s): broken compressed flow", filename);
+	return;
+    }
+    fseek(stream, 0, SEEK_SET);
+
     int width, height;
     float tag;
 
@@ -173,6 +198,220 @@ void FlowIO::ReadFlowFile(cv::Mat& img, const char* filename)
     fclose(stream);
 }
 
+// size of the header (tag, width and height) in bytes
+static const int FLOW_HEADER_SIZE = 12;
+
+// check a flow header and the total file length it implies
+static bool check_flow_header(const unsigned char* header, long long fileSize, int& width, int& height)
+{
+	float tag;
+	memcpy(&tag, header, sizeof(float));
+	memcpy(&width, header + 4, sizeof(int));
+	memcpy(&height, header + 8, sizeof(int));
+
+	if (tag != TAG_FLOAT)
+		return false;
+	if (width < 1 || width > 99999 || height < 1 || height > 99999)
+		return false;
+	return fileSize == FLOW_HEADER_SIZE + (long long)width * height * 2 * (long long)sizeof(float);
+}
+
+bool FlowIO::ProbeFlowFile(const char* filename, int* width, int* height)
+{
+	if (filename == NULL)
+		return false;
+
+	const char *dot = strrchr(filename, '.');
+	if (dot == NULL || strcmp(dot, ".flo") != 0)
+		return false;
+
+	long long fileSize = MappedFile::FileSize(filename);
+	if (fileSize < FLOW_HEADER_SIZE)
+		return false;
+
+	FILE *stream = fopen(filename, "rb");
+	if (stream == 0)
+		return false;
+
+	// enough for the header of either format
+	unsigned char header[FlowCodec::HEADER_SIZE];
+	size_t n = fread(header, 1, FlowCodec::HEADER_SIZE, stream);
+	fclose(stream);
+
+	int w, h;
+	if (FlowCodec::IsCompressed(header, n))
+	{
+		if (!FlowCodec::CheckHeader(header, n, fileSize, w, h))
+			return false;
+	}
+	else if (n < FLOW_HEADER_SIZE || !check_flow_header(header, fileSize, w, h))
+		return false;
+
+	if (width) *width = w;
+	if (height) *height = h;
+	return true;
+}
+
+bool FlowIO::DecodeFlow(cv::Mat& img, const unsigned char* data, size_t size, int numThreads)
+{
+	if (FlowCodec::IsCompressed(data, size))
+		return FlowCodec::Decode(data, size, img, numThreads);
+
+	int width, height;
+	if (data == NULL || size < FLOW_HEADER_SIZE || !check_flow_header(data, (long long)size, width, height))
+		return false;
+
+	img.create(height, width, CV_32FC2);
+	memcpy(img.data, data + FLOW_HEADER_SIZE, (size_t)width * height * 2 * sizeof(float));
+	return true;
+}
+
+bool FlowIO::FlowBandReader::Open(const char* filename)
+{
+	Close();
+	if (!ProbeFlowFile(filename, &width, &height))
+		return false;
+
+	stream = fopen(filename, "rb");
+	unsigned char header[FLOW_HEADER_SIZE];
+	if (stream == 0 || fread(header, 1, FLOW_HEADER_SIZE, stream) != FLOW_HEADER_SIZE || FlowCodec::IsCompressed(header, FLOW_HEADER_SIZE))
+	{
+		Close();
+		return false;
+	}
+	row = 0;
+	return true;
+}
+
+void FlowIO::FlowBandReader::Close()
+{
+	if (stream)
+		fclose(stream);
+	stream = NULL;
+	width = height = row = 0;
+}
+
+bool FlowIO::FlowBandReader::Read(cv::Mat& band)
+{
+	CV_Assert(band.type() == CV_32FC2 && band.cols == width);
+	if (stream == 0 || row + band.rows > height)
+		return false;
+
+	const size_t n = (size_t)width * 2;
+	if (band.isContinuous())
+	{
+		if (fread(band.data, sizeof(float), n * band.rows, stream) != n * band.rows)
+			return false;
+	}
+	else
+	for (int y = 0; y < band.rows; y++)
+	if (fread(band.ptr<float>(y), sizeof(float), n, stream) != n)
+		return false;
+	row += band.rows;
+	return true;
+}
+
+// Owns the MappedFile behind an image created by MapFlowFile and unmaps it
+// when the last cv::Mat referring to the data is released.
+class MappedFlowAllocator : public cv::MatAllocator
+{
+public:
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usageFlags) const
+	{
+		return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+	}
+	bool allocate(cv::UMatData* u, int accessFlags, cv::UMatUsageFlags usageFlags) const
+	{
+		return cv::Mat::getStdAllocator()->allocate(u, accessFlags, usageFlags);
+	}
+	void deallocate(cv::UMatData* u) const
+	{
+		if (u == NULL)
+			return;
+		CV_Assert(u->urefcount == 0 && u->refcount == 0);
+		delete (MappedFile*)u->userdata;
+		u->userdata = NULL;
+		u->origdata = u->data = NULL;
+		delete u;
+	}
+};
+
+static MappedFlowAllocator mappedFlowAllocator;
+
+// 2-band image header over the data of a mapped flow file, which it takes ownership of
+static cv::Mat wrap_mapped_flow(MappedFile* file, int width, int height)
+{
+    cv::Mat mapped(height, width, CV_32FC2, file->Data() + FLOW_HEADER_SIZE);
+    cv::UMatData* u = new cv::UMatData(&mappedFlowAllocator);
+    u->data = u->origdata = file->Data();
+    u->size = file->Size();
+    u->flags |= cv::UMatData::USER_ALLOCATED;
+    u->userdata = file;
+    u->refcount = 1;
+    mapped.u = u;
+    return mapped;
+}
+
+// map a flow file into 2-band image
+void FlowIO::MapFlowFile(cv::Mat& img, const char* filename, int numThreads)
+{
+    if (filename == NULL)
+	throw CError("MapFlowFile: empty filename");
+
+    const char *dot = strrchr(filename, '.');
+    if (dot == NULL || strcmp(dot, ".flo") != 0)
+	throw CError("MapFlowFile (%s): extension .flo expected", filename);
+
+    MappedFile* file = new MappedFile();
+    if (!file->Open(filename))
+    {
+	// e.g., empty files or file systems without mapping support; let the stream reader report it
+	delete file;
+	ReadFlowFile(img, filename);
+	return;
+    }
+
+    // compressed flows are decoded from the mapping, which is released right away
+    if (FlowCodec::IsCompressed(file->Data(), file->Size()))
+    {
+	bool ok = FlowCodec::Decode(file->Data(), file->Size(), img, numThreads);
+	delete file;
+	if (!ok)
+	    throw CError("MapFlowFile(%s): broken compressed flow", filename);
+	return;
+    }
+
+    int width, height;
+    if (file->Size() < FLOW_HEADER_SIZE || !check_flow_header(file->Data(), (long long)file->Size(), width, height))
+    {
+	delete file;
+	ReadFlowFile(img, filename);
+	return;
+    }
+
+    img = wrap_mapped_flow(file, width, height);
+}
+
+bool FlowIO::TryMapFlowFile(cv::Mat& img, const char* filename, bool prefault)
+{
+    const char *dot = filename != NULL ? strrchr(filename, '.') : NULL;
+    if (dot == NULL || strcmp(dot, ".flo") != 0)
+	return false;
+
+    MappedFile* file = new MappedFile();
+    int width, height;
+    if (!file->Open(filename) || FlowCodec::IsCompressed(file->Data(), file->Size()) ||
+	file->Size() < FLOW_HEADER_SIZE || !check_flow_header(file->Data(), (long long)file->Size(), width, height))
+    {
+	delete file;
+	return false;
+    }
+    if (prefault)
+	file->Prefault();
+    img = wrap_mapped_flow(file, width, height);
+    return true;
+}
+
 // write a 2-band image into flow file 
 void FlowIO::WriteFlowFile(cv::Mat img, const char* filename)
 {
@@ -213,6 +452,63 @@ void FlowIO::WriteFlowFile(cv::Mat img, const char* filename)
     fclose(stream);
 }
 
+void FlowIO::WriteCompressedFlowFile(cv::Mat img, const char* filename, float step, int numThreads)
+{
+    if (filename == NULL)
+	throw CError("WriteCompressedFlowFile: empty filename");
+    if (img.type() != CV_32FC2)
+	throw CError("WriteCompressedFlowFile(%s): image must have 2 float bands", filename);
+
+    FlowCodec::Options options;
+    options.step = step;
+    std::vector<unsigned char> data;
+    FlowCodec::Encode(img, data, options, numThreads);
+
+    FILE *stream = fopen(filename, "wb");
+    if (stream == 0)
+        throw CError("WriteCompressedFlowFile: could not open %s", filename);
+    bool ok = fwrite(data.data(), 1, data.size(), stream) == data.size();
+    ok = (fclose(stream) == 0) && ok;
+    if (!ok)
+	throw CError("WriteCompressedFlowFile(%s): problem writing data", filename);
+}
+
+// rows per task of the parallel colorization
+static const int COLOR_BAND_ROWS = 16;
+
+float FlowIO::ComputeMaxMotion(cv::Mat motim, int numThreads)
+{
+	CV_Assert(motim.type() == CV_32FC2);
+
+	// Maximum squared radius of the known flows of each band, reduced in band order. The root
+	// is taken once at the end: sqrt is monotonic, so this is the maximum of the radii.
+	const int numBands = (motim.rows + COLOR_BAND_ROWS - 1) / COLOR_BAND_ROWS;
+	std::vector<float> bandMax(numBands, 0.0f);
+	ParallelUtils::ParallelFor(numBands, numThreads, [&](int band)
+	{
+		float maxrad2 = 0;
+		const int y1 = std::min(motim.rows, (band + 1) * COLOR_BAND_ROWS);
+		for (int y = band * COLOR_BAND_ROWS; y < y1; y++)
+		{
+			const float* f = motim.ptr<float>(y);
+			for (int x = 0; x < motim.cols; x++, f += 2)
+			if (!unknown_flow(f[0], f[1]))
+				maxrad2 = std::max(maxrad2, f[0] * f[0] + f[1] * f[1]);
+		}
+		bandMax[band] = maxrad2;
+	});
+
+	float maxrad2 = 0;
+	for (float m : bandMax)
+		maxrad2 = std::max(maxrad2, m);
+	return std::sqrt(maxrad2);
+}
+
+float FlowIO::ComputeMaxMotion(cv::Mat motim, cv::Mat& knownMask)
+{
+	cv::Mat rad;
+	return ComputeMaxMotion(motim, knownMask, rad);
+}
 
 float FlowIO::ComputeMaxMotion(cv::Mat motim, cv::Mat& knownMask, cv::Mat& rad)
 {
@@ -238,36 +534,70 @@ float FlowIO::ComputeMaxMotion(cv::Mat motim, cv::Mat& knownMask, cv::Mat& rad)
 	return maxrad;
 }
 
-cv::Mat FlowIO::MotionToColor(cv::Mat motim, float maxmotion, cv::Scalar bgColor)
+// atan2 within 1e-5 radians, about 0.01 of a color code on the wheel.
+// Like atan2, it returns +-pi for (+-0, x < 0).
+static inline float fast_atan2(float y, float x)
 {
-	cv::Size sh = motim.size();
-	int width = sh.width, height = sh.height;
-	// determine motion range:
-	double maxx = -999, maxy = -999;
-	double minx = 999, miny = 999;
-	cv::Mat knownMask;
-	double maxrad = ComputeMaxMotion(motim, knownMask);
+	const float ax = std::abs(x), ay = std::abs(y);
+	const float mx = std::max(ax, ay), mn = std::min(ax, ay);
+	const float z = mx > 0 ? mn / mx : 0.0f;
+	const float z2 = z * z;
+	float a = z * (0.9998660f + z2 * (-0.3302995f + z2 * (0.1801410f + z2 * (-0.0851330f + z2 * 0.0208351f))));
+	if (ay > ax) a = (float)(M_PI / 2) - a;
+	if (x < 0) a = (float)M_PI - a;
+	return std::copysign(a, y);
+}
 
-	if (maxmotion > 0) // i.e., specified on commandline
-		maxrad = maxmotion;
+// computeColor with fast_atan2, within one code value of it
+static inline void wheel_color(float fx, float fy, uchar* pix)
+{
+	float rad = std::sqrt(fx * fx + fy * fy);
+	float a = std::min(std::max(fast_atan2(-fy, -fx) / (float)M_PI, -1.0f), 1.0f);
+	float fk = (a + 1.0f) / 2.0f * (ncols - 1);
+	int k0 = (int)fk;
+	int k1 = (k0 + 1) % ncols;
+	float f = fk - k0;
+	for (int b = 0; b < 3; b++) {
+		float col0 = colorwheel[k0][b] / 255.0f;
+		float col1 = colorwheel[k1][b] / 255.0f;
+		float col = (1 - f) * col0 + f * col1;
+		if (rad <= 1)
+			col = 1 - rad * (1 - col); // increase saturation with radius
+		else
+			col *= .75f; // out of range
+		pix[b] = (uchar)(int)(255.0f * col);
+	}
+}
+
+cv::Mat FlowIO::MotionToColor(cv::Mat motim, float maxmotion, cv::Scalar bgColor, int numThreads)
+{
+	CV_Assert(motim.type() == CV_32FC2);
+
+	// The colors depend on the maximum radius of the whole flow, so it is found in a pass of its
+	// own. The radii of the coloring pass cannot be kept from it: they are those of the flows
+	// normalized by the maximum, which differ in rounding and decide the out-of-range colors.
+	double maxrad = maxmotion > 0 ? maxmotion : ComputeMaxMotion(motim, numThreads); // maxmotion: specified on commandline
 
 	if (maxrad == 0) // if flow == 0 everywhere
 		maxrad = 1;
 
-	//if (verbose)
-	//	fprintf(stderr, "normalizing by %g\n", maxrad);
-
-	cv::Mat colim = cv::Mat(sh, CV_8UC3, bgColor);
-	std::vector<cv::Mat> bands;
-	cv::split(motim, bands);
-	bands[0] = bands[0] / maxrad;
-	bands[1] = bands[1] / maxrad;
-	//rad = rad / maxrad;
-	for (int y = 0; y < colim.rows; y++)
-	for (int x = 0; x < colim.cols; x++)
+	// Rows are colored in bands on parallel workers; unknown flows keep the background color.
+	// Flows are normalized as the former Mat division (convertTo) did, including the +0 shift
+	// that turns -0 into +0, so radii and the sign of zero components match exactly.
+	cv::Mat colim = cv::Mat(motim.size(), CV_8UC3, bgColor);
+	const float scale = (float)(1.0 / maxrad);
+	const int numBands = (motim.rows + COLOR_BAND_ROWS - 1) / COLOR_BAND_ROWS;
+	ParallelUtils::ParallelFor(numBands, numThreads, [&](int band)
 	{
-		if (knownMask.at<uchar>(y, x))
-			FlowIO::computeColor(bands[0].at<float>(y, x), bands[1].at<float>(y, x), &colim.at<cv::Vec3b>(y, x)[0]);
-	}
+		const int y1 = std::min(motim.rows, (band + 1) * COLOR_BAND_ROWS);
+		for (int y = band * COLOR_BAND_ROWS; y < y1; y++)
+		{
+			const float* f = motim.ptr<float>(y);
+			uchar* pix = colim.ptr<uchar>(y);
+			for (int x = 0; x < motim.cols; x++, f += 2, pix += 3)
+			if (!unknown_flow(f[0], f[1]))
+				wheel_color(f[0] * scale + 0.0f, f[1] * scale + 0.0f, pix);
+		}
+	});
 	return colim;
 }
@@ -2,6 +2,8 @@
 #include <opencv2/opencv.hpp>
 #include <exception>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 namespace FlowIO
 {
@@ -46,14 +48,70 @@ namespace FlowIO
 
 	cv::Mat unknown_flow_mask(cv::Mat flow);
 
+	// The readers accept both .flo files and the compressed container of FlowCodec.h,
+	// recognized from their first bytes whatever the file name.
+
 	// read a flow file into 2-band image
 	void ReadFlowFile(cv::Mat& img, const char* filename);
 
+	// map a flow file into memory and return a 2-band image header over its data without copying.
+	// the mapping is copy-on-write and released with the last reference to the image.
+	// falls back to ReadFlowFile if the file cannot be mapped.
+	// compressed flows are decoded into a new image on numThreads workers (<= 0: one per core).
+	void MapFlowFile(cv::Mat& img, const char* filename, int numThreads = 1);
+
+	// map an uncompressed flow file as MapFlowFile does, reading all its pages if prefault is set.
+	// returns false, leaving img untouched, if the file is compressed, broken or cannot be mapped.
+	bool TryMapFlowFile(cv::Mat& img, const char* filename, bool prefault = false);
+
+	// decode the contents of a flow file read into memory, returns false if they are not valid.
+	// img is written in place if it already has the size of an uncompressed flow.
+	bool DecodeFlow(cv::Mat& img, const unsigned char* data, size_t size, int numThreads = 1);
+
+	// check the tag, size and file length of a flow file by reading its header only
+	bool ProbeFlowFile(const char* filename, int* width = NULL, int* height = NULL);
+
+	// Reads an uncompressed flow file from the top down, a band of rows at a time, without
+	// holding the whole flow in memory. Compressed flows cannot be read in bands.
+	class FlowBandReader
+	{
+		FILE* stream;
+		int width, height, row;
+
+		FlowBandReader(const FlowBandReader&);
+		FlowBandReader& operator=(const FlowBandReader&);
+
+	public:
+		FlowBandReader() : stream(NULL), width(0), height(0), row(0) {}
+		~FlowBandReader() { Close(); }
+
+		// returns false if the file is not a valid uncompressed flow file (see ProbeFlowFile)
+		bool Open(const char* filename);
+		void Close();
+
+		int Width() const { return width; }
+		int Height() const { return height; }
+		int Row() const { return row; }   // next row to be read
+
+		// reads the next band.rows rows into band, a CV_32FC2 image of Width() columns
+		bool Read(cv::Mat& band);
+	};
+
 	// write a 2-band image into flow file 
 	void WriteFlowFile(cv::Mat img, const char* filename);
 
-	float ComputeMaxMotion(cv::Mat motim, cv::Mat& knownMask = cv::Mat(), cv::Mat& rad = cv::Mat());
-	cv::Mat MotionToColor(cv::Mat motim, float maxmotion = -1, cv::Scalar bgColor = cv::Scalar());
+	// write a 2-band image into the compressed container, lossless if step is 0 and
+	// otherwise rounded to multiples of step pixels; unknown flows are kept as unknown
+	void WriteCompressedFlowFile(cv::Mat img, const char* filename, float step = 0, int numThreads = 1);
+
+	float ComputeMaxMotion(cv::Mat motim, cv::Mat& knownMask, cv::Mat& rad);
+	float ComputeMaxMotion(cv::Mat motim, cv::Mat& knownMask);
+	// maximum radius of the known flows, computed in one pass on numThreads workers (<= 0: one per core)
+	float ComputeMaxMotion(cv::Mat motim, int numThreads = 0);
+
+	// color-coded flow normalized by maxmotion (the maximum radius if <= 0). Rows are rendered
+	// on numThreads workers with an approximate atan2, within one code value of computeColor.
+	cv::Mat MotionToColor(cv::Mat motim, float maxmotion = -1, cv::Scalar bgColor = cv::Scalar(), int numThreads = 0);
 
 	void computeColor(float fx, float fy, uchar *pix);
 }
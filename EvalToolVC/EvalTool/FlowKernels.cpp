@@ -0,0 +1,426 @@
+#include "FlowKernels.h"
+#include "FlowIO.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+// AVX2 functions are compiled for AVX2 regardless of the target of the project
+// and are only called after the CPU has been checked at runtime.
+#if defined(__GNUC__)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define AVX2_FUNCTION
+#endif
+
+namespace FlowKernels
+{
+	static const float VALID_THRESH = (float)FlowIO::UNKNOWN_FLOW_THRESH;
+	static const float INVALID_ERROR = 1000.0f;
+
+	// --- scalar ---
+
+	static inline bool is_valid(float u, float v)
+	{
+		// false for NaN, as !FlowIO::unknown_flow(u, v)
+		return std::abs(u) <= VALID_THRESH && std::abs(v) <= VALID_THRESH;
+	}
+
+	static void flow_error_row_scalar(const float* f, const float* g, int x, int width, float* err, uchar* validGT, uchar* valid)
+	{
+		for (; x < width; x++)
+		{
+			const float* a = f + 2 * x;
+			const float* b = g + 2 * x;
+			bool vg = is_valid(b[0], b[1]);
+			bool vf = is_valid(a[0], a[1]);
+			if (err)
+			{
+				float du = a[0] - b[0];
+				float dv = a[1] - b[1];
+				float du2 = du * du;
+				float dv2 = dv * dv;
+				err[x] = vg != vf ? INVALID_ERROR : std::sqrt(du2 + dv2);
+			}
+			if (validGT) validGT[x] = vg ? 255 : 0;
+			if (valid) valid[x] = vf ? 255 : 0;
+		}
+	}
+
+	static void valid_row_scalar(const float* f, int x, int width, uchar* valid)
+	{
+		for (; x < width; x++)
+			valid[x] = is_valid(f[2 * x], f[2 * x + 1]) ? 255 : 0;
+	}
+
+	static void map_row_scalar(const float* f, int x, int width, int y, float* map)
+	{
+		for (; x < width; x++)
+		{
+			map[2 * x] = f[2 * x] + (float)x;
+			map[2 * x + 1] = f[2 * x + 1] + (float)y;
+		}
+	}
+
+	// --- SSE2, 4 pixels per iteration ---
+
+	// packs two 4-lane compare results of interleaved (u, v) pairs into per-pixel validity
+	static inline __m128 valid_pairs_sse2(__m128 lo, __m128 hi)
+	{
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		const __m128 thresh = _mm_set1_ps(VALID_THRESH);
+		// (a <= t) is false for NaN
+		__m128 clo = _mm_cmple_ps(_mm_and_ps(lo, absMask), thresh);
+		__m128 chi = _mm_cmple_ps(_mm_and_ps(hi, absMask), thresh);
+		__m128 u = _mm_shuffle_ps(clo, chi, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 v = _mm_shuffle_ps(clo, chi, _MM_SHUFFLE(3, 1, 3, 1));
+		return _mm_and_ps(u, v);
+	}
+
+	static inline void store_mask4(uchar* dst, __m128 m)
+	{
+		__m128i w = _mm_packs_epi32(_mm_castps_si128(m), _mm_setzero_si128());
+		w = _mm_packs_epi16(w, _mm_setzero_si128());
+		*(int*)dst = _mm_cvtsi128_si32(w);
+	}
+
+	static void flow_error_row_sse2(const float* f, const float* g, int width, float* err, uchar* validGT, uchar* valid)
+	{
+		const __m128 invalidError = _mm_set1_ps(INVALID_ERROR);
+		int x = 0;
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128 f0 = _mm_loadu_ps(f + 2 * x), f1 = _mm_loadu_ps(f + 2 * x + 4);
+			__m128 g0 = _mm_loadu_ps(g + 2 * x), g1 = _mm_loadu_ps(g + 2 * x + 4);
+			__m128 vg = valid_pairs_sse2(g0, g1);
+			__m128 vf = valid_pairs_sse2(f0, f1);
+			if (err)
+			{
+				__m128 d0 = _mm_sub_ps(f0, g0), d1 = _mm_sub_ps(f1, g1);
+				d0 = _mm_mul_ps(d0, d0);
+				d1 = _mm_mul_ps(d1, d1);
+				__m128 du2 = _mm_shuffle_ps(d0, d1, _MM_SHUFFLE(2, 0, 2, 0));
+				__m128 dv2 = _mm_shuffle_ps(d0, d1, _MM_SHUFFLE(3, 1, 3, 1));
+				__m128 e = _mm_sqrt_ps(_mm_add_ps(du2, dv2));
+				__m128 mismatch = _mm_xor_ps(vg, vf);
+				e = _mm_or_ps(_mm_andnot_ps(mismatch, e), _mm_and_ps(mismatch, invalidError));
+				_mm_storeu_ps(err + x, e);
+			}
+			if (validGT) store_mask4(validGT + x, vg);
+			if (valid) store_mask4(valid + x, vf);
+		}
+		flow_error_row_scalar(f, g, x, width, err, validGT, valid);
+	}
+
+	static void valid_row_sse2(const float* f, int width, uchar* valid)
+	{
+		int x = 0;
+		for (; x + 4 <= width; x += 4)
+			store_mask4(valid + x, valid_pairs_sse2(_mm_loadu_ps(f + 2 * x), _mm_loadu_ps(f + 2 * x + 4)));
+		valid_row_scalar(f, x, width, valid);
+	}
+
+	static void map_row_sse2(const float* f, int width, int y, float* map)
+	{
+		// (x, y, x + 1, y) advanced by 2 pixels per iteration; x stays exact in float
+		const __m128 step = _mm_setr_ps(2.0f, 0.0f, 2.0f, 0.0f);
+		__m128 xy = _mm_setr_ps(0.0f, (float)y, 1.0f, (float)y);
+		int x = 0;
+		for (; x + 2 <= width; x += 2)
+		{
+			_mm_storeu_ps(map + 2 * x, _mm_add_ps(_mm_loadu_ps(f + 2 * x), xy));
+			xy = _mm_add_ps(xy, step);
+		}
+		map_row_scalar(f, x, width, y, map);
+	}
+
+	// --- AVX2, 8 pixels per iteration ---
+
+	// de-interleaves the even and odd lanes of two 8-lane vectors, keeping the pixel order
+	AVX2_FUNCTION static inline void split_pairs_avx2(__m256 lo, __m256 hi, __m256& even, __m256& odd)
+	{
+		// the in-lane shuffles give pixels 0 1 4 5 | 2 3 6 7
+		__m256 e = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 o = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+		even = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(e), _MM_SHUFFLE(3, 1, 2, 0)));
+		odd = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(o), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	AVX2_FUNCTION static inline __m256 valid_pairs_avx2(__m256 lo, __m256 hi)
+	{
+		const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+		const __m256 thresh = _mm256_set1_ps(VALID_THRESH);
+		// ordered compare, false for NaN
+		__m256 clo = _mm256_cmp_ps(_mm256_and_ps(lo, absMask), thresh, _CMP_LE_OQ);
+		__m256 chi = _mm256_cmp_ps(_mm256_and_ps(hi, absMask), thresh, _CMP_LE_OQ);
+		__m256 u, v;
+		split_pairs_avx2(clo, chi, u, v);
+		return _mm256_and_ps(u, v);
+	}
+
+	AVX2_FUNCTION static inline void store_mask8(uchar* dst, __m256 m)
+	{
+		__m128i lo = _mm256_castsi256_si128(_mm256_castps_si256(m));
+		__m128i hi = _mm256_extracti128_si256(_mm256_castps_si256(m), 1);
+		__m128i w = _mm_packs_epi32(lo, hi);
+		w = _mm_packs_epi16(w, _mm_setzero_si128());
+		_mm_storel_epi64((__m128i*)dst, w);
+	}
+
+	AVX2_FUNCTION static void flow_error_row_avx2(const float* f, const float* g, int width, float* err, uchar* validGT, uchar* valid)
+	{
+		const __m256 invalidError = _mm256_set1_ps(INVALID_ERROR);
+		int x = 0;
+		for (; x + 8 <= width; x += 8)
+		{
+			__m256 f0 = _mm256_loadu_ps(f + 2 * x), f1 = _mm256_loadu_ps(f + 2 * x + 8);
+			__m256 g0 = _mm256_loadu_ps(g + 2 * x), g1 = _mm256_loadu_ps(g + 2 * x + 8);
+			__m256 vg = valid_pairs_avx2(g0, g1);
+			__m256 vf = valid_pairs_avx2(f0, f1);
+			if (err)
+			{
+				// separate multiply and add (no FMA) to round as the scalar code does
+				__m256 d0 = _mm256_sub_ps(f0, g0), d1 = _mm256_sub_ps(f1, g1);
+				d0 = _mm256_mul_ps(d0, d0);
+				d1 = _mm256_mul_ps(d1, d1);
+				__m256 du2, dv2;
+				split_pairs_avx2(d0, d1, du2, dv2);
+				__m256 e = _mm256_sqrt_ps(_mm256_add_ps(du2, dv2));
+				e = _mm256_blendv_ps(e, invalidError, _mm256_xor_ps(vg, vf));
+				_mm256_storeu_ps(err + x, e);
+			}
+			if (validGT) store_mask8(validGT + x, vg);
+			if (valid) store_mask8(valid + x, vf);
+		}
+		flow_error_row_scalar(f, g, x, width, err, validGT, valid);
+	}
+
+	AVX2_FUNCTION static void valid_row_avx2(const float* f, int width, uchar* valid)
+	{
+		int x = 0;
+		for (; x + 8 <= width; x += 8)
+			store_mask8(valid + x, valid_pairs_avx2(_mm256_loadu_ps(f + 2 * x), _mm256_loadu_ps(f + 2 * x + 8)));
+		valid_row_scalar(f, x, width, valid);
+	}
+
+	AVX2_FUNCTION static void map_row_avx2(const float* f, int width, int y, float* map)
+	{
+		const float fy = (float)y;
+		const __m256 step = _mm256_setr_ps(4.0f, 0.0f, 4.0f, 0.0f, 4.0f, 0.0f, 4.0f, 0.0f);
+		__m256 xy = _mm256_setr_ps(0.0f, fy, 1.0f, fy, 2.0f, fy, 3.0f, fy);
+		int x = 0;
+		for (; x + 4 <= width; x += 4)
+		{
+			_mm256_storeu_ps(map + 2 * x, _mm256_add_ps(_mm256_loadu_ps(f + 2 * x), xy));
+			xy = _mm256_add_ps(xy, step);
+		}
+		map_row_scalar(f, x, width, y, map);
+	}
+
+	// --- forward-backward consistency, scalar (bilinear sampling is a gather) ---
+
+	// Bilinear weights for the 32x32 sub-pixel positions of cv::remap (INTER_TAB_SIZE),
+	// computed as OpenCV's initInterTab2D does for float images.
+	static const int TAB_BITS = 5, TAB_SIZE = 1 << TAB_BITS;
+	static float bilinearTab[TAB_SIZE * TAB_SIZE][4];
+
+	static bool init_bilinear_tab()
+	{
+		const float scale = 1.f / TAB_SIZE;
+		for (int i = 0; i < TAB_SIZE; i++)
+		for (int j = 0; j < TAB_SIZE; j++)
+		{
+			const float vy[2] = { 1.f - i * scale, i * scale };
+			const float vx[2] = { 1.f - j * scale, j * scale };
+			float* w = bilinearTab[i * TAB_SIZE + j];
+			for (int k = 0; k < 4; k++)
+				w[k] = vy[k >> 1] * vx[k & 1];
+		}
+		return true;
+	}
+	static bool bilinearTabInit = init_bilinear_tab();
+
+	// fixed-point map coordinate as remap computes it: rounded to 1/32 pixel with the SSE
+	// conversion (INT_MIN on overflow and NaN), integer part saturated to short
+	static inline void fixed_coord(float v, int& pos, int& frac)
+	{
+		int X = _mm_cvtss_si32(_mm_set_ss(v * TAB_SIZE));
+		pos = std::min(std::max(X >> TAB_BITS, -32768), 32767);
+		frac = X & (TAB_SIZE - 1);
+	}
+
+	void ConsistencyMaskRow(const float* flow, int width, int y, const float* reverse, size_t reverseStep,
+		int reverseWidth, int reverseHeight, float thresh, uchar* mask)
+	{
+		const float border = 1e10f;   // the unknown-flow border of computeMaskFromFlow
+		for (int x = 0; x < width; x++)
+		{
+			const float* f = flow + 2 * x;
+			int sx, sy, fx, fy;
+			fixed_coord(f[0] + (float)x, sx, fx);
+			fixed_coord(f[1] + (float)y, sy, fy);
+
+			// sample the reverse flow at the target like remap with BORDER_CONSTANT
+			float s[2] = { border, border };
+			if (sx < reverseWidth && sx + 1 >= 0 && sy < reverseHeight && sy + 1 >= 0)
+			{
+				const float* w = bilinearTab[fy * TAB_SIZE + fx];
+				const bool in0 = sx >= 0, in1 = sx + 1 < reverseWidth;
+				const float* r0 = sy >= 0 ? reverse + sy * reverseStep + 2 * sx : NULL;
+				const float* r1 = sy + 1 < reverseHeight ? reverse + (sy + 1) * reverseStep + 2 * sx : NULL;
+				for (int k = 0; k < 2; k++)
+				{
+					float v0 = r0 && in0 ? r0[k] : border;
+					float v1 = r0 && in1 ? r0[2 + k] : border;
+					float v2 = r1 && in0 ? r1[k] : border;
+					float v3 = r1 && in1 ? r1[2 + k] : border;
+					s[k] = v0 * w[0] + v1 * w[1] + v2 * w[2] + v3 * w[3];
+				}
+			}
+
+			// endpoint error against the negated sample, as flow_error_row_scalar
+			const float b[2] = { -s[0], -s[1] };
+			bool vg = is_valid(b[0], b[1]);
+			bool vf = is_valid(f[0], f[1]);
+			float du = f[0] - b[0];
+			float dv = f[1] - b[1];
+			float du2 = du * du;
+			float dv2 = dv * dv;
+			float err = vg != vf ? INVALID_ERROR : std::sqrt(du2 + dv2);
+			mask[x] = err < thresh ? 255 : 0;
+		}
+	}
+
+	// --- dispatch ---
+
+	static Isa selected = GetSupportedIsa();
+
+	Isa GetSupportedIsa()
+	{
+		if (cv::checkHardwareSupport(CV_CPU_AVX2))
+			return ISA_AVX2;
+		if (cv::checkHardwareSupport(CV_CPU_SSE2))
+			return ISA_SSE2;
+		return ISA_SCALAR;
+	}
+
+	Isa GetIsa()
+	{
+		return selected;
+	}
+
+	void SetIsa(Isa isa)
+	{
+		selected = isa <= GetSupportedIsa() ? isa : GetSupportedIsa();
+	}
+
+	const char* IsaName(Isa isa)
+	{
+		switch (isa)
+		{
+		case ISA_AVX2: return "AVX2";
+		case ISA_SSE2: return "SSE2";
+		default: return "scalar";
+		}
+	}
+
+	void FlowErrorRow(const float* flow, const float* flowGT, int width, float* err, uchar* validGT, uchar* valid)
+	{
+		switch (selected)
+		{
+		case ISA_AVX2: flow_error_row_avx2(flow, flowGT, width, err, validGT, valid); break;
+		case ISA_SSE2: flow_error_row_sse2(flow, flowGT, width, err, validGT, valid); break;
+		default: flow_error_row_scalar(flow, flowGT, 0, width, err, validGT, valid); break;
+		}
+	}
+
+	void ValidFlowRow(const float* flow, int width, uchar* valid)
+	{
+		switch (selected)
+		{
+		case ISA_AVX2: valid_row_avx2(flow, width, valid); break;
+		case ISA_SSE2: valid_row_sse2(flow, width, valid); break;
+		default: valid_row_scalar(flow, 0, width, valid); break;
+		}
+	}
+
+	void WarpMapRow(const float* flow, int width, int y, float* map)
+	{
+		switch (selected)
+		{
+		case ISA_AVX2: map_row_avx2(flow, width, y, map); break;
+		case ISA_SSE2: map_row_sse2(flow, width, y, map); break;
+		default: map_row_scalar(flow, 0, width, y, map); break;
+		}
+	}
+
+	void ComputeFlowError(const cv::Mat& flow, const cv::Mat& flowGT, cv::Mat& err, cv::Mat& validGT, cv::Mat& valid)
+	{
+		CV_Assert(flow.type() == CV_32FC2 && flowGT.type() == CV_32FC2 && flow.size() == flowGT.size());
+		err.create(flow.size(), CV_32F);
+		validGT.create(flow.size(), CV_8U);
+		valid.create(flow.size(), CV_8U);
+		for (int y = 0; y < flow.rows; y++)
+			FlowErrorRow(flow.ptr<float>(y), flowGT.ptr<float>(y), flow.cols, err.ptr<float>(y), validGT.ptr<uchar>(y), valid.ptr<uchar>(y));
+	}
+
+	void ComputeValidFlowMask(const cv::Mat& flow, cv::Mat& valid)
+	{
+		CV_Assert(flow.type() == CV_32FC2);
+		valid.create(flow.size(), CV_8U);
+		for (int y = 0; y < flow.rows; y++)
+			ValidFlowRow(flow.ptr<float>(y), flow.cols, valid.ptr<uchar>(y));
+	}
+
+	void ConsistencyMaskOpenCV(const cv::Mat& flow, const cv::Mat& reverse, double thresh, cv::Mat& mask)
+	{
+		CV_Assert(flow.type() == CV_32FC2 && reverse.type() == CV_32FC2);
+		cv::Mat map(flow.size(), CV_32FC2), warped, err, validGT, valid;
+		for (int y = 0; y < flow.rows; y++)
+			WarpMapRow(flow.ptr<float>(y), flow.cols, y, map.ptr<float>(y));
+		cv::remap(reverse, warped, map, cv::Mat(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar::all(1e10));
+		ComputeFlowError(flow, -warped, err, validGT, valid);
+		cv::Mat result = err < thresh;
+		result.copyTo(mask);
+	}
+
+	// Compares ConsistencyMaskRow with the OpenCV path on small flows that are nearly
+	// consistent, so both mask values occur, with unknown flows and targets off the image.
+	static bool check_consistency_against_opencv()
+	{
+		const cv::Size size(48, 32);
+		const double thresh = 1.0;
+		cv::RNG rng(0);
+		cv::Mat flow(size, CV_32FC2), reverse(size, CV_32FC2), noise(size, CV_32FC2);
+		flow.setTo(cv::Scalar(3.3, -2.7));
+		rng.fill(noise, cv::RNG::UNIFORM, -0.6, 0.6);
+		flow += noise;
+		reverse.setTo(cv::Scalar(-3.3, 2.7));
+		rng.fill(noise, cv::RNG::UNIFORM, -0.6, 0.6);
+		reverse += noise;
+		for (int i = 0; i < 40; i++)
+		{
+			const int x = rng.uniform(0, size.width), y = rng.uniform(0, size.height);
+			flow.at<cv::Vec2f>(y, x) = cv::Vec2f(rng.uniform(-60.f, 60.f), rng.uniform(-60.f, 60.f));
+			(i % 2 ? flow : reverse).at<cv::Vec2f>(rng.uniform(0, size.height), rng.uniform(0, size.width)) = cv::Vec2f(1e10f, 1e10f);
+		}
+
+		cv::Mat mask(size, CV_8U), ref;
+		for (int y = 0; y < size.height; y++)
+			ConsistencyMaskRow(flow.ptr<float>(y), size.width, y, reverse.ptr<float>(), reverse.step / sizeof(float),
+				size.width, size.height, (float)thresh, mask.ptr<uchar>(y));
+		ConsistencyMaskOpenCV(flow, reverse, thresh, ref);
+		return cv::countNonZero(mask != ref) == 0;
+	}
+
+	static std::once_flag consistencyCheckOnce;
+	static bool consistencyMatchesOpenCV = false;
+
+	bool ConsistencyMatchesOpenCV()
+	{
+		std::call_once(consistencyCheckOnce, []{ consistencyMatchesOpenCV = check_consistency_against_opencv(); });
+		return consistencyMatchesOpenCV;
+	}
+}
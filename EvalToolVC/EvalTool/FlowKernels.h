@@ -0,0 +1,50 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+// Per-pixel kernels over interleaved 2-band (CV_32FC2) flows.
+// The streaming kernels have scalar, SSE2 and AVX2 versions and the fastest one
+// supported by the CPU is chosen at runtime. All versions give bit-identical results.
+namespace FlowKernels
+{
+	enum Isa { ISA_SCALAR, ISA_SSE2, ISA_AVX2 };
+
+	// fastest instruction set supported by the CPU
+	Isa GetSupportedIsa();
+
+	// instruction set used by the kernels. SetIsa() is meant for benchmarking and
+	// falls back to the supported one if the requested set is not available.
+	Isa GetIsa();
+	void SetIsa(Isa isa);
+	const char* IsaName(Isa isa);
+
+	// Endpoint error of one row of 'width' pixels, computed as computeFlowError does:
+	// err is sqrt(du*du + dv*dv), or 1000 where exactly one of the flows is unknown
+	// (see FlowIO::unknown_flow). validGT and valid are set to 255 where flowGT and flow
+	// are known and 0 elsewhere. err, validGT and valid may be NULL.
+	void FlowErrorRow(const float* flow, const float* flowGT, int width, float* err, uchar* validGT, uchar* valid);
+
+	// Validity of one row of 'width' pixels, 255 where the flow is known and 0 elsewhere.
+	void ValidFlowRow(const float* flow, int width, uchar* valid);
+
+	// Absolute sampling positions (x + u, y + v) of row y, as interleaved CV_32FC2 pixels.
+	// flow and map may be the same buffer.
+	void WarpMapRow(const float* flow, int width, int y, float* map);
+
+	// Forward-backward consistency of one row: samples the reverse flow bilinearly at
+	// (x + u, y + v) exactly as cv::remap with a constant 1e10 border,
+	// and sets mask to 255 where the endpoint error between the flow and the negated
+	// sample is below thresh, 0 elsewhere. reverseStep is the row step in floats.
+	void ConsistencyMaskRow(const float* flow, int width, int y, const float* reverse, size_t reverseStep,
+		int reverseWidth, int reverseHeight, float thresh, uchar* mask);
+
+	// The consistency mask as the former code computed it, with cv::remap and the flow error
+	// images: computeFlowError(flow, -warped reverse) < thresh.
+	void ConsistencyMaskOpenCV(const cv::Mat& flow, const cv::Mat& reverse, double thresh, cv::Mat& mask);
+
+	// Whether ConsistencyMaskRow matches the remap of this OpenCV build; checked once.
+	bool ConsistencyMatchesOpenCV();
+
+	// Full-frame versions. err is CV_32F and the masks are CV_8U.
+	void ComputeFlowError(const cv::Mat& flow, const cv::Mat& flowGT, cv::Mat& err, cv::Mat& validGT, cv::Mat& valid);
+	void ComputeValidFlowMask(const cv::Mat& flow, cv::Mat& valid);
+}
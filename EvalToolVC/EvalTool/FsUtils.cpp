@@ -0,0 +1,357 @@
+#include "FsUtils.h"
+#include "ParallelUtils.h"
+#include "PackFile.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace FsUtil
+{
+	const char* PAIR_FILE_NAMES[NUM_PAIR_FILES] = {
+		"flow1.flo", "flow2.flo", "mask1.png", "mask2.png", "pair.txt", "flip_gt.txt", "image1.png", "image2.png"
+	};
+
+	std::string JoinPath(const std::string& dir, const std::string& name)
+	{
+		if (name.empty())
+			return dir;
+		if (dir.empty())
+			return name;
+		char last = dir[dir.size() - 1];
+		if (last == '/' || last == '\\')
+			return dir + name;
+		return dir + SEPARATOR + name;
+	}
+
+	// mounted packs and their paths with '/' separators
+	static std::vector<std::pair<std::string, std::shared_ptr<PackFile::Archive> > > mounts;
+
+	static std::string normalize(const std::string& path)
+	{
+		std::string p = path;
+		std::replace(p.begin(), p.end(), '\\', '/');
+		while (p.size() > 1 && p[p.size() - 1] == '/')
+			p.resize(p.size() - 1);
+		return p;
+	}
+
+	// Finds the mounted pack containing path, and the pair directory and file name of path
+	// in it (both empty for the pack itself). NULL if path is not inside a pack.
+	static const PackFile::Archive* resolve(const std::string& path, std::string& dir, std::string& name)
+	{
+		if (mounts.empty())
+			return NULL;
+		const std::string p = normalize(path);
+		for (const auto& m : mounts)
+		{
+			const std::string& root = m.first;
+			if (p == root)
+			{
+				dir = name = "";
+				return m.second.get();
+			}
+			if (p.size() > root.size() && p.compare(0, root.size(), root) == 0 && p[root.size()] == '/')
+			{
+				const std::string rest = p.substr(root.size() + 1);
+				const size_t slash = rest.find('/');
+				dir = rest.substr(0, slash);
+				name = slash == std::string::npos ? "" : rest.substr(slash + 1);
+				return m.second.get();
+			}
+		}
+		return NULL;
+	}
+
+	bool MountPack(const std::string& path)
+	{
+		std::shared_ptr<PackFile::Archive> archive(new PackFile::Archive());
+		if (!archive->Open(path))
+			return false;
+		mounts.push_back(std::make_pair(normalize(path), archive));
+		return true;
+	}
+
+	bool IsPacked(const std::string& path)
+	{
+		std::string dir, name;
+		return resolve(path, dir, name) != NULL;
+	}
+
+	std::string OutputDir(const std::string& path)
+	{
+		std::string dir, name;
+		if (resolve(path, dir, name) == NULL || !dir.empty())
+			return path;
+		std::string out = path;
+		if (out.size() > 5 && out.compare(out.size() - 5, 5, ".pack") == 0)
+			out.resize(out.size() - 5);
+		else
+			out += "_out";
+		MakeDirectory(out);
+		return out;
+	}
+
+	// calls func(name, isDirectory) for each non-hidden entry of dir
+	template <typename Func>
+	static void list_directory(const std::string& dir, Func func)
+	{
+		std::string packDir, packName;
+		if (const PackFile::Archive* pack = resolve(dir, packDir, packName))
+		{
+			if (packDir.empty())
+				for (const std::string& d : pack->Directories())
+					func(d.c_str(), true);
+			else if (packName.empty() && pack->Files(packDir))
+				for (int i : *pack->Files(packDir))
+					func(pack->GetEntry(i).name.c_str(), false);
+			return;
+		}
+
+#ifdef _WIN32
+		WIN32_FIND_DATAA fd;
+		HANDLE hFind = FindFirstFileA(JoinPath(dir, "*").c_str(), &fd);
+		if (hFind == INVALID_HANDLE_VALUE)
+			return;
+		do
+		{
+			if (fd.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN)
+				continue;
+			if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
+				continue;
+			func(fd.cFileName, (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+		} while (FindNextFileA(hFind, &fd));
+		FindClose(hFind);
+#else
+		DIR* d = opendir(dir.c_str());
+		if (d == NULL)
+			return;
+		int fd = dirfd(d);
+		while (struct dirent* e = readdir(d))
+		{
+			if (e->d_name[0] == '.')
+				continue;
+			bool isDir = e->d_type == DT_DIR;
+			if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK)
+			{
+				struct stat st;
+				isDir = fstatat(fd, e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+			}
+			func(e->d_name, isDir);
+		}
+		closedir(d);
+#endif
+	}
+
+	static std::vector<std::string> list_entries(const std::string& dir, bool directories)
+	{
+		std::vector<std::string> names;
+		list_directory(dir, [&](const char* name, bool isDir){
+			if (isDir == directories)
+				names.push_back(name);
+		});
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+	std::vector<std::string> GetDirectories(const std::string& dir)
+	{
+		return list_entries(dir, true);
+	}
+
+	std::vector<std::string> GetFiles(const std::string& dir)
+	{
+		return list_entries(dir, false);
+	}
+
+	bool MatchWildcard(const std::string& pattern, const std::string& name)
+	{
+		// greedy matching with backtracking to the last '*'
+		size_t p = 0, n = 0, star = std::string::npos, mark = 0;
+		while (n < name.size())
+		{
+			if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) { p++; n++; }
+			else if (p < pattern.size() && pattern[p] == '*') { star = p++; mark = n; }
+			else if (star != std::string::npos) { p = star + 1; n = ++mark; }
+			else return false;
+		}
+		while (p < pattern.size() && pattern[p] == '*')
+			p++;
+		return p == pattern.size();
+	}
+
+	std::vector<std::string> ExpandDirectoryList(const std::string& list)
+	{
+		std::vector<std::string> dirs;
+		size_t begin = 0;
+		while (begin <= list.size())
+		{
+			size_t end = list.find(';', begin);
+			if (end == std::string::npos)
+				end = list.size();
+			std::string entry = list.substr(begin, end - begin);
+			begin = end + 1;
+			if (entry.empty())
+				continue;
+
+			size_t slash = entry.find_last_of("/\\");
+			std::string parent = slash == std::string::npos ? "." : entry.substr(0, slash + 1);
+			std::string pattern = slash == std::string::npos ? entry : entry.substr(slash + 1);
+			if (pattern.find_first_of("*?") == std::string::npos)
+			{
+				dirs.push_back(entry);
+				continue;
+			}
+			for (const std::string& name : GetDirectories(parent))
+			if (MatchWildcard(pattern, name))
+				dirs.push_back(slash == std::string::npos ? name : parent + name);
+		}
+		return dirs;
+	}
+
+	bool FileExists(const std::string& path)
+	{
+		long long size, mtime;
+		return GetFileStamp(path, size, mtime);
+	}
+
+	std::string AbsolutePath(const std::string& path)
+	{
+#ifdef _WIN32
+		char buf[MAX_PATH];
+		return _fullpath(buf, path.c_str(), MAX_PATH) != NULL ? std::string(buf) : path;
+#else
+		if (!path.empty() && path[0] == '/')
+			return path;
+		char buf[4096];
+		return getcwd(buf, sizeof(buf)) != NULL ? JoinPath(buf, path) : path;
+#endif
+	}
+
+	bool MakeDirectory(const std::string& path)
+	{
+#ifdef _WIN32
+		return _mkdir(path.c_str()) == 0;
+#else
+		return mkdir(path.c_str(), 0777) == 0;
+#endif
+	}
+
+	bool ReadFile(const std::string& path, std::vector<unsigned char>& data)
+	{
+		data.clear();
+		std::string packDir, packName;
+		if (const PackFile::Archive* pack = resolve(path, packDir, packName))
+		if (!packDir.empty())
+		{
+			const PackFile::Archive::Entry* e = pack->Find(packDir, packName);
+			if (e == NULL)
+				return false;
+			data.assign(pack->Data(*e), pack->Data(*e) + e->size);
+			return true;
+		}
+
+		FILE* fp = fopen(path.c_str(), "rb");
+		if (fp == NULL)
+			return false;
+
+		// read in large chunks without relying on the reported file size
+		const size_t CHUNK = 1 << 20;
+		size_t size = 0;
+		for (;;)
+		{
+			data.resize(size + CHUNK);
+			size_t n = fread(&data[size], 1, CHUNK, fp);
+			size += n;
+			if (n < CHUNK)
+				break;
+		}
+		bool ok = ferror(fp) == 0;
+		fclose(fp);
+		data.resize(ok ? size : 0);
+		return ok;
+	}
+
+	bool GetFileStamp(const std::string& path, long long& size, long long& mtime)
+	{
+		// files in a pack keep the stamps of their source files
+		std::string packDir, packName;
+		if (const PackFile::Archive* pack = resolve(path, packDir, packName))
+		if (!packDir.empty())
+		{
+			const PackFile::Archive::Entry* e = pack->Find(packDir, packName);
+			if (e == NULL)
+				return false;
+			size = e->size;
+			mtime = e->mtime;
+			return true;
+		}
+
+#ifdef _WIN32
+		struct __stat64 st;
+		if (_stat64(path.c_str(), &st) != 0)
+			return false;
+#else
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+			return false;
+#endif
+		size = (long long)st.st_size;
+		mtime = (long long)st.st_mtime;
+		return true;
+	}
+
+	static bool same_name(const char* a, const char* b)
+	{
+#ifdef _WIN32
+		return _stricmp(a, b) == 0;
+#else
+		return strcmp(a, b) == 0;
+#endif
+	}
+
+	PairFiles ScanPairFiles(const std::string& dir)
+	{
+		PairFiles files;
+		list_directory(dir, [&](const char* name, bool isDir){
+			if (isDir)
+				return;
+			for (int f = 0; f < NUM_PAIR_FILES; f++)
+			if (same_name(name, PAIR_FILE_NAMES[f]))
+				files.Set((PairFile)f);
+		});
+		return files;
+	}
+
+	std::vector<PairEntry> ScanPairs(const std::string& resultsDir, const std::string& datasetDir, int numThreads)
+	{
+		std::vector<std::string> dirs = GetDirectories(resultsDir);
+		std::vector<PairEntry> pairs(dirs.size());
+
+		// task 2i scans the i-th results directory and task 2i+1 its dataset directory
+		ParallelUtils::ParallelFor((int)dirs.size() * 2, numThreads, [&](int t)
+		{
+			PairEntry& pair = pairs[t / 2];
+			if (t % 2 == 0) {
+				pair.name = dirs[t / 2];
+				pair.result = ScanPairFiles(JoinPath(resultsDir, dirs[t / 2]));
+			}
+			else
+				pair.dataset = ScanPairFiles(JoinPath(datasetDir, dirs[t / 2]));
+		});
+		return pairs;
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace FsUtil
+{
+#ifdef _WIN32
+	const char SEPARATOR = '\\';
+#else
+	const char SEPARATOR = '/';
+#endif
+
+	// dir + separator + name (just dir if name is empty)
+	std::string JoinPath(const std::string& dir, const std::string& name);
+
+	// names of the non-hidden sub-directories / files of dir in sorted order
+	std::vector<std::string> GetDirectories(const std::string& dir);
+	std::vector<std::string> GetFiles(const std::string& dir);
+
+	// true if name matches pattern, where '*' matches any characters and '?' any one character
+	bool MatchWildcard(const std::string& pattern, const std::string& name);
+
+	// Splits a ';'-separated list of directories. An entry whose last component contains
+	// wildcards is replaced by the matching sub-directories of its parent in sorted order.
+	std::vector<std::string> ExpandDirectoryList(const std::string& list);
+
+	// Mounts a pack file (see PackFile.h) at its own path, so that the functions of this file
+	// see path/<pair>/<file> as in the tree the pack was built from. Packs are read-only and
+	// have to be mounted before other threads use these functions.
+	bool MountPack(const std::string& path);
+
+	// true if path lies inside a mounted pack
+	bool IsPacked(const std::string& path);
+
+	// directory for the files written about a tree (scores, visualization): the tree itself,
+	// or for a mounted pack its path without the .pack extension, created if needed
+	std::string OutputDir(const std::string& path);
+
+	// path relative to the root instead of the working directory, or path itself if it cannot be resolved
+	std::string AbsolutePath(const std::string& path);
+
+	bool FileExists(const std::string& path);
+	bool MakeDirectory(const std::string& path);
+
+	// read the whole file into data, false if it cannot be read
+	bool ReadFile(const std::string& path, std::vector<unsigned char>& data);
+
+	// size and modification time of a file, false if it does not exist
+	bool GetFileStamp(const std::string& path, long long& size, long long& mtime);
+
+	// files of a pair directory used by the evaluation
+	enum PairFile { FLOW1_FLO, FLOW2_FLO, MASK1_PNG, MASK2_PNG, PAIR_TXT, FLIP_GT_TXT, IMAGE1_PNG, IMAGE2_PNG, NUM_PAIR_FILES };
+	extern const char* PAIR_FILE_NAMES[NUM_PAIR_FILES];
+
+	// set of PairFile present in a directory
+	struct PairFiles
+	{
+		unsigned flags;
+
+		PairFiles() : flags(0) {}
+		bool Has(PairFile f) const { return (flags >> f) & 1; }
+		bool HasAny() const { return flags != 0; }
+		void Set(PairFile f) { flags |= 1u << f; }
+	};
+
+	// one pair directory of a results tree and the matching dataset directory
+	struct PairEntry
+	{
+		std::string name;
+		PairFiles result, dataset;
+	};
+
+	// scans a single pair directory for the files it contains
+	PairFiles ScanPairFiles(const std::string& dir);
+
+	// Lists the pair directories of resultsDir in sorted order, and checks which of the
+	// pair files exist in each of them and in the dataset directory of the same name.
+	// Directories are scanned concurrently on up to numThreads workers.
+	std::vector<PairEntry> ScanPairs(const std::string& resultsDir, const std::string& datasetDir, int numThreads = 0);
+}
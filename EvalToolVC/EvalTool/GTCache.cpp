@@ -0,0 +1,331 @@
+#include "GTCache.h"
+#include "FsUtils.h"
+#include "ByteBuffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace GTCache;
+
+static const char CACHE_MAGIC[8] = { 'T', 'S', 'S', 'G', 'T', 'C', '0', '2' };
+static const int HEADER_SIZE = 16;   // magic and offset of the index
+static const int BLOB_ALIGN = 64;
+
+enum { MASK_BITS = 0, MASK_BYTES = 1 };
+
+// source files of a pair whose changes invalidate the cache
+static const FsUtil::PairFile SOURCE_FILES[6] = { FsUtil::FLOW1_FLO, FsUtil::FLOW2_FLO, FsUtil::MASK1_PNG, FsUtil::MASK2_PNG, FsUtil::PAIR_TXT, FsUtil::FLIP_GT_TXT };
+
+static void stat_file(const std::string& path, long long stamp[2])
+{
+	if (!FsUtil::GetFileStamp(path, stamp[0], stamp[1]))
+		stamp[0] = stamp[1] = -1;
+}
+
+// ------------------------------------------------------------------
+// mask packing
+
+// pack a 0/255 mask into bits, row-major and LSB first as PackedMask
+static std::vector<uchar> pack_bits(const cv::Mat& mask)
+{
+	std::vector<uchar> bits(((size_t)mask.rows * mask.cols + 7) / 8, 0);
+	size_t i = 0;
+	for (int y = 0; y < mask.rows; y++)
+	{
+		const uchar* p = mask.ptr<uchar>(y);
+		for (int x = 0; x < mask.cols; x++, i++)
+		if (p[x])
+			bits[i >> 3] |= (uchar)(1 << (i & 7));
+	}
+	return bits;
+}
+
+static cv::Mat unpack_bits(const uchar* bits, int width, int height)
+{
+	cv::Mat mask(height, width, CV_8U);
+	size_t i = 0;
+	for (int y = 0; y < height; y++)
+	{
+		uchar* p = mask.ptr<uchar>(y);
+		for (int x = 0; x < width; x++, i++)
+			p[x] = (bits[i >> 3] >> (i & 7)) & 1 ? 255 : 0;
+	}
+	return mask;
+}
+
+static void set_mask(const cv::Mat& mask, cv::Mat& dst, PackedMask& packed)
+{
+	dst = cv::Mat();
+	if (mask.empty())
+	{
+		packed = PackedMask();
+		return;
+	}
+
+	// packing into the previous bits reuses their memory when a PairGT is decoded again
+	packed.Pack(mask);
+	if (!packed.IsBinary())
+	{
+		packed = PackedMask();
+		dst = mask;
+	}
+}
+
+void PairGT::SetMasks(const cv::Mat& m1, const cv::Mat& m2)
+{
+	set_mask(m1, mask1, packedMask1);
+	set_mask(m2, mask2, packedMask2);
+}
+
+// ------------------------------------------------------------------
+// writing
+
+class CacheWriter : public BufferWriter
+{
+	FILE* fp;
+	long long pos;
+
+public:
+	CacheWriter(FILE* fp) : fp(fp), pos(0) {}
+
+	bool Write(const void* data, size_t size)
+	{
+		if (size > 0 && fwrite(data, 1, size, fp) != size)
+			return false;
+		pos += size;
+		return true;
+	}
+	// append a blob at an aligned position and return its offset
+	long long WriteBlob(const void* data, size_t size)
+	{
+		static const char zeros[BLOB_ALIGN] = { 0 };
+		size_t pad = (size_t)((BLOB_ALIGN - pos % BLOB_ALIGN) % BLOB_ALIGN);
+		if (!Write(zeros, pad))
+			return -1;
+		long long offset = pos;
+		return Write(data, size) ? offset : -1;
+	}
+	long long Position() const { return pos; }
+};
+
+static long long write_mat(CacheWriter& writer, const cv::Mat& m)
+{
+	cv::Mat c = m.isContinuous() ? m : m.clone();
+	return writer.WriteBlob(c.data, c.total() * c.elemSize());
+}
+
+bool Cache::Build(const std::string& cacheFile, const std::string& datasetDir, const std::vector<std::string>& dirs, Loader loader)
+{
+	std::string tmpFile = cacheFile + ".tmp";
+	FILE* fp = fopen(tmpFile.c_str(), "wb");
+	if (fp == NULL)
+		return false;
+
+	CacheWriter writer(fp);
+	bool ok = writer.Write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	long long indexOffset = 0;
+	ok = ok && writer.Write(&indexOffset, sizeof(indexOffset));
+
+	int count = 0;
+	std::vector<uchar> entries;
+	for (size_t i = 0; i < dirs.size() && ok; i++)
+	{
+		std::string dir = FsUtil::JoinPath(datasetDir, dirs[i]);
+
+		// stamp the sources before decoding, so changes made meanwhile are detected later
+		long long stamps[6][2];
+		for (int k = 0; k < 6; k++)
+			stat_file(FsUtil::JoinPath(dir, FsUtil::PAIR_FILE_NAMES[SOURCE_FILES[k]]), stamps[k]);
+
+		PairGT gt;
+		loader(dir, gt);
+		if (gt.empty())
+			continue;
+
+		int maskFormat1 = gt.mask1.empty() ? MASK_BITS : MASK_BYTES;
+		int maskFormat2 = gt.mask2.empty() ? MASK_BITS : MASK_BYTES;
+		long long offsets[6];
+		offsets[0] = write_mat(writer, gt.flow1);
+		offsets[1] = write_mat(writer, gt.flow2);
+		offsets[2] = maskFormat1 == MASK_BITS ? writer.WriteBlob(gt.packedMask1.Bits(), gt.packedMask1.BitsSize()) : write_mat(writer, gt.mask1);
+		offsets[3] = maskFormat2 == MASK_BITS ? writer.WriteBlob(gt.packedMask2.Bits(), gt.packedMask2.BitsSize()) : write_mat(writer, gt.mask2);
+		std::vector<uchar> v1 = pack_bits(gt.valid1);
+		std::vector<uchar> v2 = pack_bits(gt.valid2);
+		offsets[4] = writer.WriteBlob(v1.data(), v1.size());
+		offsets[5] = writer.WriteBlob(v2.data(), v2.size());
+		for (int k = 0; k < 6; k++)
+			ok = ok && offsets[k] >= 0;
+
+		writer.PutString(dirs[i]);
+		writer.PutString(gt.name1);
+		writer.PutString(gt.name2);
+		writer.Put(gt.flip);
+		writer.Put(gt.flow1.cols);
+		writer.Put(gt.flow1.rows);
+		writer.Put(gt.flow2.cols);
+		writer.Put(gt.flow2.rows);
+		writer.Put(gt.MaskSize1().width);
+		writer.Put(gt.MaskSize1().height);
+		writer.Put(gt.MaskSize2().width);
+		writer.Put(gt.MaskSize2().height);
+		writer.Put(maskFormat1);
+		writer.Put(maskFormat2);
+		for (int k = 0; k < 6; k++)
+			writer.Put(offsets[k]);
+		for (int k = 0; k < 6; k++) {
+			writer.Put(stamps[k][0]);
+			writer.Put(stamps[k][1]);
+		}
+		count++;
+	}
+
+	// index: dataset path, number of pairs and the entries
+	std::vector<uchar> pairs;
+	pairs.swap(writer.buffer);
+	writer.PutString(datasetDir);
+	writer.Put(count);
+	writer.buffer.insert(writer.buffer.end(), pairs.begin(), pairs.end());
+
+	indexOffset = writer.Position();
+	ok = ok && writer.Write(writer.buffer.data(), writer.buffer.size());
+	ok = ok && fseek(fp, sizeof(CACHE_MAGIC), SEEK_SET) == 0;
+	ok = ok && fwrite(&indexOffset, sizeof(indexOffset), 1, fp) == 1;
+	ok = (fclose(fp) == 0) && ok;
+
+	if (ok)
+	{
+		remove(cacheFile.c_str());
+		ok = rename(tmpFile.c_str(), cacheFile.c_str()) == 0;
+	}
+	if (!ok)
+		remove(tmpFile.c_str());
+	return ok;
+}
+
+// ------------------------------------------------------------------
+// reading
+
+bool Cache::Open(const std::string& cacheFile, const std::string& datasetDir)
+{
+	Close();
+	if (!file.Open(cacheFile.c_str()) || !parse(datasetDir))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void Cache::Close()
+{
+	file.Close();
+	entries.clear();
+	index.clear();
+}
+
+bool Cache::parse(const std::string& datasetDir)
+{
+	const uchar* data = file.Data();
+	const long long size = (long long)file.Size();
+	if (size < HEADER_SIZE || memcmp(data, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0)
+		return false;
+
+	long long indexOffset;
+	memcpy(&indexOffset, data + sizeof(CACHE_MAGIC), sizeof(indexOffset));
+	if (indexOffset < HEADER_SIZE || indexOffset > size)
+		return false;
+
+	BufferReader reader(data + indexOffset, data + size);
+	if (reader.GetString() != datasetDir)
+		return false;
+
+	int count = reader.Get<int>();
+	for (int i = 0; i < count && reader.ok; i++)
+	{
+		Entry e;
+		e.dir = reader.GetString();
+		e.name1 = reader.GetString();
+		e.name2 = reader.GetString();
+		e.flip = reader.Get<int>();
+		e.width1 = reader.Get<int>();
+		e.height1 = reader.Get<int>();
+		e.width2 = reader.Get<int>();
+		e.height2 = reader.Get<int>();
+		e.maskWidth1 = reader.Get<int>();
+		e.maskHeight1 = reader.Get<int>();
+		e.maskWidth2 = reader.Get<int>();
+		e.maskHeight2 = reader.Get<int>();
+		e.maskFormat1 = reader.Get<int>();
+		e.maskFormat2 = reader.Get<int>();
+		e.flow1 = reader.Get<long long>();
+		e.flow2 = reader.Get<long long>();
+		e.mask1 = reader.Get<long long>();
+		e.mask2 = reader.Get<long long>();
+		e.valid1 = reader.Get<long long>();
+		e.valid2 = reader.Get<long long>();
+		for (int k = 0; k < 6; k++) {
+			e.stamps[k][0] = reader.Get<long long>();
+			e.stamps[k][1] = reader.Get<long long>();
+		}
+		if (!reader.ok)
+			return false;
+
+		// every blob has to lie inside the file
+		const long long area1 = (long long)e.width1 * e.height1, area2 = (long long)e.width2 * e.height2;
+		const long long maskArea1 = (long long)e.maskWidth1 * e.maskHeight1, maskArea2 = (long long)e.maskWidth2 * e.maskHeight2;
+		const long long ends[6] = {
+			e.flow1 + area1 * 8, e.flow2 + area2 * 8,
+			e.mask1 + (e.maskFormat1 == MASK_BITS ? (maskArea1 + 7) / 8 : maskArea1),
+			e.mask2 + (e.maskFormat2 == MASK_BITS ? (maskArea2 + 7) / 8 : maskArea2),
+			e.valid1 + (area1 + 7) / 8, e.valid2 + (area2 + 7) / 8 };
+		const long long begins[6] = { e.flow1, e.flow2, e.mask1, e.mask2, e.valid1, e.valid2 };
+		if (e.width1 < 1 || e.height1 < 1 || e.width2 < 1 || e.height2 < 1 ||
+			e.maskWidth1 < 1 || e.maskHeight1 < 1 || e.maskWidth2 < 1 || e.maskHeight2 < 1)
+			return false;
+		for (int k = 0; k < 6; k++)
+		if (begins[k] < HEADER_SIZE || ends[k] > indexOffset)
+			return false;
+
+		// any modified source file makes the whole cache stale
+		for (int k = 0; k < 6; k++)
+		{
+			long long stamp[2];
+			stat_file(FsUtil::JoinPath(FsUtil::JoinPath(datasetDir, e.dir), FsUtil::PAIR_FILE_NAMES[SOURCE_FILES[k]]), stamp);
+			if (stamp[0] != e.stamps[k][0] || stamp[1] != e.stamps[k][1])
+				return false;
+		}
+
+		index[e.dir] = (int)entries.size();
+		entries.push_back(e);
+	}
+	return reader.ok;
+}
+
+bool Cache::Get(const std::string& dir, PairGT& gt) const
+{
+	auto it = index.find(dir);
+	if (it == index.end())
+		return false;
+
+	const Entry& e = entries[it->second];
+	uchar* data = file.Data();
+
+	gt.name1 = e.name1;
+	gt.name2 = e.name2;
+	gt.flip = e.flip;
+	gt.flow1 = cv::Mat(e.height1, e.width1, CV_32FC2, data + e.flow1);
+	gt.flow2 = cv::Mat(e.height2, e.width2, CV_32FC2, data + e.flow2);
+	gt.mask1 = gt.mask2 = cv::Mat();
+	gt.packedMask1 = gt.packedMask2 = PackedMask();
+	if (e.maskFormat1 == MASK_BITS)
+		gt.packedMask1.Assign(data + e.mask1, e.maskWidth1, e.maskHeight1);
+	else
+		gt.mask1 = cv::Mat(e.maskHeight1, e.maskWidth1, CV_8U, data + e.mask1);
+	if (e.maskFormat2 == MASK_BITS)
+		gt.packedMask2.Assign(data + e.mask2, e.maskWidth2, e.maskHeight2);
+	else
+		gt.mask2 = cv::Mat(e.maskHeight2, e.maskWidth2, CV_8U, data + e.mask2);
+	gt.valid1 = unpack_bits(data + e.valid1, e.width1, e.height1);
+	gt.valid2 = unpack_bits(data + e.valid2, e.width2, e.height2);
+	return true;
+}
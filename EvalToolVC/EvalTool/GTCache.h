@@ -0,0 +1,74 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+#include "MappedFile.h"
+#include "PackedMask.h"
+
+namespace GTCache
+{
+	// Decoded ground truth of one image pair
+	struct PairGT
+	{
+		std::string name1, name2;   // image names from pair.txt
+		int flip;                   // value of flip_gt.txt
+		cv::Mat flow1, flow2;       // CV_32FC2 flows
+		cv::Mat mask1, mask2;       // CV_8U foreground masks, only kept if they are not 0/255
+		PackedMask packedMask1, packedMask2;  // 0/255 foreground masks packed into bits
+		cv::Mat valid1, valid2;     // CV_8U masks of known GT flow (0/255)
+
+		PairGT() : flip(0) {}
+		bool empty() const { return flow1.empty() || flow2.empty() || MaskSize1().area() == 0 || MaskSize2().area() == 0; }
+		cv::Size MaskSize1() const { return mask1.empty() ? packedMask1.size() : mask1.size(); }
+		cv::Size MaskSize2() const { return mask2.empty() ? packedMask2.size() : mask2.size(); }
+
+		// Stores decoded foreground masks, packing them into bits if they are 0/255.
+		void SetMasks(const cv::Mat& m1, const cv::Mat& m2);
+	};
+
+	// Decodes the ground truth of the pair directory 'dir'.
+	typedef std::function<void(const std::string& dir, PairGT& gt)> Loader;
+
+	// Pre-decoded ground truth of a dataset stored in a single binary file.
+	// Flows are stored raw and returned as views over the mapped file, and binary
+	// masks are stored as packed bits. The file records the dataset path and the
+	// size and modification time of every source file, and is rejected as stale
+	// if any of them has changed.
+	class Cache
+	{
+		struct Entry
+		{
+			std::string dir, name1, name2;
+			int flip;
+			int width1, height1, width2, height2;           // flow sizes
+			int maskWidth1, maskHeight1, maskWidth2, maskHeight2;   // mask sizes, which may differ from the flows
+			long long flow1, flow2, mask1, mask2, valid1, valid2; // byte offsets in the file
+			int maskFormat1, maskFormat2;
+			long long stamps[6][2];  // size and mtime of the source files
+		};
+
+		MappedFile file;
+		std::vector<Entry> entries;
+		std::map<std::string, int> index;
+
+		bool parse(const std::string& datasetDir);
+
+	public:
+		// Opens a cache built for datasetDir. Returns false if the file is missing, broken or stale.
+		bool Open(const std::string& cacheFile, const std::string& datasetDir);
+		void Close();
+
+		bool IsOpen() const { return file.IsOpen(); }
+		int Size() const { return (int)entries.size(); }
+		bool Contains(const std::string& dir) const { return index.count(dir) != 0; }
+
+		// Ground truth of pair directory 'dir', or false if the pair is not in the cache.
+		bool Get(const std::string& dir, PairGT& gt) const;
+
+		// Decodes all pairs in 'dirs' with 'loader' and writes them to cacheFile.
+		static bool Build(const std::string& cacheFile, const std::string& datasetDir, const std::vector<std::string>& dirs, Loader loader);
+	};
+}
@@ -0,0 +1,120 @@
+#include "ImageWriter.h"
+#include "Profiler.h"
+
+#include <stdio.h>
+
+namespace ImageWriter
+{
+	int ParsePngStrategy(const std::string& name)
+	{
+		if (name == "default") return cv::IMWRITE_PNG_STRATEGY_DEFAULT;
+		if (name == "filtered") return cv::IMWRITE_PNG_STRATEGY_FILTERED;
+		if (name == "huffman") return cv::IMWRITE_PNG_STRATEGY_HUFFMAN_ONLY;
+		if (name == "rle") return cv::IMWRITE_PNG_STRATEGY_RLE;
+		if (name == "fixed") return cv::IMWRITE_PNG_STRATEGY_FIXED;
+		return -1;
+	}
+
+	Writer::Writer(const Options& o)
+		: options(o), queuedBytes(0), maxBytes((size_t)std::max(o.maxQueueMB, 1) << 20), closed(false), failures(0)
+	{
+		if (options.format != "bmp" && options.format != "ppm")
+			options.format = "png";
+		if (options.format == "png")
+		{
+			if (options.pngCompression >= 0) {
+				params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+				params.push_back(std::min(options.pngCompression, 9));
+			}
+			if (options.pngStrategy >= 0) {
+				params.push_back(cv::IMWRITE_PNG_STRATEGY);
+				params.push_back(options.pngStrategy);
+			}
+		}
+		for (int t = 0; t < options.threads; t++)
+			workers.push_back(std::thread([this]{ worker(); }));
+	}
+
+	Writer::~Writer()
+	{
+		Finish();
+	}
+
+	bool Writer::write(const Job& job)
+	{
+		Profiler::Scope scope("encode image", job.path);
+		std::vector<uchar> bytes;
+		if (!cv::imencode(Extension(), job.image, bytes, params))
+			return false;
+		FILE* fp = fopen(job.path.c_str(), "wb");
+		if (fp == NULL)
+			return false;
+		bool ok = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+		ok = (fclose(fp) == 0) && ok;
+		Profiler::AddBytes("written", (long long)bytes.size());
+		return ok;
+	}
+
+	void Writer::worker()
+	{
+		Profiler::SetThreadName("encode");
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				notEmpty.wait(lock, [&]{ return closed || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			bool ok = write(job);
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				queuedBytes -= job.image.total() * job.image.elemSize();
+				if (!ok) {
+					failures++;
+					printf("Failed to write %s\n", job.path.c_str());
+				}
+			}
+			notFull.notify_all();
+		}
+	}
+
+	void Writer::Write(const std::string& path, const cv::Mat& image)
+	{
+		Job job;
+		job.path = path + Extension();
+		job.image = image;
+		if (workers.empty())
+		{
+			if (!write(job)) {
+				failures++;
+				printf("Failed to write %s\n", job.path.c_str());
+			}
+			return;
+		}
+
+		const size_t bytes = image.total() * image.elemSize();
+		std::unique_lock<std::mutex> lock(mtx);
+		// an image larger than the whole budget is still accepted once the queue is empty
+		notFull.wait(lock, [&]{ return queuedBytes == 0 || queuedBytes + bytes <= maxBytes; });
+		queuedBytes += bytes;
+		jobs.push_back(job);
+		notEmpty.notify_one();
+	}
+
+	int Writer::Finish()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			closed = true;
+		}
+		notEmpty.notify_all();
+		for (auto& w : workers)
+			w.join();
+		workers.clear();
+		return failures;
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes and writes images on background threads, so that the next pair is
+// computed while the previous one is being compressed.
+namespace ImageWriter
+{
+	struct Options
+	{
+		std::string format;   // "png", or the faster lossless "bmp" and "ppm"
+		int pngCompression;   // zlib level 0-9, -1 for the OpenCV default
+		int pngStrategy;      // cv::IMWRITE_PNG_STRATEGY_*, -1 for the OpenCV default
+		int threads;          // encoding threads, 0 writes synchronously
+		int maxQueueMB;       // images waiting for encoding, in MB
+
+		Options() : format("png"), pngCompression(-1), pngStrategy(-1), threads(2), maxQueueMB(256) {}
+	};
+
+	// cv::IMWRITE_PNG_STRATEGY_* for "default", "filtered", "huffman", "rle" or "fixed"; -1 if unknown.
+	int ParsePngStrategy(const std::string& name);
+
+	class Writer
+	{
+		struct Job
+		{
+			std::string path;
+			cv::Mat image;
+		};
+
+		Options options;
+		std::vector<int> params;
+		std::deque<Job> jobs;
+		size_t queuedBytes, maxBytes;
+		bool closed;
+		int failures;
+		std::mutex mtx;
+		std::condition_variable notFull, notEmpty;
+		std::vector<std::thread> workers;
+
+		bool write(const Job& job);
+		void worker();
+
+		Writer(const Writer&);
+		Writer& operator=(const Writer&);
+
+	public:
+		explicit Writer(const Options& options);
+		~Writer();
+
+		// File extension of the output format, e.g. ".png".
+		std::string Extension() const { return "." + options.format; }
+
+		// Queues the image for writing to path (without extension). The image must not be
+		// modified afterwards. Blocks while the queued images exceed maxQueueMB.
+		void Write(const std::string& path, const cv::Mat& image);
+
+		// Waits until every queued image has been written. Returns the number of failed writes.
+		int Finish();
+	};
+}
@@ -0,0 +1,201 @@
+#include "LocalSocket.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+// from afunix.h of the Windows 10 SDK
+struct sockaddr_un
+{
+	ADDRESS_FAMILY sun_family;
+	char sun_path[108];
+};
+typedef int socklen_t;
+#define close_socket closesocket
+// INVALID_SOCKET as -1 also in 32-bit builds
+#define socket_fd(s) ((s) == INVALID_SOCKET ? -1LL : (long long)(s))
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#define close_socket close
+#define socket_fd(s) ((long long)(s))
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace LocalSocket
+{
+	static bool startup()
+	{
+#ifdef _WIN32
+		static bool started = false;
+		if (!started)
+		{
+			WSADATA data;
+			started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}
+		return started;
+#else
+		return true;
+#endif
+	}
+
+	static bool make_address(const std::string& path, sockaddr_un& addr)
+	{
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (path.empty() || path.size() >= sizeof(addr.sun_path))
+			return false;
+		memcpy(addr.sun_path, path.c_str(), path.size());
+		return true;
+	}
+
+	// sends or receives exactly size bytes, retrying on interrupted and partial transfers
+	static bool send_all(long long fd, const unsigned char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			int chunk = (int)(size < (1 << 30) ? size : (1 << 30));
+			int n = (int)send(fd, (const char*)data, chunk, MSG_NOSIGNAL);
+#ifndef _WIN32
+			if (n < 0 && errno == EINTR)
+				continue;
+#endif
+			if (n <= 0)
+				return false;
+			data += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	static bool receive_all(long long fd, unsigned char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			int chunk = (int)(size < (1 << 30) ? size : (1 << 30));
+			int n = (int)recv(fd, (char*)data, chunk, 0);
+#ifndef _WIN32
+			if (n < 0 && errno == EINTR)
+				continue;
+#endif
+			if (n <= 0)
+				return false;
+			data += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	bool Connection::Send(const std::vector<unsigned char>& message)
+	{
+		if (fd < 0 || message.size() > MAX_MESSAGE_SIZE)
+			return false;
+		const unsigned size = (unsigned)message.size();
+		const unsigned char header[4] = { (unsigned char)size, (unsigned char)(size >> 8), (unsigned char)(size >> 16), (unsigned char)(size >> 24) };
+		return send_all(fd, header, 4) && send_all(fd, message.data(), message.size());
+	}
+
+	bool Connection::Receive(std::vector<unsigned char>& message)
+	{
+		unsigned char header[4];
+		if (fd < 0 || !receive_all(fd, header, 4))
+			return false;
+		const size_t size = header[0] | (header[1] << 8) | (header[2] << 16) | ((size_t)header[3] << 24);
+		if (size > MAX_MESSAGE_SIZE)
+			return false;
+		message.resize(size);
+		return size == 0 || receive_all(fd, message.data(), size);
+	}
+
+	void Connection::Shutdown()
+	{
+#ifdef _WIN32
+		if (fd >= 0)
+			shutdown(fd, SD_BOTH);
+#else
+		if (fd >= 0)
+			shutdown(fd, SHUT_RDWR);
+#endif
+	}
+
+	void Connection::Close()
+	{
+		if (fd >= 0)
+			close_socket(fd);
+		fd = -1;
+	}
+
+	bool Server::Listen(const std::string& socketPath)
+	{
+		Close();
+		sockaddr_un addr;
+		if (!startup() || !make_address(socketPath, addr))
+			return false;
+		// a socket file left by a server that did not exit cleanly refuses connections; replace it
+		std::unique_ptr<Connection> existing = Connect(socketPath);
+		if (existing)
+			return false;
+		remove(socketPath.c_str());
+
+		long long s = socket_fd(socket(AF_UNIX, SOCK_STREAM, 0));
+		if (s < 0)
+			return false;
+		if (bind(s, (const sockaddr*)&addr, (socklen_t)sizeof(addr)) != 0 || listen(s, 16) != 0)
+		{
+			close_socket(s);
+			return false;
+		}
+		fd = s;
+		path = socketPath;
+		return true;
+	}
+
+	std::unique_ptr<Connection> Server::Accept()
+	{
+		for (;;)
+		{
+			if (fd < 0)
+				return std::unique_ptr<Connection>();
+			long long c = socket_fd(accept(fd, NULL, NULL));
+			if (c >= 0)
+				return std::unique_ptr<Connection>(new Connection(c));
+#ifndef _WIN32
+			if (errno == EINTR)
+				continue;
+#endif
+			return std::unique_ptr<Connection>();
+		}
+	}
+
+	void Server::Close()
+	{
+		if (fd < 0)
+			return;
+		close_socket(fd);
+		fd = -1;
+		remove(path.c_str());
+	}
+
+	std::unique_ptr<Connection> Connect(const std::string& path)
+	{
+		sockaddr_un addr;
+		if (!startup() || !make_address(path, addr))
+			return std::unique_ptr<Connection>();
+		long long s = socket_fd(socket(AF_UNIX, SOCK_STREAM, 0));
+		if (s < 0)
+			return std::unique_ptr<Connection>();
+		if (connect(s, (const sockaddr*)&addr, (socklen_t)sizeof(addr)) != 0)
+		{
+			close_socket(s);
+			return std::unique_ptr<Connection>();
+		}
+		return std::unique_ptr<Connection>(new Connection(s));
+	}
+}
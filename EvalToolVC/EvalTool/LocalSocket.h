@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+
+// Unix domain stream sockets (AF_UNIX, also available on Windows 10 and later) carrying
+// length-prefixed messages: a 4-byte little-endian size followed by that many bytes.
+namespace LocalSocket
+{
+	// largest message accepted, so that a stray client cannot make the server allocate without bound
+	const size_t MAX_MESSAGE_SIZE = (size_t)1 << 30;
+
+	class Connection
+	{
+		long long fd;
+
+		Connection(const Connection&);
+		Connection& operator=(const Connection&);
+
+	public:
+		explicit Connection(long long fd) : fd(fd) {}
+		~Connection() { Close(); }
+
+		bool Send(const std::vector<unsigned char>& message);
+
+		// Waits for the next message. Returns false when the peer has closed the connection or
+		// on an error, including a message larger than MAX_MESSAGE_SIZE.
+		bool Receive(std::vector<unsigned char>& message);
+
+		// Ends the connection in both directions, waking a thread blocked in Receive.
+		void Shutdown();
+
+		void Close();
+	};
+
+	class Server
+	{
+		long long fd;
+		std::string path;
+
+		Server(const Server&);
+		Server& operator=(const Server&);
+
+	public:
+		Server() : fd(-1) {}
+		~Server() { Close(); }
+
+		// Listens on a socket file, replacing a stale one left by a previous server.
+		bool Listen(const std::string& path);
+
+		// Waits for the next client. Returns NULL on an error or after Close.
+		std::unique_ptr<Connection> Accept();
+
+		// Stops listening and removes the socket file.
+		void Close();
+	};
+
+	// connects to a server, NULL if there is none at path
+	std::unique_ptr<Connection> Connect(const std::string& path);
+}
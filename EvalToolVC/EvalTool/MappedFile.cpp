@@ -0,0 +1,137 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : data(0), size(0), file(0), mapping(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+void MappedFile::Prefault() const
+{
+#ifndef _WIN32
+	madvise(data, size, MADV_WILLNEED);
+#endif
+	const size_t PAGE_SIZE = 4096;
+	volatile unsigned char sink = 0;
+	for (size_t i = 0; i < size; i += PAGE_SIZE)
+		sink ^= data[i];
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+
+	HANDLE hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER len;
+	if (!GetFileSizeEx(hFile, &len) || len.QuadPart == 0)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	HANDLE hMap = CreateFileMappingA(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (hMap == NULL)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	void* view = MapViewOfFile(hMap, FILE_MAP_COPY, 0, 0, 0);
+	if (view == NULL)
+	{
+		CloseHandle(hMap);
+		CloseHandle(hFile);
+		return false;
+	}
+
+	file = hFile;
+	mapping = hMap;
+	data = (unsigned char*)view;
+	size = (size_t)len.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != 0)
+		UnmapViewOfFile(data);
+	if (mapping != 0)
+		CloseHandle((HANDLE)mapping);
+	if (file != 0)
+		CloseHandle((HANDLE)file);
+	data = 0;
+	size = 0;
+	file = 0;
+	mapping = 0;
+}
+
+long long MappedFile::FileSize(const char* filename)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &fad))
+		return -1;
+	return ((long long)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+}
+
+#else
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+	madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	data = (unsigned char*)view;
+	size = (size_t)st.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != 0)
+		munmap(data, size);
+	data = 0;
+	size = 0;
+}
+
+long long MappedFile::FileSize(const char* filename)
+{
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		return -1;
+	return (long long)st.st_size;
+}
+
+#endif
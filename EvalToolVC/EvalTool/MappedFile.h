@@ -0,0 +1,33 @@
+#pragma once
+#include <stddef.h>
+
+// Read-only view of a whole file mapped into memory.
+// Pages are mapped copy-on-write, so writing into the view never modifies the file.
+class MappedFile
+{
+	unsigned char* data;
+	size_t size;
+	void* file;     // HANDLE on Windows, file descriptor otherwise
+	void* mapping;  // file mapping HANDLE on Windows
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	// map the whole file, returns false if it cannot be opened or is empty
+	bool Open(const char* filename);
+	void Close();
+
+	// reads every page of the view, so that later accesses do not wait for the disk
+	void Prefault() const;
+
+	bool IsOpen() const { return data != 0; }
+	unsigned char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+	// size of a file in bytes without mapping it, or -1 if it does not exist
+	static long long FileSize(const char* filename);
+};
@@ -0,0 +1,191 @@
+#include "PackFile.h"
+#include "ByteBuffer.h"
+#include "FsUtils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+namespace PackFile
+{
+	static const char TAG[8] = { 'T', 'S', 'S', 'P', 'A', 'C', 'K', '1' };
+	static const int HEADER_SIZE = 24;
+	static const long long ALIGNMENT = 64;
+
+	static long long align(long long offset)
+	{
+		return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	bool IsPack(const std::string& path)
+	{
+		FILE* fp = fopen(path.c_str(), "rb");
+		if (fp == NULL)
+			return false;
+		char tag[8];
+		bool ok = fread(tag, 1, 8, fp) == 8 && memcmp(tag, TAG, 8) == 0;
+		fclose(fp);
+		return ok;
+	}
+
+	// files of a pair directory in pack order: the evaluation files first, then the others by name
+	static std::vector<std::string> pack_order(const std::vector<std::string>& files)
+	{
+		std::vector<std::string> order;
+		for (int f = 0; f < FsUtil::NUM_PAIR_FILES; f++)
+		if (std::find(files.begin(), files.end(), FsUtil::PAIR_FILE_NAMES[f]) != files.end())
+			order.push_back(FsUtil::PAIR_FILE_NAMES[f]);
+		for (const std::string& name : files)
+		if (std::find(order.begin(), order.end(), name) == order.end())
+			order.push_back(name);
+		return order;
+	}
+
+	bool Build(const std::string& dir, const std::string& packFile)
+	{
+		// the index is written first, so the sizes of the files are taken from their stamps
+		std::vector<Archive::Entry> entries;
+		long long dataSize = 0;
+		const std::vector<std::string> dirs = FsUtil::GetDirectories(dir);
+		for (const std::string& d : dirs)
+		for (const std::string& name : pack_order(FsUtil::GetFiles(FsUtil::JoinPath(dir, d))))
+		{
+			Archive::Entry e;
+			e.dir = d;
+			e.name = name;
+			if (!FsUtil::GetFileStamp(FsUtil::JoinPath(FsUtil::JoinPath(dir, d), name), e.size, e.mtime))
+			{
+				printf("Failed to read %s\n", FsUtil::JoinPath(FsUtil::JoinPath(dir, d), name).c_str());
+				return false;
+			}
+			e.offset = align(dataSize);
+			dataSize = e.offset + e.size;
+			entries.push_back(e);
+		}
+
+		BufferWriter index;
+		for (const Archive::Entry& e : entries)
+		{
+			index.PutString(e.dir);
+			index.PutString(e.name);
+			index.Put(e.offset);
+			index.Put(e.size);
+			index.Put(e.mtime);
+		}
+		const long long dataOffset = align(HEADER_SIZE + (long long)index.buffer.size());
+
+		// written to a temporary file first so that a failed run leaves no broken pack
+		const std::string temp = packFile + ".tmp";
+		FILE* fp = fopen(temp.c_str(), "wb");
+		if (fp == NULL)
+		{
+			printf("Failed to open the output file: %s\n", temp.c_str());
+			return false;
+		}
+		BufferWriter header;
+		header.PutBytes(TAG, 8);
+		header.Put((int)entries.size());
+		header.Put((int)0);
+		header.Put(dataOffset);
+		bool ok = fwrite(header.buffer.data(), 1, header.buffer.size(), fp) == header.buffer.size();
+		ok = ok && fwrite(index.buffer.data(), 1, index.buffer.size(), fp) == index.buffer.size();
+
+		long long pos = HEADER_SIZE + (long long)index.buffer.size();
+		const std::vector<unsigned char> padding(ALIGNMENT, 0);
+		std::vector<unsigned char> contents;
+		for (size_t i = 0; ok && i <= entries.size(); i++)
+		{
+			const long long start = dataOffset + (i < entries.size() ? entries[i].offset : dataSize);
+			ok = fwrite(padding.data(), 1, (size_t)(start - pos), fp) == (size_t)(start - pos);
+			pos = start;
+			if (!ok || i == entries.size())
+				break;
+
+			const Archive::Entry& e = entries[i];
+			const std::string path = FsUtil::JoinPath(FsUtil::JoinPath(dir, e.dir), e.name);
+			if (!FsUtil::ReadFile(path, contents) || (long long)contents.size() != e.size)
+			{
+				printf("Failed to read %s (or it changed while packing)\n", path.c_str());
+				ok = false;
+				break;
+			}
+			ok = fwrite(contents.data(), 1, contents.size(), fp) == contents.size();
+			pos += e.size;
+		}
+		ok = (fclose(fp) == 0) && ok;
+
+		remove(packFile.c_str());
+		if (!ok || rename(temp.c_str(), packFile.c_str()) != 0)
+		{
+			printf("Failed to write %s\n", packFile.c_str());
+			remove(temp.c_str());
+			return false;
+		}
+		int numPairs = 0;
+		for (size_t i = 0; i < entries.size(); i++)
+			numPairs += i == 0 || entries[i].dir != entries[i - 1].dir;
+		printf("Packed %d files of %d pairs (%.1lf MB) into %s\n", (int)entries.size(), numPairs, (dataOffset + dataSize) / 1048576.0, packFile.c_str());
+		return true;
+	}
+
+	bool Archive::Open(const std::string& packFile)
+	{
+		entries.clear();
+		dirs.clear();
+		dirEntries.clear();
+		if (!file.Open(packFile.c_str()) || file.Size() < (size_t)HEADER_SIZE || memcmp(file.Data(), TAG, 8) != 0)
+			return false;
+
+		BufferReader reader(file.Data() + 8, file.Data() + file.Size());
+		const int count = reader.Get<int>();
+		reader.Get<int>();
+		const long long dataOffset = reader.Get<long long>();
+		if (!reader.ok || count < 0 || dataOffset < HEADER_SIZE || dataOffset > (long long)file.Size())
+			return false;
+		data = file.Data() + dataOffset;
+		const long long dataSize = (long long)file.Size() - dataOffset;
+
+		// the index is built aside and kept only if every entry is valid
+		std::vector<Entry> newEntries;
+		std::vector<std::string> newDirs;
+		std::map<std::string, std::vector<int> > newDirEntries;
+		for (int i = 0; i < count; i++)
+		{
+			Entry e;
+			e.dir = reader.GetString();
+			e.name = reader.GetString();
+			e.offset = reader.Get<long long>();
+			e.size = reader.Get<long long>();
+			e.mtime = reader.Get<long long>();
+			if (!reader.ok || e.offset < 0 || e.size < 0 || e.offset > dataSize || e.size > dataSize - e.offset)
+				return false;
+			std::vector<int>& files = newDirEntries[e.dir];
+			if (files.empty())
+				newDirs.push_back(e.dir);
+			files.push_back((int)newEntries.size());
+			newEntries.push_back(e);
+		}
+		std::sort(newDirs.begin(), newDirs.end());
+		entries.swap(newEntries);
+		dirs.swap(newDirs);
+		dirEntries.swap(newDirEntries);
+		return true;
+	}
+
+	const std::vector<int>* Archive::Files(const std::string& dir) const
+	{
+		auto it = dirEntries.find(dir);
+		return it == dirEntries.end() ? NULL : &it->second;
+	}
+
+	const Archive::Entry* Archive::Find(const std::string& dir, const std::string& name) const
+	{
+		const std::vector<int>* files = Files(dir);
+		if (files == NULL)
+			return NULL;
+		for (int i : *files)
+		if (entries[i].name == name)
+			return &entries[i];
+		return NULL;
+	}
+}
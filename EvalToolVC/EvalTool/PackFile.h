@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+
+#include "MappedFile.h"
+
+// Single-file archive of a dataset or results tree: its pair directories and their files.
+// Built by -mode pack and read through one mapping of the whole file.
+//
+//  bytes  contents
+//
+//  0-7     tag: "TSSPACK1"
+//  8-11    number of files as an integer
+//  12-15   reserved (0)
+//  16-23   offset of the data section as a long long
+//  24-     index: for each file, the pair directory and file name as length-prefixed strings,
+//          then the offset in the data section, the size and the modification time of the
+//          source file as long longs
+//  data    the contents of the files, each starting at a multiple of 64 bytes. The files of
+//          a pair are stored together, flows and masks first.
+namespace PackFile
+{
+	// true if path is a file starting with the pack tag
+	bool IsPack(const std::string& path);
+
+	// Packs the pair directories of dir into packFile. Returns false on a read or write error.
+	bool Build(const std::string& dir, const std::string& packFile);
+
+	class Archive
+	{
+	public:
+		struct Entry
+		{
+			std::string dir, name;
+			long long offset, size, mtime;
+		};
+
+	private:
+		MappedFile file;
+		const unsigned char* data;   // start of the data section
+		std::vector<Entry> entries;
+		std::vector<std::string> dirs;
+		std::map<std::string, std::vector<int> > dirEntries;   // entries of each pair directory
+
+		Archive(const Archive&);
+		Archive& operator=(const Archive&);
+
+	public:
+		Archive() : data(0) {}
+
+		// Maps a pack file. Returns false if it is missing or broken.
+		bool Open(const std::string& packFile);
+
+		// pair directories in sorted order
+		const std::vector<std::string>& Directories() const { return dirs; }
+
+		// files of a pair directory, NULL if there is no such directory
+		const std::vector<int>* Files(const std::string& dir) const;
+
+		const Entry& GetEntry(int i) const { return entries[i]; }
+		const unsigned char* Data(const Entry& e) const { return data + e.offset; }
+
+		// file of a pair directory, NULL if not found
+		const Entry* Find(const std::string& dir, const std::string& name) const;
+	};
+}
@@ -0,0 +1,169 @@
+#include "PackedMask.h"
+#include <string.h>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+void PackedMask::Pack(const cv::Mat& mask)
+{
+	CV_Assert(mask.type() == CV_8U);
+	width = mask.cols;
+	height = mask.rows;
+
+	const size_t words = ((size_t)width * height + 63) / 64;
+	nonzero.assign(words, 0);
+	full.assign(words, 0);
+
+	bool binary = true;
+	size_t i = 0;
+	for (int y = 0; y < height; y++)
+	{
+		const uchar* p = mask.ptr<uchar>(y);
+		for (int x = 0; x < width; x++, i++)
+		{
+			const uint64 bit = (uint64)1 << (i & 63);
+			if (p[x])
+				nonzero[i >> 6] |= bit;
+			if (p[x] == 255)
+				full[i >> 6] |= bit;
+			else if (p[x])
+				binary = false;
+		}
+	}
+
+	if (binary)
+		std::vector<uint64>().swap(full);
+}
+
+void PackedMask::Assign(const uchar* bits, int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	nonzero.assign(((size_t)width * height + 63) / 64, 0);
+	memcpy(nonzero.data(), bits, BitsSize());
+	std::vector<uint64>().swap(full);
+}
+
+cv::Mat PackedMask::Unpack() const
+{
+	cv::Mat mask(height, width, CV_8U);
+	size_t i = 0;
+	for (int y = 0; y < height; y++)
+	{
+		uchar* p = mask.ptr<uchar>(y);
+		for (int x = 0; x < width; x++, i++)
+			p[x] = (nonzero[i >> 6] >> (i & 63)) & 1 ? 255 : 0;
+	}
+	return mask;
+}
+
+// ------------------------------------------------------------------
+// counting
+
+// the POPCNT version is compiled for POPCNT regardless of the project's target
+// and only called after the CPU has been checked at runtime.
+#if defined(__GNUC__)
+#define POPCNT_FUNCTION __attribute__((target("popcnt")))
+static inline int popcount_hw(uint64 x) { return __builtin_popcountll(x); }
+#define HAVE_POPCOUNT_HW 1
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define POPCNT_FUNCTION
+static inline int popcount_hw(uint64 x) { return (int)__popcnt64(x); }
+#define HAVE_POPCOUNT_HW 1
+#endif
+
+static inline int popcount_sw(uint64 x)
+{
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+// Per word, with g the GT bits, a the 'nonzero' and b the 'full' bits of the mask:
+//   maskGT &  mask : g & a          maskGT &  ~mask : g & ~b
+//   maskGT |  mask : g | a          maskGT |  ~mask : g | ~b
+//   maskGT ^  mask : ~g & a | g & ~b   maskGT ^ ~mask : ~g & ~b | g & a
+// 'tail' clears the bits past the last pixel, which ~b would set.
+#define COUNT_MASK_WORDS(POPCOUNT) \
+	for (size_t i = 0; i < n; i++) \
+	{ \
+		const uint64 g = gt[i], a = nz[i], b = fl[i]; \
+		const uint64 tail = i + 1 < n ? ~(uint64)0 : lastMask; \
+		inter += POPCOUNT(g & a); \
+		uni += POPCOUNT(g | a); \
+		outside += POPCOUNT(~g & a); \
+		interInv += POPCOUNT(g & ~b); \
+		gtCount += POPCOUNT(g); \
+		outsideInv += POPCOUNT(~g & ~b & tail); \
+	}
+
+struct WordCounts
+{
+	int64 inter, uni, outside, interInv, gtCount, outsideInv;
+};
+
+static void count_words_sw(const uint64* gt, const uint64* nz, const uint64* fl, size_t n, uint64 lastMask, WordCounts& c)
+{
+	int64 inter = 0, uni = 0, outside = 0, interInv = 0, gtCount = 0, outsideInv = 0;
+	COUNT_MASK_WORDS(popcount_sw)
+	WordCounts r = { inter, uni, outside, interInv, gtCount, outsideInv };
+	c = r;
+}
+
+#ifdef HAVE_POPCOUNT_HW
+static const bool hasPopcnt = cv::checkHardwareSupport(CV_CPU_POPCNT);
+
+POPCNT_FUNCTION static void count_words_hw(const uint64* gt, const uint64* nz, const uint64* fl, size_t n, uint64 lastMask, WordCounts& c)
+{
+	int64 inter = 0, uni = 0, outside = 0, interInv = 0, gtCount = 0, outsideInv = 0;
+	COUNT_MASK_WORDS(popcount_hw)
+	WordCounts r = { inter, uni, outside, interInv, gtCount, outsideInv };
+	c = r;
+}
+#endif
+
+MaskCounts CompareMasks(const PackedMask& maskGT, const PackedMask& mask)
+{
+	CV_Assert(maskGT.IsBinary() && maskGT.size() == mask.size());
+
+	MaskCounts counts;
+	counts.area = (int64)mask.width * mask.height;
+	if (counts.area == 0)
+		return counts;
+
+	const size_t n = maskGT.nonzero.size();
+	const uint64* fl = mask.IsBinary() ? mask.nonzero.data() : mask.full.data();
+	const int used = (int)(counts.area & 63);
+	const uint64 lastMask = used ? ((uint64)1 << used) - 1 : ~(uint64)0;
+
+	WordCounts c;
+#ifdef HAVE_POPCOUNT_HW
+	if (hasPopcnt)
+		count_words_hw(maskGT.nonzero.data(), mask.nonzero.data(), fl, n, lastMask, c);
+	else
+#endif
+		count_words_sw(maskGT.nonzero.data(), mask.nonzero.data(), fl, n, lastMask, c);
+
+	counts.inter = c.inter;
+	counts.uni = c.uni;
+	counts.diff = c.outside + c.interInv;
+	counts.interInv = c.interInv;
+	counts.uniInv = c.gtCount + c.outsideInv;
+	counts.diffInv = c.outsideInv + c.inter;
+	return counts;
+}
+
+MaskCounts CompareMasks(const cv::Mat& maskGT, const cv::Mat& mask)
+{
+	MaskCounts counts;
+	counts.area = maskGT.size().area();
+	counts.inter = cv::countNonZero(maskGT & mask);
+	counts.uni = cv::countNonZero(maskGT | mask);
+	counts.diff = cv::countNonZero(maskGT ^ mask);
+	counts.interInv = cv::countNonZero(maskGT & ~mask);
+	counts.uniInv = cv::countNonZero(maskGT | ~mask);
+	counts.diffInv = cv::countNonZero(maskGT ^ ~mask);
+	return counts;
+}
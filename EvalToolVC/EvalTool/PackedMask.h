@@ -0,0 +1,55 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Counts of the pixels set in the bitwise combinations of a 0/255 GT mask and a mask
+// (and its inverse), as countNonZero would give them on the 8-bit images.
+struct MaskCounts
+{
+	int64 area;                       // number of pixels
+	int64 inter, uni, diff;           // maskGT & mask, maskGT | mask, maskGT ^ mask
+	int64 interInv, uniInv, diffInv;  // the same with ~mask
+
+	MaskCounts() : area(0), inter(0), uni(0), diff(0), interInv(0), uniInv(0), diffInv(0) {}
+};
+
+// A CV_8U mask packed into bits, row-major and LSB first in 64-bit words.
+// Two bit planes are kept: 'nonzero' is set where the mask is not 0 and 'full' where it is 255.
+// They are the same for 0/255 masks, which take 1 bit per pixel, and together they give the
+// exact results of &, |, ^ and ~ on 8-bit masks whose values are not only 0 and 255.
+class PackedMask
+{
+	std::vector<uint64> nonzero;
+	std::vector<uint64> full;   // empty for 0/255 masks
+	int width, height;
+
+public:
+	PackedMask() : width(0), height(0) {}
+	explicit PackedMask(const cv::Mat& mask) : width(0), height(0) { Pack(mask); }
+
+	// packs a CV_8U mask in a single pass
+	void Pack(const cv::Mat& mask);
+
+	// assigns a 0/255 mask given as bits, row-major and LSB first (as Bits() returns)
+	void Assign(const uchar* bits, int width, int height);
+
+	// 0/255 mask, 255 where the packed mask is not 0
+	cv::Mat Unpack() const;
+
+	bool empty() const { return width == 0 || height == 0; }
+	cv::Size size() const { return cv::Size(width, height); }
+	bool IsBinary() const { return full.empty(); }
+
+	// bits of the 'nonzero' plane, (area + 7) / 8 bytes on little-endian machines
+	const uchar* Bits() const { return (const uchar*)nonzero.data(); }
+	size_t BitsSize() const { return ((size_t)width * height + 7) / 8; }
+
+	// Counts of the combinations of a 0/255 GT mask with 'mask' and with '~mask'
+	// from one pass over both. The masks must have the same size.
+	friend MaskCounts CompareMasks(const PackedMask& maskGT, const PackedMask& mask);
+};
+
+MaskCounts CompareMasks(const PackedMask& maskGT, const PackedMask& mask);
+
+// Same counts from 8-bit masks, for GT masks that are not 0/255.
+MaskCounts CompareMasks(const cv::Mat& maskGT, const cv::Mat& mask);
@@ -0,0 +1,179 @@
+#include "PairData.h"
+#include "FlowIO.h"
+#include "CvUtils.h"
+#include "FlowKernels.h"
+#include "Profiler.h"
+
+#include <stdio.h>
+
+namespace PairData
+{
+	// Parses the image names from the second line of pair.txt (the first line is a header).
+	static void parse_pair_names(const std::vector<uchar>& text, std::string& image1, std::string& image2)
+	{
+		std::string str(text.begin(), text.end());
+		char buff[2][512];
+		int n = 0;
+		if (sscanf(str.c_str(), "%511[^,],%511[^,\n]\n%n", buff[0], buff[1], &n) == 2 &&
+			sscanf(str.c_str() + n, "%511[^,],%511[^,\n]", buff[0], buff[1]) == 2)
+		{
+			image1 = buff[0];
+			image2 = buff[1];
+		}
+	}
+
+	static void parse_flip(const std::vector<uchar>& text, int& flip)
+	{
+		std::string str(text.begin(), text.end());
+		sscanf(str.c_str(), "%d", &flip);
+	}
+
+	void ReadPairFiles(const std::string& dir, const FsUtil::PairFiles& files, PairBytes& bytes, bool mapFlows)
+	{
+		const FsUtil::PairFile targets[] = { FsUtil::FLOW1_FLO, FsUtil::FLOW2_FLO, FsUtil::MASK1_PNG, FsUtil::MASK2_PNG, FsUtil::PAIR_TXT, FsUtil::FLIP_GT_TXT };
+		Profiler::Scope scope("read files");
+
+		// the buffers are cleared rather than freed, so that a reused PairBytes keeps their memory
+		bytes.files = FsUtil::PairFiles();
+		for (std::vector<uchar>& data : bytes.data)
+			data.clear();
+		bytes.flows[0] = bytes.flows[1] = cv::Mat();
+
+		// Flows are used only as a pair, so both are mapped or both are read.
+		if (mapFlows && files.Has(FsUtil::FLOW1_FLO) && files.Has(FsUtil::FLOW2_FLO) && !FsUtil::IsPacked(dir))
+		{
+			if (FlowIO::TryMapFlowFile(bytes.flows[0], FsUtil::JoinPath(dir, "flow1.flo").c_str(), true) &&
+				FlowIO::TryMapFlowFile(bytes.flows[1], FsUtil::JoinPath(dir, "flow2.flo").c_str(), true))
+			{
+				bytes.files.Set(FsUtil::FLOW1_FLO);
+				bytes.files.Set(FsUtil::FLOW2_FLO);
+				Profiler::AddBytes("read", (long long)(bytes.flows[0].total() + bytes.flows[1].total()) * 8);
+			}
+			else
+				bytes.flows[0] = bytes.flows[1] = cv::Mat();
+		}
+
+		for (FsUtil::PairFile f : targets)
+		if (files.Has(f) && !bytes.files.Has(f) && FsUtil::ReadFile(FsUtil::JoinPath(dir, FsUtil::PAIR_FILE_NAMES[f]), bytes.data[f]))
+		{
+			bytes.files.Set(f);
+			Profiler::AddBytes("read", (long long)bytes.data[f].size());
+		}
+	}
+
+	void DecodeData(const PairBytes& bytes, cv::Mat& flow1, cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2, std::string& image1, std::string& image2)
+	{
+		const std::vector<uchar>& m1 = bytes.data[FsUtil::MASK1_PNG];
+		const std::vector<uchar>& m2 = bytes.data[FsUtil::MASK2_PNG];
+		{
+			Profiler::Scope scope("decode png");
+			mask1 = !m1.empty() ? cv::imdecode(cv::Mat(m1), cv::IMREAD_GRAYSCALE) : cv::Mat();
+			mask2 = !m2.empty() ? cv::imdecode(cv::Mat(m2), cv::IMREAD_GRAYSCALE) : cv::Mat();
+		}
+
+		// Flows are used only as a pair.
+		Profiler::Scope scope("decode flow");
+		const std::vector<uchar>& f1 = bytes.data[FsUtil::FLOW1_FLO];
+		const std::vector<uchar>& f2 = bytes.data[FsUtil::FLOW2_FLO];
+		if (!bytes.flows[0].empty())
+		{
+			flow1 = bytes.flows[0];
+			flow2 = bytes.flows[1];
+		}
+		else if (f1.empty() || f2.empty() || !FlowIO::DecodeFlow(flow1, f1.data(), f1.size()) || !FlowIO::DecodeFlow(flow2, f2.data(), f2.size()))
+		{
+			flow1 = cv::Mat();
+			flow2 = cv::Mat();
+		}
+
+		if (bytes.files.Has(FsUtil::PAIR_TXT))
+			parse_pair_names(bytes.data[FsUtil::PAIR_TXT], image1, image2);
+	}
+
+	void DecodeData(const PairBytes& bytes, cv::Mat& flow1, cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2)
+	{
+		std::string image1, image2;
+		DecodeData(bytes, flow1, flow2, mask1, mask2, image1, image2);
+	}
+
+	void LoadData(const std::string& dir, const FsUtil::PairFiles& files, cv::Mat& flow1, cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2, std::string& image1, std::string& image2, int numThreads)
+	{
+		// files in a pack are already mapped
+		if (FsUtil::IsPacked(dir))
+		{
+			PairBytes bytes;
+			ReadPairFiles(dir, files, bytes);
+			DecodeData(bytes, flow1, flow2, mask1, mask2, image1, image2);
+			return;
+		}
+
+		Profiler::Scope scope("load data");
+		mask1 = files.Has(FsUtil::MASK1_PNG) ? cv::imread(FsUtil::JoinPath(dir, "mask1.png"), cv::IMREAD_GRAYSCALE) : cv::Mat();
+		mask2 = files.Has(FsUtil::MASK2_PNG) ? cv::imread(FsUtil::JoinPath(dir, "mask2.png"), cv::IMREAD_GRAYSCALE) : cv::Mat();
+
+		// Flows are used only as a pair; broken files are rejected from their headers.
+		std::string flowFile1 = FsUtil::JoinPath(dir, "flow1.flo");
+		std::string flowFile2 = FsUtil::JoinPath(dir, "flow2.flo");
+		if (files.Has(FsUtil::FLOW1_FLO) && files.Has(FsUtil::FLOW2_FLO) &&
+			FlowIO::ProbeFlowFile(flowFile1.c_str()) && FlowIO::ProbeFlowFile(flowFile2.c_str()))
+		{
+			FlowIO::MapFlowFile(flow1, flowFile1.c_str(), numThreads);
+			FlowIO::MapFlowFile(flow2, flowFile2.c_str(), numThreads);
+			Profiler::AddBytes("read", (long long)(flow1.total() + flow2.total()) * 8);
+		}
+		else
+		{
+			flow1 = cv::Mat();
+			flow2 = cv::Mat();
+		}
+
+		std::vector<uchar> text;
+		if (files.Has(FsUtil::PAIR_TXT) && FsUtil::ReadFile(FsUtil::JoinPath(dir, "pair.txt"), text))
+			parse_pair_names(text, image1, image2);
+	}
+
+	void LoadData(const std::string& dir, const FsUtil::PairFiles& files, cv::Mat& flow1, cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2, int numThreads)
+	{
+		std::string image1, image2;
+		LoadData(dir, files, flow1, flow2, mask1, mask2, image1, image2, numThreads);
+	}
+
+	void DecodeGroundTruth(const PairBytes& bytes, GTCache::PairGT& gt)
+	{
+		cv::Mat mask1, mask2;
+		gt.name1.clear();
+		gt.name2.clear();
+		DecodeData(bytes, gt.flow1, gt.flow2, mask1, mask2, gt.name1, gt.name2);
+		gt.SetMasks(mask1, mask2);
+		if (!gt.flow1.empty() && !gt.flow2.empty())
+		{
+			FlowKernels::ComputeValidFlowMask(gt.flow1, gt.valid1);
+			FlowKernels::ComputeValidFlowMask(gt.flow2, gt.valid2);
+		}
+		else
+		{
+			gt.valid1 = cv::Mat();
+			gt.valid2 = cv::Mat();
+		}
+
+		gt.flip = 0;
+		if (bytes.files.Has(FsUtil::FLIP_GT_TXT))
+			parse_flip(bytes.data[FsUtil::FLIP_GT_TXT], gt.flip);
+	}
+
+	void LoadGroundTruth(const std::string& dir, const FsUtil::PairFiles& files, GTCache::PairGT& gt)
+	{
+		PairBytes bytes;
+		ReadPairFiles(dir, files, bytes);
+		DecodeGroundTruth(bytes, gt);
+	}
+
+	bool LoadGroundTruth(const std::string& dir, GTCache::PairGT& gt)
+	{
+		const FsUtil::PairFiles files = FsUtil::ScanPairFiles(dir);
+		if (!files.Has(FsUtil::FLOW1_FLO) || !files.Has(FsUtil::FLOW2_FLO) || !files.Has(FsUtil::MASK1_PNG) || !files.Has(FsUtil::MASK2_PNG))
+			return false;
+		LoadGroundTruth(dir, files, gt);
+		return !gt.empty();
+	}
+}
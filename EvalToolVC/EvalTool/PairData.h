@@ -0,0 +1,47 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "FsUtils.h"
+#include "GTCache.h"
+
+// Reading and decoding the files of a pair directory of a results tree or of the dataset
+namespace PairData
+{
+	// Contents of the files of a pair directory read into memory
+	struct PairBytes
+	{
+		FsUtil::PairFiles files;
+		std::vector<uchar> data[FsUtil::NUM_PAIR_FILES];
+		cv::Mat flows[2];   // flows mapped by ReadPairFiles, whose data is then left empty
+	};
+
+	// Reads the files used for evaluation (flows, masks, pair.txt and flip_gt.txt) of a pair directory.
+	// With mapFlows, uncompressed flows of an unpacked directory are mapped and their pages read
+	// instead of being copied into data; packed and compressed flows are always read.
+	void ReadPairFiles(const std::string& dir, const FsUtil::PairFiles& files, PairBytes& bytes, bool mapFlows = false);
+
+	// Decodes masks and flows read by ReadPairFiles, and the image names from pair.txt.
+	// Flows are used only as a pair: both are empty unless both are valid. Mapped flows are
+	// passed on without a copy; others are written in place if they already have the right
+	// size, so decoding into the flows of an earlier pair reuses their memory.
+	void DecodeData(const PairBytes& bytes, cv::Mat& flow1, cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2, std::string& image1, std::string& image2);
+	void DecodeData(const PairBytes& bytes, cv::Mat& flow1, cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2);
+
+	// Loads a pair directory, mapping its flow files into memory. Compressed flows are decoded
+	// on numThreads workers.
+	void LoadData(const std::string& dir, const FsUtil::PairFiles& files, cv::Mat& flow1, cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2, std::string& image1, std::string& image2, int numThreads = 1);
+	void LoadData(const std::string& dir, const FsUtil::PairFiles& files, cv::Mat& flow1, cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2, int numThreads = 1);
+
+	// Decodes the ground truth of a dataset pair directory read into memory. gt may hold an
+	// earlier pair decoded by this function, whose buffers are then reused, but not views
+	// into a GTCache file.
+	void DecodeGroundTruth(const PairBytes& bytes, GTCache::PairGT& gt);
+
+	// Loads the ground truth of a dataset pair directory.
+	void LoadGroundTruth(const std::string& dir, const FsUtil::PairFiles& files, GTCache::PairGT& gt);
+
+	// Same, returning false if the directory lacks a GT flow or mask.
+	bool LoadGroundTruth(const std::string& dir, GTCache::PairGT& gt);
+}
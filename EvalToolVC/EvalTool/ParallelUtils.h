@@ -0,0 +1,346 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <deque>
+#include <chrono>
+
+namespace ParallelUtils
+{
+	// Number of workers to use for a requested count (<= 0 means one per core).
+	inline int ResolveThreadCount(int requested)
+	{
+		if (requested > 0)
+			return requested;
+		int n = (int)std::thread::hardware_concurrency();
+		return n > 0 ? n : 1;
+	}
+
+	// Runs task(i) for i in [0, n) on up to numThreads workers and calls consume(i)
+	// on the calling thread in index order, as soon as task i has finished.
+	// Workers never run more than 'window' indices ahead of the consumer, so the
+	// number of unconsumed results held in memory stays bounded.
+	// The first exception thrown by a task is rethrown on the calling thread.
+	template <typename Task, typename Consume>
+	void OrderedParallelFor(int n, int numThreads, Task task, Consume consume, int window = 0)
+	{
+		numThreads = std::min(ResolveThreadCount(numThreads), n);
+		if (numThreads <= 1)
+		{
+			for (int i = 0; i < n; i++) {
+				task(i);
+				consume(i);
+			}
+			return;
+		}
+		if (window <= 0)
+			window = 4 * numThreads;
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::vector<char> done(n, 0);
+		std::exception_ptr error;
+		int next = 0;
+		int consumed = 0;
+		bool abort = false;
+
+		auto worker = [&]()
+		{
+			for (;;)
+			{
+				int i;
+				{
+					std::unique_lock<std::mutex> lock(mtx);
+					cv.wait(lock, [&]{ return abort || next >= n || next < consumed + window; });
+					if (abort || next >= n)
+						return;
+					i = next++;
+				}
+				try {
+					task(i);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(mtx);
+					if (!error)
+						error = std::current_exception();
+					abort = true;
+				}
+				{
+					std::lock_guard<std::mutex> lock(mtx);
+					done[i] = 1;
+				}
+				cv.notify_all();
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (int t = 0; t < numThreads; t++)
+			workers.push_back(std::thread(worker));
+
+		for (int i = 0; i < n; i++)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				cv.wait(lock, [&]{ return abort || done[i] != 0; });
+				if (abort)
+					break;
+			}
+			try {
+				consume(i);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(mtx);
+				if (!error)
+					error = std::current_exception();
+				abort = true;
+			}
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				consumed = i + 1;
+			}
+			cv.notify_all();
+			if (abort)
+				break;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			abort = true;
+		}
+		cv.notify_all();
+		for (auto& w : workers)
+			w.join();
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	// Runs task(i) for i in [0, n) on up to numThreads workers in any order.
+	template <typename Task>
+	void ParallelFor(int n, int numThreads, Task task)
+	{
+		OrderedParallelFor(n, numThreads, task, [](int){});
+	}
+
+	// Occupancy of a BoundedQueue over its lifetime
+	struct QueueStats
+	{
+		int capacity;
+		long long items;        // number of items passed through
+		double meanOccupancy;   // time-averaged number of queued items
+		double fullRatio;       // fraction of time the queue was full (consumers are the bottleneck)
+		double emptyRatio;      // fraction of time the queue was empty (producers are the bottleneck)
+	};
+
+	// Blocking FIFO queue holding at most 'capacity' items between two pipeline stages.
+	template <typename T>
+	class BoundedQueue
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		std::deque<T> items;
+		size_t capacity;
+		bool closed;
+		long long pushed;
+		mutable std::mutex mtx;
+		std::condition_variable notFull, notEmpty;
+
+		// occupancy integrated over time
+		Clock::time_point start, last;
+		double area, fullTime, emptyTime;
+
+		void account()
+		{
+			Clock::time_point now = Clock::now();
+			double dt = std::chrono::duration<double>(now - last).count();
+			area += items.size() * dt;
+			if (items.size() >= capacity) fullTime += dt;
+			if (items.empty()) emptyTime += dt;
+			last = now;
+		}
+
+		BoundedQueue(const BoundedQueue&);
+		BoundedQueue& operator=(const BoundedQueue&);
+
+	public:
+		explicit BoundedQueue(int capacity)
+			: capacity(std::max(capacity, 1)), closed(false), pushed(0), area(0), fullTime(0), emptyTime(0)
+		{
+			start = last = Clock::now();
+		}
+
+		// Blocks while the queue is full. Returns false if the queue has been closed.
+		bool Push(T item)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			notFull.wait(lock, [&]{ return closed || items.size() < capacity; });
+			if (closed)
+				return false;
+			account();
+			items.push_back(std::move(item));
+			pushed++;
+			notEmpty.notify_one();
+			return true;
+		}
+
+		// Blocks while the queue is empty. Returns false once it is closed and drained.
+		bool Pop(T& item)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			notEmpty.wait(lock, [&]{ return closed || !items.empty(); });
+			if (items.empty())
+				return false;
+			account();
+			item = std::move(items.front());
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		// No more items will be pushed; consumers drain what is left.
+		void Close()
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			account();
+			closed = true;
+			notFull.notify_all();
+			notEmpty.notify_all();
+		}
+
+		// Drops the queued items and wakes up every waiting thread.
+		void Abort()
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			account();
+			closed = true;
+			items.clear();
+			notFull.notify_all();
+			notEmpty.notify_all();
+		}
+
+		QueueStats Stats() const
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			double total = std::chrono::duration<double>(last - start).count();
+			QueueStats stats;
+			stats.capacity = (int)capacity;
+			stats.items = pushed;
+			stats.meanOccupancy = total > 0 ? area / total : 0;
+			stats.fullRatio = total > 0 ? fullTime / total : 0;
+			stats.emptyRatio = total > 0 ? emptyTime / total : 0;
+			return stats;
+		}
+	};
+
+	// Results produced out of order by worker threads and taken in index order.
+	template <typename T>
+	class OrderedResults
+	{
+		std::vector<T> results;
+		std::vector<char> done;
+		bool aborted;
+		std::mutex mtx;
+		std::condition_variable cv;
+
+	public:
+		explicit OrderedResults(int n) : results(n), done(n, 0), aborted(false) {}
+
+		void Put(int i, T value)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				results[i] = std::move(value);
+				done[i] = 1;
+			}
+			cv.notify_all();
+		}
+
+		// Blocks until result i is available. Returns false if aborted.
+		bool Take(int i, T& value)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&]{ return aborted || done[i] != 0; });
+			if (aborted)
+				return false;
+			value = std::move(results[i]);
+			results[i] = T();
+			return true;
+		}
+
+		void Abort()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				aborted = true;
+			}
+			cv.notify_all();
+		}
+	};
+
+	// A group of threads running the same function, e.g., one pipeline stage.
+	class ThreadGroup
+	{
+		std::vector<std::thread> threads;
+		std::mutex mtx;
+		std::exception_ptr error;
+		int running;
+
+		ThreadGroup(const ThreadGroup&);
+		ThreadGroup& operator=(const ThreadGroup&);
+
+	public:
+		ThreadGroup() : running(0) {}
+		~ThreadGroup()
+		{
+			for (auto& t : threads)
+			if (t.joinable())
+				t.join();
+		}
+
+		// Starts n threads running func(). onError() is called for every exception thrown
+		// by func, and onExit() once, by the last thread that finishes.
+		template <typename Func, typename Exit, typename Error>
+		void Start(int n, Func func, Exit onExit, Error onError)
+		{
+			running = n;
+			for (int t = 0; t < n; t++)
+			{
+				threads.push_back(std::thread([=]()
+				{
+					try {
+						func();
+					}
+					catch (...) {
+						{
+							std::lock_guard<std::mutex> lock(mtx);
+							if (!error)
+								error = std::current_exception();
+						}
+						onError();
+					}
+					bool last;
+					{
+						std::lock_guard<std::mutex> lock(mtx);
+						last = --running == 0;
+					}
+					if (last)
+						onExit();
+				}));
+			}
+		}
+
+		// Waits for all threads and rethrows the first exception thrown by any of them.
+		void Join()
+		{
+			for (auto& t : threads)
+			if (t.joinable())
+				t.join();
+			if (error)
+				std::rethrow_exception(error);
+		}
+	};
+}
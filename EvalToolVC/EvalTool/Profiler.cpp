@@ -0,0 +1,220 @@
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+namespace Profiler
+{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Event
+	{
+		const char* name;
+		std::string arg;
+		int tid;
+		long long start, duration;   // microseconds since Enable()
+	};
+
+	static bool enabled = false;
+	static Clock::time_point origin;
+	static std::mutex mtx;
+	static std::vector<Event> events;
+	static std::map<std::thread::id, int> threadIds;
+	static std::vector<std::string> threadNames;
+	static std::map<std::string, long long> counters;
+
+	static long long now()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - origin).count();
+	}
+
+	// small id of the calling thread; the mutex has to be held
+	static int thread_index()
+	{
+		auto it = threadIds.find(std::this_thread::get_id());
+		if (it != threadIds.end())
+			return it->second;
+		int id = (int)threadNames.size();
+		threadIds[std::this_thread::get_id()] = id;
+		threadNames.push_back(id == 0 ? "main" : "thread");
+		return id;
+	}
+
+	void Enable(bool e)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		enabled = e;
+		origin = Clock::now();
+		events.clear();
+		counters.clear();
+		thread_index();
+	}
+
+	bool Enabled()
+	{
+		return enabled;
+	}
+
+	void SetThreadName(const std::string& name)
+	{
+		if (!enabled)
+			return;
+		std::lock_guard<std::mutex> lock(mtx);
+		threadNames[thread_index()] = name;
+	}
+
+	Scope::Scope(const char* name, const std::string& a) : name(name), start(-1)
+	{
+		if (!enabled)
+			return;
+		arg = a;
+		start = now();
+	}
+
+	Scope::~Scope()
+	{
+		if (start < 0)
+			return;
+		Event e;
+		e.name = name;
+		e.arg.swap(arg);
+		e.start = start;
+		e.duration = now() - start;
+		std::lock_guard<std::mutex> lock(mtx);
+		e.tid = thread_index();
+		events.push_back(e);
+	}
+
+	void AddBytes(const char* name, long long bytes)
+	{
+		if (!enabled)
+			return;
+		std::lock_guard<std::mutex> lock(mtx);
+		counters[name] += bytes;
+	}
+
+	long long PeakResidentBytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS pmc;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+			return -1;
+		return (long long)pmc.PeakWorkingSetSize;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return -1;
+#ifdef __APPLE__
+		return (long long)usage.ru_maxrss;
+#else
+		return (long long)usage.ru_maxrss * 1024;
+#endif
+#endif
+	}
+
+	void PrintSummary()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+
+		// stages in order of first appearance
+		struct Stage
+		{
+			long long count, total, max;
+			std::string maxArg;
+		};
+		std::vector<const char*> order;
+		std::map<std::string, Stage> stages;
+		for (const Event& e : events)
+		{
+			auto it = stages.find(e.name);
+			if (it == stages.end())
+			{
+				order.push_back(e.name);
+				Stage s = { 0, 0, -1, "" };
+				it = stages.insert(std::make_pair(std::string(e.name), s)).first;
+			}
+			Stage& s = it->second;
+			s.count++;
+			s.total += e.duration;
+			if (e.duration > s.max) {
+				s.max = e.duration;
+				s.maxArg = e.arg;
+			}
+		}
+
+		const double wall = now() / 1000.0;
+		printf("------------- Profile ----------------------------\n");
+		printf("%-16s %8s %10s %8s %8s  %s\n", "Stage", "Count", "Total ms", "Mean ms", "Max ms", "Slowest");
+		for (const char* name : order)
+		{
+			const Stage& s = stages[name];
+			printf("%-16s %8lld %10.1lf %8.2lf %8.2lf  %s\n", name, s.count, s.total / 1000.0, s.total / 1000.0 / s.count, s.max / 1000.0, s.maxArg.c_str());
+		}
+		printf("Wall time        : %.1lf ms on %d threads\n", wall, (int)threadNames.size());
+		for (auto& c : counters)
+			printf("Bytes %-10s : %.1lf MB (%.1lf MB/s)\n", c.first.c_str(), c.second / 1048576.0, wall > 0 ? c.second / 1048576.0 / (wall / 1000.0) : 0.0);
+		long long peak = PeakResidentBytes();
+		if (peak >= 0)
+			printf("Peak resident    : %.1lf MB\n", peak / 1048576.0);
+	}
+
+	static void write_json_string(FILE* fp, const std::string& s)
+	{
+		fputc('"', fp);
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\')
+				fprintf(fp, "\\%c", c);
+			else if ((unsigned char)c < 0x20)
+				fprintf(fp, "\\u%04x", c);
+			else
+				fputc(c, fp);
+		}
+		fputc('"', fp);
+	}
+
+	bool WriteTrace(const std::string& file)
+	{
+		FILE* fp = fopen(file.c_str(), "w");
+		if (fp == NULL)
+			return false;
+
+		std::lock_guard<std::mutex> lock(mtx);
+		fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		const char* sep = "\n";
+		for (int t = 0; t < (int)threadNames.size(); t++, sep = ",\n")
+		{
+			fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", sep, t);
+			write_json_string(fp, threadNames[t]);
+			fprintf(fp, "}}");
+		}
+		for (const Event& e : events)
+		{
+			fprintf(fp, ",\n{\"name\":");
+			write_json_string(fp, e.name);
+			fprintf(fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld", e.tid, e.start, e.duration);
+			if (!e.arg.empty())
+			{
+				fprintf(fp, ",\"args\":{\"item\":");
+				write_json_string(fp, e.arg);
+				fprintf(fp, "}");
+			}
+			fprintf(fp, "}");
+		}
+		fprintf(fp, "\n]}\n");
+		return fclose(fp) == 0;
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+
+// Instrumentation enabled with -profile: scoped stage timers, byte counters and
+// peak memory, reported as a per-stage summary table and as a Chrome trace
+// (chrome://tracing or Perfetto) with one track per thread.
+// Disabled timers cost a single flag test.
+namespace Profiler
+{
+	void Enable(bool enabled);
+	bool Enabled();
+
+	// Names the track of the calling thread in the trace, e.g. "decode".
+	void SetThreadName(const std::string& name);
+
+	// Times the enclosing scope as one event of a stage. name has to outlive the
+	// profiler (a string literal). arg, e.g. the pair name, is shown in the trace
+	// and names the slowest event of the stage in the summary.
+	class Scope
+	{
+		const char* name;
+		std::string arg;
+		long long start;
+
+		Scope(const Scope&);
+		Scope& operator=(const Scope&);
+
+	public:
+		explicit Scope(const char* name, const std::string& arg = std::string());
+		~Scope();
+	};
+
+	// Adds to a named byte counter, e.g. "read" or "written". name has to be a literal.
+	void AddBytes(const char* name, long long bytes);
+
+	// Peak resident memory of the process in bytes, or -1 if unknown.
+	long long PeakResidentBytes();
+
+	void PrintSummary();
+	bool WriteTrace(const std::string& file);
+}
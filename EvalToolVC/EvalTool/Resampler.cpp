@@ -0,0 +1,417 @@
+#include "Resampler.h"
+#include "FlowKernels.h"
+#include "ParallelUtils.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <mutex>
+#include <string.h>
+
+namespace Resampler
+{
+	static const int BAND_ROWS = 16;
+	static const int COEF_BITS = 11, COEF_SCALE = 1 << COEF_BITS;   // INTER_RESIZE_COEF_BITS of cv::resize
+	static const float UNKNOWN = 1e10f;
+
+	// Source index and weights along one axis, computed as cv::resize does for INTER_LINEAR.
+	struct LinearAxis
+	{
+		std::vector<int> ofs;       // first source index
+		std::vector<float> alpha;   // weights of ofs and ofs + 1
+		std::vector<int> ialpha;    // the same in fixed point, for 8-bit images
+		int twoTap;                 // indices from twoTap on lie at the last source index and read only it
+	};
+
+	static LinearAxis linear_axis(int srcLen, int dstLen)
+	{
+		const double scale = 1. / ((double)dstLen / srcLen);
+		LinearAxis a;
+		a.ofs.resize(dstLen);
+		a.alpha.resize(2 * dstLen);
+		a.ialpha.resize(2 * dstLen);
+		a.twoTap = dstLen;
+		for (int d = 0; d < dstLen; d++)
+		{
+			float f = (float)((d + 0.5) * scale - 0.5);
+			int s = (int)std::floor(f);
+			f -= s;
+			if (s < 0)
+				f = 0, s = 0;
+			if (s + 1 >= srcLen)
+			{
+				a.twoTap = std::min(a.twoTap, d);
+				if (s >= srcLen - 1)
+					f = 0, s = srcLen - 1;
+			}
+			a.ofs[d] = s;
+			a.alpha[2 * d] = 1.f - f;
+			a.alpha[2 * d + 1] = f;
+			a.ialpha[2 * d] = cv::saturate_cast<short>(a.alpha[2 * d] * COEF_SCALE);
+			a.ialpha[2 * d + 1] = cv::saturate_cast<short>(a.alpha[2 * d + 1] * COEF_SCALE);
+		}
+		return a;
+	}
+
+	// cv::resize turns an exact 2x downscale with INTER_LINEAR into a 2x2 box filter
+	static bool is_half_size(cv::Size src, cv::Size dst)
+	{
+		const double sx = 1. / ((double)dst.width / src.width), sy = 1. / ((double)dst.height / src.height);
+		const int ix = cv::saturate_cast<int>(sx), iy = cv::saturate_cast<int>(sy);
+		return ix == 2 && iy == 2 && std::abs(sx - ix) < DBL_EPSILON && std::abs(sy - iy) < DBL_EPSILON;
+	}
+
+	// Two-slot cache of horizontally resized source rows, so that a source row shared
+	// by consecutive output rows is resized once. compute(sy, slot) fills a slot.
+	class RowCache
+	{
+		int rows[2];
+
+	public:
+		RowCache() { rows[0] = rows[1] = -1; }
+
+		template <typename Compute>
+		int Get(int sy, int keep, Compute compute)
+		{
+			for (int k = 0; k < 2; k++)
+			if (rows[k] == sy)
+				return k;
+			int k = rows[0] == keep ? 1 : 0;
+			compute(sy, k);
+			rows[k] = sy;
+			return k;
+		}
+	};
+
+	// dst itself if its buffer can receive the result, otherwise a new image
+	static cv::Mat output(const cv::Mat& src, const cv::Mat& dst, cv::Size size, int type)
+	{
+		const bool overlaps = dst.data != NULL && dst.datastart < src.dataend && src.datastart < dst.dataend;
+		cv::Mat out = overlaps ? cv::Mat() : dst;
+		out.create(size, type);
+		return out;
+	}
+
+	// ------------------------------------------------------------------
+	// flows
+
+	// ((u + x * s1) * s2) - x with the roundings of the former Mat expressions:
+	// the products by a Scalar are done in double, the sums in float
+	static inline float rescale(float u, float oldGrid, float newGrid, double s2)
+	{
+		return (float)((double)(u + oldGrid) * s2) - newGrid;
+	}
+
+	static void resize_flow(const cv::Mat& flow, cv::Mat& dst, cv::Size oldSize2, cv::Size newSize, cv::Size newSize2, int numThreads)
+	{
+		CV_Assert(flow.type() == CV_32FC2 && !flow.empty());
+		const cv::Size oldSize = flow.size();
+		const double sx1 = (double)oldSize.width / newSize.width, sy1 = (double)oldSize.height / newSize.height;
+		const double sx2 = (double)newSize2.width / oldSize2.width, sy2 = (double)newSize2.height / oldSize2.height;
+		const bool same = oldSize == newSize;
+		const bool half = !same && is_half_size(oldSize, newSize);
+		const LinearAxis ax = linear_axis(oldSize.width, newSize.width);
+		const LinearAxis ay = linear_axis(oldSize.height, newSize.height);
+
+		std::vector<float> oldGridX(newSize.width);
+		for (int x = 0; x < newSize.width; x++)
+			oldGridX[x] = (float)((double)(float)x * sx1);
+
+		cv::Mat out = output(flow, dst, newSize, CV_32FC2);
+		const int numBands = (newSize.height + BAND_ROWS - 1) / BAND_ROWS;
+		ParallelUtils::ParallelFor(numBands, numThreads, [&](int band)
+		{
+			const int W = newSize.width;
+			std::vector<uchar> valid0(oldSize.width), valid1(oldSize.width);
+			std::vector<float> h[2], hv[2];
+			for (int k = 0; k < 2; k++) {
+				h[k].resize(2 * W);
+				hv[k].resize(W);
+			}
+
+			// horizontal pass of a source row into a cache slot: the flow and its 0/1 validity
+			RowCache cache;
+			auto hresize = [&](int sy, int k)
+			{
+				const float* s = flow.ptr<float>(sy);
+				FlowKernels::ValidFlowRow(s, oldSize.width, &valid0[0]);
+				float* d = &h[k][0];
+				float* dv = &hv[k][0];
+				for (int x = 0; x < W; x++)
+				{
+					const int sx = ax.ofs[x];
+					const float v0 = valid0[sx] ? 1.f : 0.f;
+					if (x < ax.twoTap)
+					{
+						const float a0 = ax.alpha[2 * x], a1 = ax.alpha[2 * x + 1];
+						const float v1 = valid0[sx + 1] ? 1.f : 0.f;
+						d[2 * x] = s[2 * sx] * a0 + s[2 * sx + 2] * a1;
+						d[2 * x + 1] = s[2 * sx + 1] * a0 + s[2 * sx + 3] * a1;
+						dv[x] = v0 * a0 + v1 * a1;
+					}
+					else
+					{
+						d[2 * x] = s[2 * sx];
+						d[2 * x + 1] = s[2 * sx + 1];
+						dv[x] = v0;
+					}
+				}
+			};
+
+			const int y1 = std::min(newSize.height, (band + 1) * BAND_ROWS);
+			for (int y = band * BAND_ROWS; y < y1; y++)
+			{
+				float* o = out.ptr<float>(y);
+				const float newGridY = (float)y;
+				const float oldGridY = (float)((double)newGridY * sy1);
+
+				// writes one output pixel from the resized flow and validity
+				auto put = [&](int x, float u, float v, float valid)
+				{
+					// setTo(Scalar(1e10)) of the former code: u unknown, v 0
+					if (valid != 1.0f) {
+						o[2 * x] = UNKNOWN;
+						o[2 * x + 1] = 0;
+						return;
+					}
+					o[2 * x] = rescale(u, oldGridX[x], (float)x, sx2);
+					o[2 * x + 1] = rescale(v, oldGridY, newGridY, sy2);
+				};
+
+				if (same)
+				{
+					const float* s = flow.ptr<float>(y);
+					FlowKernels::ValidFlowRow(s, W, &valid0[0]);
+					for (int x = 0; x < W; x++)
+						put(x, s[2 * x], s[2 * x + 1], valid0[x] ? 1.f : 0.f);
+				}
+				else if (half)
+				{
+					// box filter summed in the order of cv::resize's area path
+					const float* s0 = flow.ptr<float>(2 * y);
+					const float* s1 = flow.ptr<float>(2 * y + 1);
+					FlowKernels::ValidFlowRow(s0, oldSize.width, &valid0[0]);
+					FlowKernels::ValidFlowRow(s1, oldSize.width, &valid1[0]);
+					for (int x = 0; x < W; x++)
+					{
+						float r[3];
+						for (int c = 0; c < 2; c++) {
+							const int i = 4 * x + c;
+							float sum = 0;
+							sum += s0[i] + s0[i + 2] + s1[i] + s1[i + 2];
+							r[c] = sum * 0.25f;
+						}
+						float sum = 0;
+						sum += (valid0[2 * x] ? 1.f : 0.f) + (valid0[2 * x + 1] ? 1.f : 0.f) + (valid1[2 * x] ? 1.f : 0.f) + (valid1[2 * x + 1] ? 1.f : 0.f);
+						r[2] = sum * 0.25f;
+						put(x, r[0], r[1], r[2]);
+					}
+				}
+				else
+				{
+					const int sy0 = ay.ofs[y], sy1 = std::min(sy0 + 1, oldSize.height - 1);
+					const float b0 = ay.alpha[2 * y], b1 = ay.alpha[2 * y + 1];
+					const int k0 = cache.Get(sy0, sy1, hresize);
+					const int k1 = cache.Get(sy1, sy0, hresize);
+					const float *d0 = &h[k0][0], *d1 = &h[k1][0], *dv0 = &hv[k0][0], *dv1 = &hv[k1][0];
+					for (int x = 0; x < W; x++)
+						put(x, d0[2 * x] * b0 + d1[2 * x] * b1, d0[2 * x + 1] * b0 + d1[2 * x + 1] * b1, dv0[x] * b0 + dv1[x] * b1);
+				}
+			}
+		});
+		dst = out;
+	}
+
+	// ------------------------------------------------------------------
+	// masks
+
+	static inline int saturate_short(int v)
+	{
+		return std::min(std::max(v, -32768), 32767);
+	}
+
+	// Vertical pass of cv::resize for 8-bit images. Its SSE2 version, used for a prefix
+	// of each row, drops the low 4 bits first and rounds differently from the scalar one.
+	static inline int vresize_scalar(int s0, int s1, int b0, int b1)
+	{
+		return (b0 * s0 + b1 * s1 + (1 << (2 * COEF_BITS - 1))) >> (2 * COEF_BITS);
+	}
+
+	static inline int vresize_sse2(int s0, int s1, int b0, int b1)
+	{
+		int t = saturate_short(((saturate_short(s0 >> 4) * b0) >> 16) + ((saturate_short(s1 >> 4) * b1) >> 16));
+		return saturate_short(t + 2) >> 2;
+	}
+
+	static int sse2_prefix(int width)
+	{
+		int x = 0;
+		while (x <= width - 16)
+			x += 16;
+		while (x < width - 4)
+			x += 4;
+		return x;
+	}
+
+	static void resize_mask(const cv::Mat& mask, cv::Mat& dst, cv::Size newSize, int thresh, int numThreads)
+	{
+		CV_Assert(mask.type() == CV_8U && !mask.empty());
+		const cv::Size oldSize = mask.size();
+		const bool same = oldSize == newSize;
+		const bool half = !same && is_half_size(oldSize, newSize);
+		const LinearAxis ax = linear_axis(oldSize.width, newSize.width);
+		const LinearAxis ay = linear_axis(oldSize.height, newSize.height);
+		const int prefix = cv::checkHardwareSupport(CV_CPU_SSE2) ? sse2_prefix(newSize.width) : 0;
+
+		cv::Mat out = output(mask, dst, newSize, CV_8U);
+		const int numBands = (newSize.height + BAND_ROWS - 1) / BAND_ROWS;
+		ParallelUtils::ParallelFor(numBands, numThreads, [&](int band)
+		{
+			const int W = newSize.width;
+			std::vector<int> h[2];
+			h[0].resize(W);
+			h[1].resize(W);
+
+			RowCache cache;
+			auto hresize = [&](int sy, int k)
+			{
+				const uchar* s = mask.ptr<uchar>(sy);
+				int* d = &h[k][0];
+				for (int x = 0; x < W; x++)
+				{
+					const int sx = ax.ofs[x];
+					d[x] = x < ax.twoTap ? s[sx] * ax.ialpha[2 * x] + s[sx + 1] * ax.ialpha[2 * x + 1] : s[sx] * COEF_SCALE;
+				}
+			};
+
+			const int y1 = std::min(newSize.height, (band + 1) * BAND_ROWS);
+			for (int y = band * BAND_ROWS; y < y1; y++)
+			{
+				uchar* o = out.ptr<uchar>(y);
+				if (same)
+				{
+					const uchar* s = mask.ptr<uchar>(y);
+					for (int x = 0; x < W; x++)
+						o[x] = s[x] > thresh ? 255 : 0;
+				}
+				else if (half)
+				{
+					const uchar* s0 = mask.ptr<uchar>(2 * y);
+					const uchar* s1 = mask.ptr<uchar>(2 * y + 1);
+					for (int x = 0; x < W; x++)
+						o[x] = ((s0[2 * x] + s0[2 * x + 1] + s1[2 * x] + s1[2 * x + 1] + 2) >> 2) > thresh ? 255 : 0;
+				}
+				else
+				{
+					const int sy0 = ay.ofs[y], sy1 = std::min(sy0 + 1, oldSize.height - 1);
+					const int b0 = cv::saturate_cast<short>(ay.alpha[2 * y] * COEF_SCALE);
+					const int b1 = cv::saturate_cast<short>(ay.alpha[2 * y + 1] * COEF_SCALE);
+					const int* d0 = &h[cache.Get(sy0, sy1, hresize)][0];
+					const int* d1 = &h[cache.Get(sy1, sy0, hresize)][0];
+					int x = 0;
+					for (; x < prefix; x++)
+						o[x] = cv::saturate_cast<uchar>(vresize_sse2(d0[x], d1[x], b0, b1)) > thresh ? 255 : 0;
+					for (; x < W; x++)
+						o[x] = cv::saturate_cast<uchar>(vresize_scalar(d0[x], d1[x], b0, b1)) > thresh ? 255 : 0;
+				}
+			}
+		});
+		dst = out;
+	}
+
+	// ------------------------------------------------------------------
+	// OpenCV reference
+
+	// The operations that resize_flow and resize_mask reproduce, used when they do not
+	// match the cv::resize of the OpenCV build.
+	static void resize_flow_opencv(const cv::Mat& flow, cv::Mat& dst, cv::Size oldSize2, cv::Size newSize, cv::Size newSize2)
+	{
+		const cv::Size oldSize = flow.size();
+		cv::Mat valid, resized;
+		FlowKernels::ComputeValidFlowMask(flow, valid);
+		valid.convertTo(valid, CV_32F, 1.0 / 255);
+		cv::resize(valid, valid, newSize, 0, 0, cv::INTER_LINEAR);
+		cv::resize(flow, resized, newSize, 0, 0, cv::INTER_LINEAR);
+
+		cv::Mat newGrid(newSize, CV_32FC2);
+		for (int y = 0; y < newSize.height; y++)
+		for (int x = 0; x < newSize.width; x++)
+			newGrid.at<cv::Vec2f>(y, x) = cv::Vec2f((float)x, (float)y);
+		cv::Mat oldGrid = newGrid.mul(cv::Scalar((double)oldSize.width / newSize.width, (double)oldSize.height / newSize.height));
+		resized = resized + oldGrid;
+		resized = resized.mul(cv::Scalar((double)newSize2.width / oldSize2.width, (double)newSize2.height / oldSize2.height)) - newGrid;
+		resized.setTo(cv::Scalar(1e10), valid != 1.0);
+		resized.copyTo(dst);
+	}
+
+	static void resize_mask_opencv(const cv::Mat& mask, cv::Mat& dst, cv::Size newSize, int thresh)
+	{
+		cv::Mat resized;
+		cv::resize(mask, resized, newSize, 0, 0, cv::INTER_LINEAR);
+		dst = resized > thresh;
+	}
+
+	static bool same_bits(const cv::Mat& a, const cv::Mat& b)
+	{
+		if (a.size() != b.size() || a.type() != b.type())
+			return false;
+		const size_t rowBytes = a.cols * a.elemSize();
+		for (int y = 0; y < a.rows; y++)
+		if (memcmp(a.ptr(y), b.ptr(y), rowBytes) != 0)
+			return false;
+		return true;
+	}
+
+	// Compares both paths on small images with unknown flows, at a 2x downscale (the area
+	// shortcut of cv::resize), other downscales and upscales.
+	static bool check_against_opencv()
+	{
+		const cv::Size src(64, 36);
+		const cv::Size sizes[] = { cv::Size(32, 18), cv::Size(40, 27), cv::Size(101, 53), cv::Size(64, 36) };
+		cv::RNG rng(0);
+		cv::Mat flow(src, CV_32FC2), mask(src, CV_8U);
+		rng.fill(flow, cv::RNG::UNIFORM, -20, 20);
+		rng.fill(mask, cv::RNG::UNIFORM, 0, 256);
+		for (int i = 0; i < 40; i++)
+			flow.at<cv::Vec2f>(rng.uniform(0, src.height), rng.uniform(0, src.width)) = cv::Vec2f(UNKNOWN, UNKNOWN);
+
+		for (const cv::Size& size : sizes)
+		{
+			cv::Mat out, ref;
+			resize_flow(flow, out, src, size, size, 1);
+			resize_flow_opencv(flow, ref, src, size, size);
+			if (!same_bits(out, ref))
+				return false;
+			resize_mask(mask, out, size, 128, 1);
+			resize_mask_opencv(mask, ref, size, 128);
+			if (!same_bits(out, ref))
+				return false;
+		}
+		return true;
+	}
+
+	static std::once_flag checkOnce;
+	static bool matchesOpenCV = false;
+
+	bool MatchesOpenCV()
+	{
+		std::call_once(checkOnce, []{ matchesOpenCV = check_against_opencv(); });
+		return matchesOpenCV;
+	}
+
+	void ResizeFlow(const cv::Mat& flow, cv::Mat& dst, cv::Size oldSize2, cv::Size newSize, cv::Size newSize2, int numThreads)
+	{
+		if (MatchesOpenCV())
+			resize_flow(flow, dst, oldSize2, newSize, newSize2, numThreads);
+		else
+			resize_flow_opencv(flow, dst, oldSize2, newSize, newSize2);
+	}
+
+	void ResizeMask(const cv::Mat& mask, cv::Mat& dst, cv::Size newSize, int thresh, int numThreads)
+	{
+		if (MatchesOpenCV())
+			resize_mask(mask, dst, newSize, thresh, numThreads);
+		else
+			resize_mask_opencv(mask, dst, newSize, thresh);
+	}
+}
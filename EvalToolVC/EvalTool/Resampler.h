@@ -0,0 +1,29 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+// Single-pass resampling of flows and masks to another resolution.
+// Both reproduce cv::resize with INTER_LINEAR of OpenCV 3.1 without IPP bit for bit
+// (including its 2x2 area shortcut and the fixed-point rounding of its SSE2 vertical
+// pass for 8-bit images) and fuse the steps that used to follow it, so no intermediate
+// images are allocated. Rows are processed in bands on up to numThreads threads.
+// This depends on private details of cv::resize, so the first resize checks it against
+// the OpenCV build on small images. If they differ, cv::resize and the former Mat
+// operations are used instead, so scores never depend on the OpenCV version.
+namespace Resampler
+{
+	// Whether the single-pass resampling matches cv::resize of this OpenCV build; checked once.
+	bool MatchesOpenCV();
+
+	// Resizes a flow from its size to newSize and rescales its vectors from a target
+	// frame of oldSize2 to newSize2, as the former CvUtils::ResizeFlow:
+	// ((resize(flow) + x * sx1) * sx2) - x with the same roundings, and unknown
+	// (u = 1e10, v = 0, as setTo(Scalar(1e10)) wrote it) where any source pixel
+	// contributing to the result is unknown.
+	// dst may be the same Mat as flow. Otherwise it is written in place when it already
+	// has the size and type of the result, as with cv::resize.
+	void ResizeFlow(const cv::Mat& flow, cv::Mat& dst, cv::Size oldSize2, cv::Size newSize, cv::Size newSize2, int numThreads = 1);
+
+	// Resizes a CV_8U mask and thresholds it, as (resize(mask) > thresh).
+	// dst may be the same Mat as mask, and is otherwise reused as by ResizeFlow.
+	void ResizeMask(const cv::Mat& mask, cv::Mat& dst, cv::Size newSize, int thresh = 128, int numThreads = 1);
+}
@@ -0,0 +1,269 @@
+#include "ScoreCache.h"
+#include "FsUtils.h"
+#include "ByteBuffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace ScoreCache;
+
+static const char CACHE_MAGIC[8] = { 'T', 'S', 'S', 'S', 'C', 'C', '0', '1' };
+static const char HIST_MAGIC[8] = { 'T', 'S', 'S', 'E', 'P', 'E', 'H', '1' };
+
+static const FsUtil::PairFile RESULT_FILES[4] = { FsUtil::FLOW1_FLO, FsUtil::FLOW2_FLO, FsUtil::MASK1_PNG, FsUtil::MASK2_PNG };
+static const FsUtil::PairFile DATASET_FILES[6] = { FsUtil::FLOW1_FLO, FsUtil::FLOW2_FLO, FsUtil::MASK1_PNG, FsUtil::MASK2_PNG, FsUtil::PAIR_TXT, FsUtil::FLIP_GT_TXT };
+
+PairKey ScoreCache::StampPair(const std::string& resultPairDir, const std::string& datasetPairDir)
+{
+	PairKey key;
+	for (int k = 0; k < PairKey::NUM_FILES; k++)
+	{
+		std::string path = k < 4 ?
+			FsUtil::JoinPath(resultPairDir, FsUtil::PAIR_FILE_NAMES[RESULT_FILES[k]]) :
+			FsUtil::JoinPath(datasetPairDir, FsUtil::PAIR_FILE_NAMES[DATASET_FILES[k - 4]]);
+		if (!FsUtil::GetFileStamp(path, key.stamps[k][0], key.stamps[k][1]))
+			key.stamps[k][0] = key.stamps[k][1] = -1;
+	}
+	return key;
+}
+
+static void put_scores(BufferWriter& writer, const cv::Mat_<double>& score)
+{
+	cv::Mat_<double> c = score.isContinuous() ? score : score.clone();
+	writer.Put((int)c.total());
+	writer.PutBytes(c.data, c.total() * sizeof(double));
+}
+
+static cv::Mat_<double> get_scores(BufferReader& reader)
+{
+	int n = reader.Get<int>();
+	if (!reader.ok || n < 0 || n > (1 << 20)) {
+		reader.ok = false;
+		return cv::Mat_<double>();
+	}
+	cv::Mat_<double> score(n, 1);
+	reader.GetBytes(score.data, n * sizeof(double));
+	return score;
+}
+
+// write to a temporary file and replace, so an interrupted run leaves the old file
+static bool replace_file(const std::string& file, const std::vector<uchar>& data)
+{
+	std::string tmpFile = file + ".tmp";
+	FILE* fp = fopen(tmpFile.c_str(), "wb");
+	if (fp == NULL)
+		return false;
+	bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+	ok = (fclose(fp) == 0) && ok;
+	if (ok)
+	{
+		remove(file.c_str());
+		ok = rename(tmpFile.c_str(), file.c_str()) == 0;
+	}
+	if (!ok)
+		remove(tmpFile.c_str());
+	return ok;
+}
+
+bool Cache::Load(const std::string& file, const std::string& settings)
+{
+	entries.clear();
+
+	std::vector<uchar> data;
+	if (!FsUtil::ReadFile(file, data) || data.size() < sizeof(CACHE_MAGIC) || memcmp(data.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0)
+		return false;
+
+	BufferReader reader(data.data() + sizeof(CACHE_MAGIC), data.data() + data.size());
+	if (reader.GetString() != settings || !reader.ok)
+		return false;
+
+	int count = reader.Get<int>();
+	for (int i = 0; i < count && reader.ok; i++)
+	{
+		std::string name = reader.GetString();
+		Entry e;
+		reader.GetBytes(e.key.stamps, sizeof(e.key.stamps));
+		e.score.valid = true;
+		e.score.flip = reader.Get<int>();
+		e.score.name1 = reader.GetString();
+		e.score.name2 = reader.GetString();
+		e.score.score1 = get_scores(reader);
+		e.score.score2 = get_scores(reader);
+		if (reader.ok)
+			entries[name] = e;
+	}
+
+	if (!reader.ok || !reader.AtEnd())
+	{
+		entries.clear();
+		return false;
+	}
+	return true;
+}
+
+bool Cache::Save(const std::string& file, const std::string& settings) const
+{
+	BufferWriter writer;
+	writer.PutBytes(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	writer.PutString(settings);
+	writer.Put((int)entries.size());
+	for (auto& it : entries)
+	{
+		const Entry& e = it.second;
+		writer.PutString(it.first);
+		writer.PutBytes(e.key.stamps, sizeof(e.key.stamps));
+		writer.Put(e.score.flip);
+		writer.PutString(e.score.name1);
+		writer.PutString(e.score.name2);
+		put_scores(writer, e.score.score1);
+		put_scores(writer, e.score.score2);
+	}
+
+	return replace_file(file, writer.buffer);
+}
+
+bool Cache::Find(const std::string& name, const PairKey& key, PairScore& score) const
+{
+	auto it = entries.find(name);
+	if (it == entries.end() || !(it->second.key == key))
+		return false;
+	score = it->second.score;
+	return true;
+}
+
+void Cache::Put(const std::string& name, const PairKey& key, const PairScore& score)
+{
+	Entry e;
+	e.key = key;
+	e.score = score;
+	e.score.hist1 = e.score.hist2 = EpeHistogram::Histogram();   // not written to scores.cache
+	entries[name] = e;
+}
+
+void Cache::Merge(const Cache& other)
+{
+	for (auto& it : other.entries)
+		entries[it.first] = it.second;
+}
+
+bool Cache::ReadSettings(const std::string& file, std::string& settings)
+{
+	std::vector<uchar> data;
+	if (!FsUtil::ReadFile(file, data) || data.size() < sizeof(CACHE_MAGIC) || memcmp(data.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0)
+		return false;
+	BufferReader reader(data.data() + sizeof(CACHE_MAGIC), data.data() + data.size());
+	settings = reader.GetString();
+	return reader.ok;
+}
+
+static void put_histogram(BufferWriter& writer, const EpeHistogram::Histogram& hist)
+{
+	writer.Put(hist.scale);
+	writer.Put((int)hist.bins.size());
+	if (hist.bins.empty())
+		return;
+	writer.PutBytes(hist.bins.data(), hist.bins.size() * sizeof(unsigned short));
+	writer.PutBytes(hist.counts.data(), hist.counts.size() * sizeof(unsigned));
+}
+
+static EpeHistogram::Histogram get_histogram(BufferReader& reader)
+{
+	EpeHistogram::Histogram hist;
+	hist.scale = reader.Get<double>();
+	int n = reader.Get<int>();
+	if (!reader.ok || n < 0 || n > EpeHistogram::NUM_BINS)
+	{
+		reader.ok = false;
+		return hist;
+	}
+	hist.bins.resize(n);
+	hist.counts.resize(n);
+	if (n > 0)
+	{
+		reader.GetBytes(hist.bins.data(), n * sizeof(unsigned short));
+		reader.GetBytes(hist.counts.data(), n * sizeof(unsigned));
+	}
+	for (int i = 0; i < n; i++)
+		hist.valid += hist.counts[i];
+	return hist;
+}
+
+bool HistogramStore::Load(const std::string& file)
+{
+	entries.clear();
+	settings.clear();
+
+	std::vector<uchar> data;
+	if (!FsUtil::ReadFile(file, data) || data.size() < sizeof(HIST_MAGIC) || memcmp(data.data(), HIST_MAGIC, sizeof(HIST_MAGIC)) != 0)
+		return false;
+
+	BufferReader reader(data.data() + sizeof(HIST_MAGIC), data.data() + data.size());
+	settings = reader.GetString();
+	int count = reader.Get<int>();
+	for (int i = 0; i < count && reader.ok; i++)
+	{
+		std::string name = reader.GetString();
+		PairScore score;
+		score.valid = true;
+		score.flip = reader.Get<int>();
+		score.name1 = reader.GetString();
+		score.name2 = reader.GetString();
+		score.score1 = cv::Mat_<double>(1, 1, reader.Get<double>());
+		score.score2 = cv::Mat_<double>(1, 1, reader.Get<double>());
+		score.hist1 = get_histogram(reader);
+		score.hist2 = get_histogram(reader);
+		if (reader.ok)
+			entries[name] = score;
+	}
+
+	if (!reader.ok || !reader.AtEnd())
+	{
+		entries.clear();
+		return false;
+	}
+	return true;
+}
+
+bool HistogramStore::Save(const std::string& file) const
+{
+	BufferWriter writer;
+	writer.PutBytes(HIST_MAGIC, sizeof(HIST_MAGIC));
+	writer.PutString(settings);
+	writer.Put((int)entries.size());
+	for (auto& it : entries)
+	{
+		const PairScore& s = it.second;
+		writer.PutString(it.first);
+		writer.Put(s.flip);
+		writer.PutString(s.name1);
+		writer.PutString(s.name2);
+		writer.Put(s.score1.empty() ? 0.0 : s.score1(0));
+		writer.Put(s.score2.empty() ? 0.0 : s.score2(0));
+		put_histogram(writer, s.hist1);
+		put_histogram(writer, s.hist2);
+	}
+	return replace_file(file, writer.buffer);
+}
+
+bool HistogramStore::Find(const std::string& name, PairScore& score) const
+{
+	auto it = entries.find(name);
+	if (it == entries.end())
+		return false;
+	score = it->second;
+	return true;
+}
+
+void HistogramStore::Put(const std::string& name, const PairScore& score)
+{
+	PairScore& s = entries[name];
+	s = score;
+	s.score1 = cv::Mat_<double>(1, 1, score.score1.empty() ? 0.0 : score.score1(0));
+	s.score2 = cv::Mat_<double>(1, 1, score.score2.empty() ? 0.0 : score.score2(0));
+}
+
+void HistogramStore::Merge(const HistogramStore& other)
+{
+	for (auto& it : other.entries)
+		entries[it.first] = it.second;
+}
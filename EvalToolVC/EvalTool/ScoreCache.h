@@ -0,0 +1,92 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <map>
+#include <string.h>
+
+#include "EpeHistogram.h"
+
+namespace ScoreCache
+{
+	// Scores of one image pair
+	struct PairScore
+	{
+		bool valid;
+		int flip;
+		std::string name1, name2;
+		cv::Mat_<double> score1, score2;
+		EpeHistogram::Histogram hist1, hist2;   // only kept with -saveHistograms
+
+		PairScore() : valid(false), flip(0) {}
+	};
+
+	// Size and modification time of the result files (flows and masks) and of the ground
+	// truth files of a pair. A cached score is reused only while all of them are unchanged.
+	struct PairKey
+	{
+		enum { NUM_FILES = 10 };
+		long long stamps[NUM_FILES][2];
+
+		bool operator==(const PairKey& other) const { return memcmp(stamps, other.stamps, sizeof(stamps)) == 0; }
+	};
+
+	// stamps the files of a pair directory of a results tree and of the dataset
+	PairKey StampPair(const std::string& resultPairDir, const std::string& datasetPairDir);
+
+	// Scores of the pairs of a results tree from a previous evaluation, stored next to scores.csv.
+	// The file records the evaluation settings and is ignored if they have changed.
+	class Cache
+	{
+		struct Entry
+		{
+			PairKey key;
+			PairScore score;
+		};
+		std::map<std::string, Entry> entries;
+
+	public:
+		// Loads the scores of a previous run with the same settings. Returns false if
+		// the file is missing, broken or was written with other settings.
+		bool Load(const std::string& file, const std::string& settings);
+
+		// Writes all entries to the file.
+		bool Save(const std::string& file, const std::string& settings) const;
+
+		// cached score of pair 'name', or false if it is not cached or its files have changed
+		bool Find(const std::string& name, const PairKey& key, PairScore& score) const;
+
+		void Put(const std::string& name, const PairKey& key, const PairScore& score);
+		// adds the entries of another cache, e.g. of a shard (-shard i/N)
+		void Merge(const Cache& other);
+		void Clear() { entries.clear(); }
+
+		// settings a cache file was written with, or false if it is not a cache file
+		static bool ReadSettings(const std::string& file, std::string& settings);
+		int Size() const { return (int)entries.size(); }
+	};
+
+	// Error histograms and mask scores of the pairs of a results tree (epe_hist.bin next to
+	// scores.csv), from which -mode rescore computes the flow accuracy for other thresholds.
+	class HistogramStore
+	{
+		std::string settings;
+		std::map<std::string, PairScore> entries;
+
+	public:
+		// Returns false if the file is missing or broken.
+		bool Load(const std::string& file);
+		bool Save(const std::string& file) const;
+
+		// settings of the evaluation the histograms come from
+		const std::string& Settings() const { return settings; }
+		void SetSettings(const std::string& s) { settings = s; }
+
+		// names, flip, mask scores (score1/score2 of one row) and histograms of pair 'name'
+		bool Find(const std::string& name, PairScore& score) const;
+
+		void Put(const std::string& name, const PairScore& score);
+		void Merge(const HistogramStore& other);
+		const std::map<std::string, PairScore>& Entries() const { return entries; }
+		int Size() const { return (int)entries.size(); }
+	};
+}
@@ -0,0 +1,194 @@
+#include "TiledEvaluation.h"
+#include "PairData.h"
+#include "FlowIO.h"
+#include "CvUtils.h"
+#include "Resampler.h"
+#include "PackedMask.h"
+#include "Profiler.h"
+
+namespace TiledEvaluation
+{
+	// Rows of a flow band of cols columns: as many as fit into maxBytes besides fixedBytes,
+	// with a GT and a result row each, and at least one.
+	static int band_rows(int cols, int rows, size_t maxBytes, size_t fixedBytes)
+	{
+		const size_t rowBytes = (size_t)cols * 2 * sizeof(float) * 2;
+		const size_t n = maxBytes > fixedBytes ? (maxBytes - fixedBytes) / rowBytes : 0;
+		return (int)std::max<size_t>(1, std::min<size_t>(n, (size_t)rows));
+	}
+
+	static cv::Mat read_mask(const std::string& file)
+	{
+		Profiler::Scope scope("decode png");
+		return cv::imread(file, cv::IMREAD_GRAYSCALE);
+	}
+
+	// Scores a result mask against the GT mask file, resizing a given mask of another size to
+	// the GT first. An empty mask is not scored. Returns false if the GT mask cannot be decoded.
+	static bool score_mask(const Evaluation::Evaluator& evaluator, const std::string& gtFile, cv::Mat& mask, bool resize, Evaluation::MaskScore& score, size_t& peakBytes)
+	{
+		cv::Mat maskGT = read_mask(gtFile);
+		if (maskGT.empty())
+			return false;
+
+		// as GTCache::PairGT, a 0/255 GT mask is compared in its packed form
+		const cv::Size size = maskGT.size();
+		PackedMask packedGT(maskGT);
+		size_t bytes = maskGT.total() + mask.total() + maskGT.total() / 4;
+		if (packedGT.IsBinary())
+			maskGT.release();
+		else
+			packedGT = PackedMask();
+
+		Profiler::Scope scope("mask score/flip");
+		if (mask.empty())
+			return true;
+		if (resize && mask.size() != size)
+		{
+			cv::Mat resized;
+			Resampler::ResizeMask(mask, resized, size, 128, evaluator.GetOptions().numThreads);
+			bytes += resized.total();
+			mask = resized;
+		}
+		score = evaluator.ScoreMask(packedGT, maskGT, mask);
+		peakBytes = std::max(peakBytes, bytes);
+		return true;
+	}
+
+	bool EvaluatePair(const Evaluation::Evaluator& evaluator, const std::string& gtDir, const FsUtil::PairFiles& gtFiles,
+		const std::string& resultDir, const FsUtil::PairFiles& resultFiles, size_t maxBytes, ScoreCache::PairScore& score, Stats& stats)
+	{
+		if (FsUtil::IsPacked(gtDir) || FsUtil::IsPacked(resultDir))
+			return false;
+		const int numThreads = evaluator.GetOptions().numThreads;
+
+		// GT flows that cannot be read in bands (compressed or broken) are left to Evaluate.
+		FlowIO::FlowBandReader gtReader[2];
+		if (!gtReader[0].Open(FsUtil::JoinPath(gtDir, "flow1.flo").c_str()) || !gtReader[1].Open(FsUtil::JoinPath(gtDir, "flow2.flo").c_str()))
+			return false;
+
+		// Result flows are used only as a pair, and broken files are ignored, as in PairData::LoadData.
+		const std::string flowFile[2] = { FsUtil::JoinPath(resultDir, "flow1.flo"), FsUtil::JoinPath(resultDir, "flow2.flo") };
+		FlowIO::FlowBandReader reader[2];
+		const bool hasFlows = resultFiles.Has(FsUtil::FLOW1_FLO) && resultFiles.Has(FsUtil::FLOW2_FLO) &&
+			FlowIO::ProbeFlowFile(flowFile[0].c_str()) && FlowIO::ProbeFlowFile(flowFile[1].c_str());
+		if (hasFlows)
+		for (int i = 0; i < 2; i++)
+		if (!reader[i].Open(flowFile[i].c_str()) || reader[i].Width() != gtReader[i].Width() || reader[i].Height() != gtReader[i].Height())
+			return false;
+
+		// image names and flip of the dataset pair; the flows and masks are not read here
+		FsUtil::PairFiles infoFiles;
+		if (gtFiles.Has(FsUtil::PAIR_TXT)) infoFiles.Set(FsUtil::PAIR_TXT);
+		if (gtFiles.Has(FsUtil::FLIP_GT_TXT)) infoFiles.Set(FsUtil::FLIP_GT_TXT);
+		PairData::PairBytes infoBytes;
+		PairData::ReadPairFiles(gtDir, infoFiles, infoBytes);
+		GTCache::PairGT info;
+		PairData::DecodeGroundTruth(infoBytes, info);
+
+		// Masks, one at a time. As in Evaluator::Evaluate, given masks are used only as a pair
+		// and are otherwise computed from the flows.
+		const std::string gtMaskFile[2] = { FsUtil::JoinPath(gtDir, "mask1.png"), FsUtil::JoinPath(gtDir, "mask2.png") };
+		const std::string maskFile[2] = { FsUtil::JoinPath(resultDir, "mask1.png"), FsUtil::JoinPath(resultDir, "mask2.png") };
+		bool hasMasks = resultFiles.Has(FsUtil::MASK1_PNG) && resultFiles.Has(FsUtil::MASK2_PNG);
+		Evaluation::MaskScore maskScore[2];
+		cv::Mat mapped[2];
+		size_t maskBytes = 0;
+		for (int i = 0; i < 2; i++)
+		{
+			cv::Mat mask;
+			if (hasMasks)
+			{
+				mask = read_mask(maskFile[i]);
+				if (mask.empty())
+				{
+					// a given mask cannot be decoded: score both masks from the flows instead
+					hasMasks = false;
+					maskScore[0] = Evaluation::MaskScore();
+					i = -1;
+					continue;
+				}
+			}
+			else if (hasFlows)
+			{
+				Profiler::Scope scope("mask from flow");
+				if (mapped[0].empty())
+				{
+					FlowIO::MapFlowFile(mapped[0], flowFile[0].c_str(), numThreads);
+					FlowIO::MapFlowFile(mapped[1], flowFile[1].c_str(), numThreads);
+				}
+				CvUtils::ComputeConsistencyMask(mapped[i], mapped[1 - i], Evaluation::CONSISTENCY_THRESHOLD, mask, numThreads);
+			}
+
+			// a GT mask that cannot be decoded makes the GT empty, which is not scored
+			if (!score_mask(evaluator, gtMaskFile[i], mask, hasMasks, maskScore[i], maskBytes))
+			{
+				score = ScoreCache::PairScore();
+				return true;
+			}
+		}
+		mapped[0] = mapped[1] = cv::Mat();
+		if (evaluator.GetOptions().autoFlip && hasMasks && Evaluation::Evaluator::ShouldFlip(maskScore[0], maskScore[1]))
+		{
+			std::swap(maskScore[0].score, maskScore[0].inverted);
+			std::swap(maskScore[1].score, maskScore[1].inverted);
+		}
+
+		// Flows, band by band. Thresholds are relative to the size of the other image, as in Evaluate.
+		ScoreCache::PairScore result;
+		result.hist1.scale = (double)std::max(gtReader[1].Height(), gtReader[1].Width());
+		result.hist2.scale = (double)std::max(gtReader[0].Height(), gtReader[0].Width());
+		EpeHistogram::Histogram* hist[2] = { &result.hist1, &result.hist2 };
+		cv::Mat_<double>* s[2] = { &result.score1, &result.score2 };
+		const int T = evaluator.Thresholds().rows;
+		size_t flowBytes = 0;
+		for (int i = 0; i < 2; i++)
+		{
+			*s[i] = cv::Mat_<double>(T + 1, 1);
+			*s[i] = 0;
+			(*s[i])(0) = maskScore[i].score;
+			if (!hasFlows)
+				continue;
+
+			Profiler::Scope scope("flow score");
+			std::vector<unsigned> dense(evaluator.GetOptions().keepHistograms ? EpeHistogram::NUM_BINS : 0);
+			CvUtils::FlowAccuracyCounter counter(evaluator.Thresholds() / 100.0 * hist[i]->scale, dense.empty() ? NULL : &dense[0]);
+
+			const int cols = gtReader[i].Width(), rows = gtReader[i].Height();
+			const size_t fixedBytes = dense.size() * sizeof(unsigned) + (size_t)cols * (sizeof(float) + 1);
+			const int bandRows = band_rows(cols, rows, maxBytes, fixedBytes);
+			cv::Mat gtBand(bandRows, cols, CV_32FC2), band(bandRows, cols, CV_32FC2);
+			while (gtReader[i].Row() < rows)
+			{
+				const int n = std::min(bandRows, rows - gtReader[i].Row());
+				cv::Mat g = gtBand.rowRange(0, n), f = band.rowRange(0, n);
+				// files shortened since they were opened are left to Evaluate
+				if (!gtReader[i].Read(g) || !reader[i].Read(f))
+					return false;
+				Profiler::AddBytes("read", (long long)(g.total() + f.total()) * 8);
+				counter.Add(f, g);
+			}
+
+			cv::Mat_<double> accuracy = counter.Accuracy();
+			for (int t = 0; t < T; t++)
+				(*s[i])(t + 1) = accuracy(t);
+			if (!dense.empty())
+				hist[i]->Build(&dense[0]);
+
+			flowBytes = std::max(flowBytes, fixedBytes + (size_t)bandRows * cols * 2 * sizeof(float) * 2);
+			stats.minBandRows = stats.minBandRows > 0 ? std::min(stats.minBandRows, bandRows) : bandRows;
+		}
+
+		result.name1 = info.name1;
+		result.name2 = info.name2;
+		result.flip = info.flip;
+		result.valid = true;
+		score = result;
+
+		stats.tiled++;
+		if (maskBytes > maxBytes)
+			stats.overBudget++;
+		stats.peakBytes = std::max(stats.peakBytes, (long long)std::max(maskBytes, flowBytes));
+		return true;
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+
+#include "Evaluation.h"
+#include "FsUtils.h"
+#include "ScoreCache.h"
+
+// Scoring of a pair within a memory budget, for images too large to hold the flows of a
+// pair at once (-maxMemoryMB). The GT and result flows are streamed from their files in
+// bands of rows and the flow accuracy counts are accumulated band by band, so the scores
+// are identical to those of Evaluation::Evaluator. Masks are PNG files and are decoded
+// whole, one at a time; masks computed from the flows read them through a mapping.
+namespace TiledEvaluation
+{
+	struct Stats
+	{
+		long long tiled;        // pairs scored in bands
+		long long whole;        // pairs that could not be read in bands and were scored whole
+		long long overBudget;   // tiled pairs whose masks alone did not fit into the budget
+		long long peakBytes;    // largest estimated working memory of a tiled pair
+		int minBandRows;        // fewest rows of a flow band, 0 if no flow was scored
+
+		Stats() : tiled(0), whole(0), overBudget(0), peakBytes(0), minBandRows(0) {}
+	};
+
+	// Scores the results in resultDir against the dataset pair in gtDir, keeping the working
+	// memory under maxBytes where the masks allow. Returns false, leaving score untouched, if
+	// the pair cannot be read in bands: a tree is packed, a flow is compressed, or the result
+	// flows differ in size from the GT flows and would have to be resized.
+	bool EvaluatePair(const Evaluation::Evaluator& evaluator, const std::string& gtDir, const FsUtil::PairFiles& gtFiles,
+		const std::string& resultDir, const FsUtil::PairFiles& resultFiles, size_t maxBytes, ScoreCache::PairScore& score, Stats& stats);
+}
@@ -1,10 +1,29 @@
 #include <opencv2/opencv.hpp>
+#include <map>
+#include <set>
+#include <atomic>
+#include <chrono>
 
 #include "FlowIO.h"
-#include "WinUtils.h"
+#include "FsUtils.h"
 #include "ArgsParser.h"
 #include "CvUtils.h"
-#include <direct.h>
+#include "ParallelUtils.h"
+#include "GTCache.h"
+#include "PackedMask.h"
+#include "ScoreCache.h"
+#include "Profiler.h"
+#include "ImageWriter.h"
+#include "PackFile.h"
+#include "EpeHistogram.h"
+#include "LocalSocket.h"
+#include "EvalProtocol.h"
+#include "ByteBuffer.h"
+#include "PairData.h"
+#include "Evaluation.h"
+#include "BufferArena.h"
+#include "TiledEvaluation.h"
+#include "Resampler.h"
 
 using namespace std;
 using namespace cv;
@@ -13,102 +32,74 @@ cv::Scalar BGCOLOR = cv::Scalar(255, 255, 0);
 cv::Scalar FLBGCOLOR = cv::Scalar(128, 128, 128);
 bool autoFlip = false;
 bool usePrec = false;
+int numThreads = 0;
+string gtCacheFile = "";
+int ioThreads = 2;
+int prefetchDepth = 0;
+int decodeDepth = 0;
+bool incremental = false;
+bool saveHistograms = false;
+int shardIndex = 0, shardCount = 1;
+int maxMemoryMB = 0;
+ImageWriter::Options imageWriterOptions;
 
-void load_data(string dir, cv::Mat& flow1, cv::Mat& flow2, cv::Mat& mask1, cv::Mat& mask2, string& image1 = string(), string& image2 = string())
-{
-	try {
-		mask1 = imread(dir + "\\mask1.png", cv::IMREAD_GRAYSCALE);
-		mask2 = imread(dir + "\\mask2.png", cv::IMREAD_GRAYSCALE);
-	}
-	catch (std::exception){
-		mask1 = cv::Mat();
-		mask2 = cv::Mat();
-	}
-	try {
-		FlowIO::ReadFlowFile(flow1, (dir + "\\flow1.flo").c_str());
-		FlowIO::ReadFlowFile(flow2, (dir + "\\flow2.flo").c_str());
-	}
-	catch (std::exception){
-		flow1 = cv::Mat();
-		flow2 = cv::Mat();
-	}
-
-	FILE *fp = fopen((dir + "\\pair.txt").c_str(), "r");
-	if (fp != nullptr)
-	{
-		char buff[2][512];
-		fscanf(fp, "%[^,],%[^,\n]\n", buff[0], buff[1]);
-		fscanf(fp, "%[^,],%[^,\n]\n", buff[0], buff[1]);
-		fclose(fp);
-		image1 = buff[0];
-		image2 = buff[1];
-	}
-}
+// number of flow accuracy thresholds, 1% to 50% of the image size
+const int THRESHOLD = Evaluation::NUM_THRESHOLDS;
 
-cv::Mat_<double> compute_score(cv::Mat maskGT1, cv::Mat flowGT1, cv::Mat mask1, cv::Mat flow1, cv::Mat thresholds)
+// Evaluator with the options given on the command line. Pairs are scored in parallel,
+// so each pair is scored on one thread.
+Evaluation::Evaluator make_evaluator()
 {
-	cv::Mat_<double> s(thresholds.rows + 1, thresholds.cols);
-	s = 0;
-
-	if (!mask1.empty())
-	{
-		if (usePrec)
-			// Precision (accurate pixel rate)
-			s.at<double>(0) = 1.0 - (double)cv::countNonZero(maskGT1 ^ mask1) / maskGT1.size().area();
-		else
-			// Intersection-over-union
-			s.at<double>(0) = (double)cv::countNonZero(maskGT1 & mask1) / cv::countNonZero(maskGT1 | mask1);
-	}
-
-	if (!flow1.empty())
-	{
-		cv::Mat error = CvUtils::computeFlowError(flow1, flowGT1);
-		cv::Mat validGT = CvUtils::ComputeValidFlowMask(flowGT1);
-
-		double validSize = cv::countNonZero(validGT);
-
-		for (int i = 0; i < thresholds.rows; i++)
-			s.at<double>(i + 1) = 1.0 - (double)cv::countNonZero((error > thresholds.at<double>(i)) & validGT) / validSize;
-	}
-
-	return s;
+	Evaluation::Options options;
+	options.autoFlip = autoFlip;
+	options.usePrec = usePrec;
+	options.keepHistograms = saveHistograms;
+	return Evaluation::Evaluator(options);
 }
 
-
-void output_visualization(cv::Mat mask1, cv::Mat flow1, cv::Mat image1, cv::Mat image2, std::string dir, std::string suffix, float maxmotion = -1)
+void output_visualization(ImageWriter::Writer& writer, cv::Mat mask1, cv::Mat flow1, cv::Mat image1, cv::Mat image2, std::string dir, std::string suffix, float maxmotion = -1)
 {
 	if (!mask1.empty())
 	{
 		cv::Mat foreground = image1.clone();
 		foreground.setTo(BGCOLOR, ~mask1);
-		cv::imwrite(dir + "\\foreground" + suffix + ".png", foreground);
+		writer.Write(FsUtil::JoinPath(dir, "foreground" + suffix), foreground);
 	}
 	else
 		mask1 = cv::Mat(flow1.size(), CV_8U, cv::Scalar(255));
 
 	if (!flow1.empty())
 	{
-		cv::Mat warped = CvUtils::warpImage(flow1, image2, BGCOLOR);
+		// 8-bit images are warped through a fixed-point map
+		cv::Mat warped = CvUtils::WarpMap(flow1, true, numThreads).Warp(image2, BGCOLOR);
 		warped.setTo(BGCOLOR, ~mask1);
-		cv::imwrite(dir + "\\warped" + suffix + ".png", warped);
+		writer.Write(FsUtil::JoinPath(dir, "warped" + suffix), warped);
 
-		cv::Mat flow = FlowIO::MotionToColor(flow1, maxmotion, FLBGCOLOR);
+		cv::Mat flow = FlowIO::MotionToColor(flow1, maxmotion, FLBGCOLOR, numThreads);
 		flow.setTo(FLBGCOLOR, ~mask1);
-		cv::imwrite(dir + "\\flow" + suffix + ".png", flow);
+		writer.Write(FsUtil::JoinPath(dir, "flow" + suffix), flow);
 	}
 }
 
-void output_visualization(string srcDir, string desDir, string datasetDir)
+cv::Mat read_image(const string& path)
 {
-	cv::Mat mask1, mask2, flow1, flow2;
+	if (!FsUtil::IsPacked(path))
+		return cv::imread(path);
+	std::vector<uchar> data;
+	return FsUtil::ReadFile(path, data) ? cv::imdecode(cv::Mat(data), cv::IMREAD_COLOR) : cv::Mat();
+}
 
-	load_data(srcDir, flow1, flow2, mask1, mask2);
-	cv::Mat image1 = cv::imread(datasetDir + "\\image1.png");
-	cv::Mat image2 = cv::imread(datasetDir + "\\image2.png");
+void output_visualization(ImageWriter::Writer& writer, string srcDir, string desDir, string datasetDir, const FsUtil::PairEntry& pair)
+{
+	cv::Mat mask1, mask2, flow1, flow2;
 
+	PairData::LoadData(srcDir, pair.result, flow1, flow2, mask1, mask2, numThreads);
 	if (flow1.empty() && flow2.empty() && mask1.empty() && mask2.empty())
 		return;
 
+	cv::Mat image1 = pair.dataset.Has(FsUtil::IMAGE1_PNG) ? read_image(FsUtil::JoinPath(datasetDir, "image1.png")) : cv::Mat();
+	cv::Mat image2 = pair.dataset.Has(FsUtil::IMAGE2_PNG) ? read_image(FsUtil::JoinPath(datasetDir, "image2.png")) : cv::Mat();
+
 	if (!mask1.empty() && mask1.size() != image1.size())
 		cv::resize(image1, image1, mask1.size());
 	else if (!flow1.empty() && flow1.size() != image1.size())
@@ -124,215 +115,1485 @@ void output_visualization(string srcDir, string desDir, string datasetDir)
 	{
 		cv::Mat maskGT1, maskGT2, flowGT1, flowGT2;
 		string name1, name2;
-		load_data(datasetDir, flowGT1, flowGT2, maskGT1, maskGT2, name1, name2);
+		PairData::LoadData(datasetDir, pair.dataset, flowGT1, flowGT2, maskGT1, maskGT2, name1, name2, numThreads);
 
 		if (!flowGT1.empty() && !flowGT2.empty())
 		{
 			if (flowGT1.size() != image1.size() || flowGT2.size() != image2.size())
-				CvUtils::ResizeFlowPair(flowGT1, flowGT2, image1.size(), image2.size());
+				CvUtils::ResizeFlowPair(flowGT1, flowGT2, image1.size(), image2.size(), numThreads);
 
-			float maxmotion1 = FlowIO::ComputeMaxMotion(flowGT1);
-			float maxmotion2 = FlowIO::ComputeMaxMotion(flowGT2);
+			float maxmotion1 = FlowIO::ComputeMaxMotion(flowGT1, numThreads);
+			float maxmotion2 = FlowIO::ComputeMaxMotion(flowGT2, numThreads);
 			maxmotion = std::max({ maxmotion1, maxmotion2 });
 		}
 
 		if (autoFlip && !maskGT1.empty() && !maskGT2.empty() && !mask1.empty() && !mask2.empty())
 		{
-			if (maskGT1.size() != mask1.size()){
-				cv::resize(maskGT1, maskGT1, mask1.size(), 0);
-				maskGT1 = maskGT1 > 128;
-			}
-			if (maskGT2.size() != mask2.size()) {
-				cv::resize(maskGT2, maskGT2, mask2.size(), 0);
-				maskGT2 = maskGT2 > 128;
-			}
+			if (maskGT1.size() != mask1.size())
+				Resampler::ResizeMask(maskGT1, maskGT1, mask1.size(), 128, numThreads);
+			if (maskGT2.size() != mask2.size())
+				Resampler::ResizeMask(maskGT2, maskGT2, mask2.size(), 128, numThreads);
 
-			double score1_1 = compute_score(maskGT1, cv::Mat(), mask1, cv::Mat(), cv::Mat_<double>(0, 1))(0);
-			double score2_1 = compute_score(maskGT2, cv::Mat(), mask2, cv::Mat(), cv::Mat_<double>(0, 1))(0);
-			double score1_0 = compute_score(maskGT1, cv::Mat(), ~mask1, cv::Mat(), cv::Mat_<double>(0, 1))(0);
-			double score2_0 = compute_score(maskGT2, cv::Mat(), ~mask2, cv::Mat(), cv::Mat_<double>(0, 1))(0);
-			if (score1_1 + score2_1 < score1_0 + score2_0){
+			PackedMask packedGT1(maskGT1), packedGT2(maskGT2);
+			if (!packedGT1.IsBinary()) packedGT1 = PackedMask();
+			if (!packedGT2.IsBinary()) packedGT2 = PackedMask();
+			const Evaluation::Evaluator evaluator = make_evaluator();
+			if (evaluator.ShouldFlip(evaluator.ScoreMask(packedGT1, maskGT1, mask1), evaluator.ScoreMask(packedGT2, maskGT2, mask2))){
 				mask1 = ~mask1;
 				mask2 = ~mask2;
 			}
 		}
 	}
 
-	_mkdir((desDir).c_str());
-	output_visualization(mask1, flow1, image1, image2, desDir, "1", maxmotion);
-	output_visualization(mask2, flow2, image2, image1, desDir, "2", maxmotion);
+	FsUtil::MakeDirectory(desDir);
+	output_visualization(writer, mask1, flow1, image1, image2, desDir, "1", maxmotion);
+	output_visualization(writer, mask2, flow2, image2, image1, desDir, "2", maxmotion);
 }
 
 void run_visualization(string resultsDir, string datasetDir, string subOutputDir = "")
 {
 	printf("Creating visualization.......\n");
 
-	auto dirs = WinUtil::GetDirectries(resultsDir, "\\*");
+	auto pairs = FsUtil::ScanPairs(resultsDir, datasetDir, numThreads);
+	ImageWriter::Writer writer(imageWriterOptions);
+	const string outputDir = FsUtil::OutputDir(resultsDir);
+
+	for (int i = 0; i < pairs.size(); i++)
+	{
+		string _srcDir = FsUtil::JoinPath(resultsDir, pairs[i].name);
+		string _desDir = FsUtil::JoinPath(FsUtil::JoinPath(outputDir, pairs[i].name), subOutputDir);
+		if (outputDir != resultsDir)
+			FsUtil::MakeDirectory(FsUtil::JoinPath(outputDir, pairs[i].name));
+		string _dataDir = FsUtil::JoinPath(datasetDir, pairs[i].name);
+		Profiler::Scope scope("visualize pair", pairs[i].name);
+		output_visualization(writer, _srcDir, _desDir, _dataDir, pairs[i]);
+	}
+
+	int failures = writer.Finish();
+	if (failures > 0)
+		printf("Failed to write %d images\n", failures);
+}
+
+typedef ScoreCache::PairScore PairScore;
+
+// scores.csv of one results tree, filled while the pairs are evaluated
+struct ScoreTable
+{
+	string resultDir;
+	std::vector<string> columns;   // names of the flow accuracy columns
+	FILE* fp;
+	cv::Mat_<double> meanScore, meanNoFlipScore;
+	int count, noFlipCount;
+
+	ScoreTable() : fp(NULL), count(0), noFlipCount(0) {}
+};
+
+// flow accuracy columns of the evaluation, T1...T50
+std::vector<string> default_columns()
+{
+	std::vector<string> columns;
+	for (int i = 0; i < THRESHOLD; i++)
+		columns.push_back("T" + std::to_string(i + 1));
+	return columns;
+}
+
+// name of an output file of the evaluation, e.g. scores.csv, or scores.shard-1-of-4.csv for -shard 1/4
+string shard_file(const string& base, const string& ext)
+{
+	if (shardCount <= 1)
+		return base + ext;
+	char suffix[64];
+	sprintf(suffix, ".shard-%d-of-%d", shardIndex, shardCount);
+	return base + suffix + ext;
+}
+
+// Opens the table of a results tree, scores.csv (or that of the shard) unless fileName is given.
+bool open_score_table(ScoreTable& t, string resultDir, const std::vector<string>& columns = default_columns(), string fileName = "")
+{
+	t.resultDir = resultDir;
+	t.columns = columns;
+	const string file = FsUtil::JoinPath(FsUtil::OutputDir(resultDir), fileName.empty() ? shard_file("scores", ".csv") : fileName);
+	t.fp = fopen(file.c_str(), "w");
+	if (t.fp == nullptr)
+	{
+		printf("Failed to open the output file: %s\n", file.c_str());
+		return false;
+	}
+
+	fprintf(t.fp, "%s,%s,%s,%s,%s", "Row", "Src", "Ref", usePrec ? "SegPrec" : "SegIUR", "Flip");
+	for (const string& column : columns)
+		fprintf(t.fp, ",%s", column.c_str());
+	fprintf(t.fp, "\n");
+
+	t.meanScore = cv::Mat_<double>::zeros((int)columns.size() + 1, 1);
+	t.meanNoFlipScore = cv::Mat_<double>::zeros((int)columns.size() + 1, 1);
+	return true;
+}
+
+// Writes a row of scores and adds them to the sums. A shard writes the scores exactly, so
+// that -mode merge adds them in the order of a single run and gets the same averages.
+void write_score_row(ScoreTable& t, const string& row, const string& src, const string& ref, const cv::Mat_<double>& score, int flip)
+{
+	const char* format = shardCount > 1 ? ",%.17g" : ",%lf";
+	fprintf(t.fp, "%s,%s,%s", row.c_str(), src.c_str(), ref.c_str());
+	fprintf(t.fp, format, score.at<double>(0));
+	fprintf(t.fp, ",%d", flip);
+	for (int j = 0; j < (int)t.columns.size(); j++) { fprintf(t.fp, format, score.at<double>(j + 1)); } fprintf(t.fp, "\n");
+	t.meanScore += score;
+	if (flip == 0) t.meanNoFlipScore += score;
+}
+
+void write_pair_rows(ScoreTable& t, const string& name, const PairScore& r)
+{
+	Profiler::Scope scope("write csv");
+	const long start = Profiler::Enabled() ? ftell(t.fp) : 0;
+	write_score_row(t, name + "_1to2", r.name1, r.name2, r.score1, r.flip);
+	write_score_row(t, name + "_1to2", r.name2, r.name1, r.score2, r.flip);
+	if (r.flip == 0) t.noFlipCount++;
 
-	for (int i = 0; i < dirs.size(); i++)
+	t.count++;
+	if (Profiler::Enabled())
+		Profiler::AddBytes("written", ftell(t.fp) - start);
+}
+
+// Writes the averages and closes the table. The table of a shard ends with the sums and
+// counts instead, from which -mode merge computes the averages of all shards.
+void close_score_table(ScoreTable& t)
+{
+	if (shardCount > 1)
 	{
-		string _srcDir = resultsDir + "\\" + dirs[i];
-		string _desDir = resultsDir + "\\" + dirs[i] + "\\" + subOutputDir;
-		string _dataDir = datasetDir + "\\" + dirs[i];
-		output_visualization(_srcDir, _desDir, _dataDir);
+		fprintf(t.fp, "#sum,%d", t.count);
+		for (int i = 0; i < t.meanScore.rows; i++) { fprintf(t.fp, ",%.17g", t.meanScore.at<double>(i)); } fprintf(t.fp, "\n");
+		fprintf(t.fp, "#noflipsum,%d", t.noFlipCount);
+		for (int i = 0; i < t.meanNoFlipScore.rows; i++) { fprintf(t.fp, ",%.17g", t.meanNoFlipScore.at<double>(i)); } fprintf(t.fp, "\n");
+		fclose(t.fp);
+		t.fp = NULL;
+		return;
 	}
+	t.meanScore = t.meanScore / (t.count * 2.0);
+	t.meanNoFlipScore = t.meanNoFlipScore / (t.noFlipCount * 2.0);
+	cv::Mat_<double> score = t.meanScore;
+	fprintf(t.fp, "%s,%s,%s,%lf,%d", "Average", "-", "-", score.at<double>(0), 1);
+	for (int i = 0; i < (int)t.columns.size(); i++) { fprintf(t.fp, ",%lf", score.at<double>(i + 1)); } fprintf(t.fp, "\n");
+	fprintf(t.fp, "%s,%s,%s,%lf,%d", "w/o flip", "-", "-", t.meanNoFlipScore.at<double>(0), 0);
+	for (int i = 0; i < (int)t.columns.size(); i++) { fprintf(t.fp, ",%lf", t.meanNoFlipScore.at<double>(i + 1)); } fprintf(t.fp, "\n");
+	fclose(t.fp);
+	t.fp = NULL;
 }
 
-void computeMaskFromFlow(cv::Mat flow1, cv::Mat flow2, cv::Mat& mask1, cv::Mat& mask2, double thres)
+// Writes the averages of all results trees, best first by the column 'rankBy'
+// (the segmentation metric or the name of a flow accuracy column, e.g. T1...T50).
+void write_leaderboard(const std::vector<ScoreTable>& tables, string file, string rankBy)
 {
-	if (flow1.empty() || flow2.empty()){
-		mask1 = cv::Mat();
-		mask2 = cv::Mat();
+	if (tables.empty())
 		return;
+	const char* smetric = usePrec ? "SegPrec" : "SegIUR";
+	const std::vector<string>& columns = tables[0].columns;
+	int column = (int)(std::find(columns.begin(), columns.end(), rankBy) - columns.begin()) + 1;
+	if (column > (int)columns.size())
+		column = 0;
+	if (column == 0 && rankBy.size() > 1 && rankBy[0] == 'T' && columns == default_columns())
+		column = std::min(std::max(atoi(rankBy.c_str() + 1), 0), THRESHOLD);
+
+	std::vector<int> order(tables.size());
+	for (int i = 0; i < (int)order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b){
+		return tables[a].meanScore.at<double>(column) > tables[b].meanScore.at<double>(column);
+	});
+
+	FILE* fp = fopen(file.c_str(), "w");
+	if (fp == nullptr)
+	{
+		printf("Failed to open the output file: %s\n", file.c_str());
+		return;
+	}
+	fprintf(fp, "%s,%s,%s,%s", "Rank", "Method", "Pairs", smetric);
+	for (const string& c : columns)
+		fprintf(fp, ",%s", c.c_str());
+	fprintf(fp, "\n");
+	for (int r = 0; r < (int)order.size(); r++)
+	{
+		const ScoreTable& t = tables[order[r]];
+		fprintf(fp, "%d,%s,%d,%lf", r + 1, t.resultDir.c_str(), t.count, t.meanScore.at<double>(0));
+		for (int i = 0; i < (int)columns.size(); i++) { fprintf(fp, ",%lf", t.meanScore.at<double>(i + 1)); } fprintf(fp, "\n");
 	}
+	fclose(fp);
+	printf("Leaderboard written to %s (ranked by %s)\n", file.c_str(), column == 0 ? smetric : rankBy.c_str());
+}
+
+// Prints the averages of the tables, the segmentation metric and the first five flow accuracies.
+void print_score_summary(const std::vector<ScoreTable>& tables)
+{
+	const char* smetric = usePrec ? "SegPrec" : "SegIUR";
+	printf("------------- Score Summary ----------------------\n");
+	printf("%8s %8s %8s %8s %8s %8s%s\n", smetric, "FA1", "FA2", "FA3", "FA4", "FA5", tables.size() > 1 ? " Method" : "");
+	for (const ScoreTable& t : tables)
+	{
+		const cv::Mat_<double>& score = t.meanScore;
+		for (int i = 0; i < 6; i++)
+			printf(i == 0 ? "%8.3lf" : " %8.3lf", i < score.rows ? score.at<double>(i) : 0.0);
+		if (tables.size() > 1)
+			printf(" %s", t.resultDir.c_str());
+		printf("\n");
+	}
+}
 
-	cv::Mat warpedFlow1 = CvUtils::warpImage(flow1, flow2, cv::Scalar::all(1e10));
-	cv::Mat warpedFlow2 = CvUtils::warpImage(flow2, flow1, cv::Scalar::all(1e10));
+// A prefetch queue that is mostly empty means the scoring waits for file reads,
+// and one that is mostly full means reading is ahead of decoding and scoring.
+void print_pipeline_stats(const ParallelUtils::QueueStats& fetchStats, const ParallelUtils::QueueStats& decodeStats)
+{
+	printf("------------- Pipeline Occupancy -----------------\n");
+	printf("%8s %8s %8s %8s %8s\n", "Queue", "Depth", "Mean", "Full%", "Empty%");
+	printf("%8s %8d %8.2lf %8.1lf %8.1lf\n", "prefetch", fetchStats.capacity, fetchStats.meanOccupancy, 100 * fetchStats.fullRatio, 100 * fetchStats.emptyRatio);
+	printf("%8s %8d %8.2lf %8.1lf %8.1lf\n", "decode", decodeStats.capacity, decodeStats.meanOccupancy, 100 * decodeStats.fullRatio, 100 * decodeStats.emptyRatio);
+	if (fetchStats.emptyRatio > 0.5)
+		printf("Bottleneck: reading files (I/O-bound)\n");
+	else if (decodeStats.fullRatio > 0.5)
+		printf("Bottleneck: scoring (compute-bound)\n");
+	else if (fetchStats.fullRatio > 0.5)
+		printf("Bottleneck: decoding (compute-bound)\n");
+}
 
-	mask1 = CvUtils::computeFlowError(flow1, -warpedFlow1) < thres;
-	mask2 = CvUtils::computeFlowError(flow2, -warpedFlow2) < thres;
+// Scratch buffers of the scoring threads and cv::Mat allocations of a run. Once every
+// arena has seen the largest pair, scoring allocates no more buffers: regrowths stay at 0
+// for a dataset of one image size, and the Mat allocations per pair are small.
+struct AllocationStats
+{
+	long long pairs;   // pairs scored
+	long long arenaRequests, arenaAllocations, arenaRegrowths, arenaBytes;
+	BufferArena::Counters mats;
+
+	AllocationStats() : pairs(0), arenaRequests(0), arenaAllocations(0), arenaRegrowths(0), arenaBytes(0) {}
+};
+
+void print_allocation_stats(const AllocationStats& s)
+{
+	printf("------------- Allocations -----------------\n");
+	printf("Scratch buffers : %lld allocated (%.1lf MB), %lld regrown for larger pairs, %lld requests\n",
+		s.arenaAllocations, s.arenaBytes / 1048576.0, s.arenaRegrowths, s.arenaRequests);
+	const double pairs = (double)std::max(s.pairs, 1LL);
+	printf("Mat allocations : %lld (%.1lf MB), %.1lf (%.1lf KB) per pair\n",
+		s.mats.allocations, s.mats.bytes / 1048576.0, s.mats.allocations / pairs, s.mats.bytes / 1024.0 / pairs);
+}
+
+void print_tiled_stats(const TiledEvaluation::Stats& s)
+{
+	printf("------------- Tiled Evaluation -----------------\n");
+	printf("Memory budget   : %d MB, estimated peak %.1lf MB\n", maxMemoryMB, s.peakBytes / 1048576.0);
+	printf("Tiled pairs     : %lld, flow bands of %d rows or more\n", s.tiled, s.minBandRows);
+	if (s.overBudget > 0)
+		printf("Over budget     : %lld pairs, whose masks alone need more (masks are decoded whole)\n", s.overBudget);
+	if (s.whole > 0)
+		printf("Scored whole    : %lld pairs (packed trees, compressed flows or result flows to be resized)\n", s.whole);
+}
+
+// Opens the -gtCache file of a dataset: pre-decoded ground truth, built on first use and
+// reused while the dataset is unchanged. Nothing is opened without -gtCache.
+void open_gt_cache(GTCache::Cache& gtCache, const string& datasetDir)
+{
+	if (!gtCacheFile.empty() && !gtCache.Open(gtCacheFile, datasetDir))
+	{
+		printf("Building ground truth cache: %s\n", gtCacheFile.c_str());
+		auto datasetDirs = FsUtil::GetDirectories(datasetDir);
+		auto loader = [](const string& dir, GTCache::PairGT& gt){ PairData::LoadGroundTruth(dir, FsUtil::ScanPairFiles(dir), gt); };
+		if (!GTCache::Cache::Build(gtCacheFile, datasetDir, datasetDirs, loader) || !gtCache.Open(gtCacheFile, datasetDir))
+			printf("Failed to build the ground truth cache. Loading the dataset directly.\n");
+	}
 }
 
-void run_evaluation(string resultDir, string datasetDir)
+// Evaluates one or more results trees against a dataset. Each dataset pair is loaded
+// once and scored against the results of every tree that has the pair, so the cost of
+// decoding the ground truth does not grow with the number of trees.
+void run_evaluation(const std::vector<string>& resultDirs, string datasetDir, string leaderboardFile = "", string rankBy = "")
 {
 	printf("Evaluating results.......\n");
 
-	auto dirs = WinUtil::GetDirectries(resultDir, "\\*");
-	FILE *scoreTable = fopen((resultDir + "\\scores.csv").c_str(), "w");
-	const int THRESHOLD = 50;
+	// Pairs of all trees in sorted order; entry[m] indexes the pair in scanned[m], or is -1.
+	struct EvalPair
+	{
+		string name;
+		FsUtil::PairFiles dataset;
+		std::vector<int> entry;
+	};
+	const int numMethods = (int)resultDirs.size();
+	std::vector<std::vector<FsUtil::PairEntry>> scanned(numMethods);
+	std::map<string, EvalPair> pairMap;
+	for (int m = 0; m < numMethods; m++)
+	{
+		Profiler::Scope scope("scan pairs", resultDirs[m]);
+		scanned[m] = FsUtil::ScanPairs(resultDirs[m], datasetDir, numThreads);
+		for (int k = 0; k < (int)scanned[m].size(); k++)
+		{
+			EvalPair& pair = pairMap[scanned[m][k].name];
+			if (pair.entry.empty())
+			{
+				pair.name = scanned[m][k].name;
+				pair.dataset = scanned[m][k].dataset;
+				pair.entry.assign(numMethods, -1);
+			}
+			pair.entry[m] = k;
+		}
+	}
+	std::vector<EvalPair> pairs;
+	for (auto& p : pairMap)
+		pairs.push_back(p.second);
 
-	if (scoreTable == nullptr)
+	// With -shard i/N, this run takes the i-th of N contiguous blocks of the sorted pairs.
+	if (shardCount > 1)
 	{
-		printf("Failed to open the output file: %s\n", (resultDir + "\\scores.csv").c_str());
+		const int total = (int)pairs.size();
+		const int begin = (int)((long long)total * shardIndex / shardCount);
+		const int end = (int)((long long)total * (shardIndex + 1) / shardCount);
+		pairs = std::vector<EvalPair>(pairs.begin() + begin, pairs.begin() + end);
+		printf("Shard %d/%d: pairs %d to %d of %d\n", shardIndex, shardCount, begin + 1, end, total);
+	}
+
+	std::vector<ScoreTable> tables(numMethods);
+	for (int m = 0; m < numMethods; m++)
+	if (!open_score_table(tables[m], resultDirs[m]))
+	{
+		for (int k = 0; k < m; k++)
+			fclose(tables[k].fp);
 		printf("Evaluation terminated.\n");
 		return;
 	}
 
-	const char* smetric = usePrec ? "SegPrec" : "SegIUR";
-	fprintf(scoreTable, "%s,%s,%s,%s,%s", "Row", "Src", "Ref", smetric, "Flip");
+	const Evaluation::Evaluator evaluator = make_evaluator();
 
-	cv::Mat_<double> thresholds(THRESHOLD, 1);
-	for (int i = 0; i < THRESHOLD; i++) {
-		fprintf(scoreTable, ",T%d", i + 1);
-		thresholds.at<double>(i) = i + 1;
+	// With -incremental, the scores of pairs whose result and GT files are unchanged since
+	// the last run are taken from scores.cache in each results tree instead of being recomputed.
+	// pending[i][m] tells whether pair i of tree m has to be scored.
+	const int n = (int)pairs.size();
+	char settings[64];
+	sprintf(settings, "v1 autoFlip=%d usePrec=%d thresholds=%d ", (int)autoFlip, (int)usePrec, THRESHOLD);
+	const string scoreSettings = settings + datasetDir;
+	sprintf(settings, "v1 autoFlip=%d usePrec=%d ", (int)autoFlip, (int)usePrec);
+	const string histSettings = settings + datasetDir;
+	std::vector<ScoreCache::Cache> lastScores(numMethods), newScores(numMethods);
+	std::vector<ScoreCache::HistogramStore> lastHists(numMethods), newHists(numMethods);
+	std::vector<std::vector<ScoreCache::PairKey>> keys;
+	std::vector<std::vector<PairScore>> reused(n, std::vector<PairScore>(numMethods));
+	std::vector<std::vector<char>> pending(n, std::vector<char>(numMethods));
+	for (int i = 0; i < n; i++)
+	for (int m = 0; m < numMethods; m++)
+		pending[i][m] = pairs[i].entry[m] >= 0;
+	if (incremental)
+	{
+		// a shard also reuses what it wrote itself since the last merge
+		for (int m = 0; m < numMethods; m++)
+		{
+			const string outputDir = FsUtil::OutputDir(resultDirs[m]);
+			lastScores[m].Load(FsUtil::JoinPath(outputDir, "scores.cache"), scoreSettings);
+			ScoreCache::Cache shardScores;
+			if (shardCount > 1 && shardScores.Load(FsUtil::JoinPath(outputDir, shard_file("scores", ".cache")), scoreSettings))
+				lastScores[m].Merge(shardScores);
+			if (!saveHistograms)
+				continue;
+			if (!lastHists[m].Load(FsUtil::JoinPath(outputDir, "epe_hist.bin")) || lastHists[m].Settings() != histSettings)
+				lastHists[m] = ScoreCache::HistogramStore();
+			ScoreCache::HistogramStore shardHists;
+			if (shardCount > 1 && shardHists.Load(FsUtil::JoinPath(outputDir, shard_file("epe_hist", ".bin"))) && shardHists.Settings() == histSettings)
+				lastHists[m].Merge(shardHists);
+		}
+
+		keys.assign(n, std::vector<ScoreCache::PairKey>(numMethods));
+		ParallelUtils::ParallelFor(n * numMethods, numThreads, [&](int t)
+		{
+			const int i = t / numMethods, m = t % numMethods;
+			if (!pending[i][m])
+				return;
+			keys[i][m] = ScoreCache::StampPair(FsUtil::JoinPath(resultDirs[m], pairs[i].name), FsUtil::JoinPath(datasetDir, pairs[i].name));
+			if (!lastScores[m].Find(pairs[i].name, keys[i][m], reused[i][m]))
+				return;
+			// a reused score also needs the histograms of the last run, or the pair is scored again
+			PairScore last;
+			if (saveHistograms && !lastHists[m].Find(pairs[i].name, last))
+			{
+				reused[i][m] = PairScore();
+				return;
+			}
+			reused[i][m].hist1 = last.hist1;
+			reused[i][m].hist2 = last.hist2;
+			pending[i][m] = 0;
+		});
+
+		int numReused = 0, numPairs = 0;
+		for (int i = 0; i < n; i++)
+		for (int m = 0; m < numMethods; m++)
+		{
+			numReused += reused[i][m].valid;
+			numPairs += pairs[i].entry[m] >= 0;
+		}
+		printf("Reused %d of %d pair scores from scores.cache\n", numReused, numPairs);
 	}
-	fprintf(scoreTable, "\n");
 
-	cv::Mat_<double> meanScore = cv::Mat_<double>::zeros(THRESHOLD + 1, 1);
-	cv::Mat_<double> meanNoFlipScore = cv::Mat_<double>::zeros(THRESHOLD + 1, 1);
-	cv::Mat_<double> score(meanScore.size());
-	int count = 0;
-	int NoFlipCount = 0;
-	for (int i = 0; i < dirs.size(); i++)
+	// With -maxMemoryMB, pairs are scored one at a time with their flows read in bands, and the
+	// scores then pass through the pipeline below like reused ones. Pairs that cannot be read in
+	// bands are loaded and scored whole. Pairs lacking GT files are left to the pipeline.
+	TiledEvaluation::Stats tiledStats;
+	if (maxMemoryMB > 0)
 	{
-		string _srcDir = datasetDir + "\\" + dirs[i];
-		string _desDir = resultDir + "\\" + dirs[i];
+		Evaluation::Options options = evaluator.GetOptions();
+		options.numThreads = numThreads;
+		const Evaluation::Evaluator tiledEvaluator(options);
+		const size_t maxBytes = (size_t)maxMemoryMB << 20;
+		try {
+			for (int i = 0; i < n; i++)
+			{
+				const EvalPair& pair = pairs[i];
+				const FsUtil::PairFiles& files = pair.dataset;
+				if (!files.Has(FsUtil::FLOW1_FLO) || !files.Has(FsUtil::FLOW2_FLO) || !files.Has(FsUtil::MASK1_PNG) || !files.Has(FsUtil::MASK2_PNG))
+					continue;
 
-		cv::Mat maskGT1, maskGT2, flowGT1, flowGT2;
-		cv::Mat mask1, mask2, flow1, flow2;
-		string name1, name2;
-		load_data(_srcDir, flowGT1, flowGT2, maskGT1, maskGT2, name1, name2);
-		load_data(_desDir, flow1, flow2, mask1, mask2);
+				const string gtDir = FsUtil::JoinPath(datasetDir, pair.name);
+				GTCache::PairGT gt;
+				for (int m = 0; m < numMethods; m++)
+				if (pending[i][m])
+				{
+					Profiler::Scope scope("evaluate pair", pair.name);
+					const string resultDir = FsUtil::JoinPath(resultDirs[m], pair.name);
+					const FsUtil::PairFiles& resultFiles = scanned[m][pair.entry[m]].result;
+					if (!TiledEvaluation::EvaluatePair(tiledEvaluator, gtDir, files, resultDir, resultFiles, maxBytes, reused[i][m], tiledStats))
+					{
+						if (gt.empty())
+							PairData::LoadGroundTruth(gtDir, files, gt);
+						cv::Mat flow1, flow2, mask1, mask2;
+						PairData::LoadData(resultDir, resultFiles, flow1, flow2, mask1, mask2, numThreads);
+						reused[i][m] = tiledEvaluator.Evaluate(gt, flow1, flow2, mask1, mask2);
+						tiledStats.whole++;
+					}
+					pending[i][m] = 0;
+				}
+			}
+		}
+		catch (...) {
+			for (ScoreTable& t : tables)
+				fclose(t.fp);
+			throw;
+		}
+	}
 
-		if (flowGT1.empty() || flowGT2.empty() || maskGT1.empty() || maskGT2.empty())
-			continue;
+	// the GT cache holds whole flows, which the tiled evaluation does not read
+	GTCache::Cache gtCache;
+	if (maxMemoryMB <= 0)
+		open_gt_cache(gtCache, datasetDir);
+
+	// Pairs flow through three stages connected by bounded queues: the prefetch stage reads
+	// the files of pair N+k while the decode stage decodes masks and flows and the scoring
+	// stage evaluates earlier pairs. Rows are then taken in directory order so that the
+	// tables and their averages match a serial run.
+	struct ResultData
+	{
+		cv::Mat flow1, flow2, mask1, mask2;
+	};
+	struct PairJob
+	{
+		int index;
+		bool cachedGT;   // gt refers to the GT cache file
+		PairData::PairBytes gtBytes;
+		std::vector<PairData::PairBytes> resultBytes;   // per results tree
+		GTCache::PairGT gt;
+		std::vector<ResultData> results;
+
+		PairJob() : index(-1), cachedGT(false) {}
+	};
+	typedef std::unique_ptr<PairJob> JobPtr;
+
+	// Scored jobs are recycled, so that the file buffers and the decoded flows of a pair reuse
+	// the memory of an earlier one. There are never more jobs than the queues and the stages hold.
+	std::mutex jobPoolMutex;
+	std::vector<JobPtr> jobPool;
+	auto take_job = [&]() -> JobPtr
+	{
+		std::lock_guard<std::mutex> lock(jobPoolMutex);
+		if (jobPool.empty())
+			return JobPtr(new PairJob());
+		JobPtr job = std::move(jobPool.back());
+		jobPool.pop_back();
+		return job;
+	};
+	auto recycle_job = [&](JobPtr job)
+	{
+		if (job->cachedGT)
+			job->gt = GTCache::PairGT();
+		job->cachedGT = false;
 
-		int flip = 0;
-		FILE *flipFp = fopen((_srcDir + "\\flip_gt.txt").c_str(), "r");
-		if (flipFp != nullptr)
+		// mapped flows are unmapped rather than kept as buffers, which would copy their pages when written
+		if (!job->gtBytes.flows[0].empty())
 		{
-			//char buff[2][512];
-			fscanf(flipFp, "%d", &flip);
+			job->gt.flow1 = job->gt.flow2 = cv::Mat();
+			job->gtBytes.flows[0] = job->gtBytes.flows[1] = cv::Mat();
 		}
-		if (!mask1.empty() && mask1.size() != maskGT1.size())
+		for (size_t m = 0; m < job->resultBytes.size() && m < job->results.size(); m++)
+		if (!job->resultBytes[m].flows[0].empty())
 		{
-			cv::resize(mask1, mask1, maskGT1.size(), 0);
-			mask1 = mask1 > 128;
+			job->results[m].flow1 = job->results[m].flow2 = cv::Mat();
+			job->resultBytes[m].flows[0] = job->resultBytes[m].flows[1] = cv::Mat();
 		}
-		if (!mask2.empty() && mask2.size() != maskGT2.size())
+		std::lock_guard<std::mutex> lock(jobPoolMutex);
+		jobPool.push_back(std::move(job));
+	};
+
+	// each scoring thread draws its scratch buffers from its own arena
+	std::mutex arenaMutex;
+	AllocationStats allocStats;
+	BufferArena::CountMatAllocations();
+	const BufferArena::Counters matStart = BufferArena::MatAllocations();
+
+	ParallelUtils::BoundedQueue<JobPtr> fetched(prefetchDepth > 0 ? prefetchDepth : 2 * numThreads);
+	ParallelUtils::BoundedQueue<JobPtr> decoded(decodeDepth > 0 ? decodeDepth : numThreads);
+	ParallelUtils::OrderedResults<std::vector<PairScore>> results(n);
+	auto abort = [&]{ fetched.Abort(); decoded.Abort(); results.Abort(); };
+
+	std::mutex nextMutex;
+	int next = 0;
+	ParallelUtils::ThreadGroup prefetchStage, decodeStage, scoreStage;
+	prefetchStage.Start(std::max(ioThreads, 1), [&]
+	{
+		Profiler::SetThreadName("prefetch");
+		for (;;)
 		{
-			cv::resize(mask2, mask2, maskGT2.size());
-			mask2 = mask2 > 128;
+			int i;
+			{
+				std::lock_guard<std::mutex> lock(nextMutex);
+				if (next >= n)
+					return;
+				i = next++;
+			}
+
+			const EvalPair& pair = pairs[i];
+			if (std::find(pending[i].begin(), pending[i].end(), 1) == pending[i].end())
+			{
+				results.Put(i, reused[i]);
+				continue;
+			}
+
+			Profiler::Scope scope("prefetch pair", pair.name);
+			JobPtr job = take_job();
+			job->index = i;
+			if (!gtCache.Contains(pair.name))
+			{
+				const FsUtil::PairFiles& files = pair.dataset;
+				if (!files.Has(FsUtil::FLOW1_FLO) || !files.Has(FsUtil::FLOW2_FLO) || !files.Has(FsUtil::MASK1_PNG) || !files.Has(FsUtil::MASK2_PNG))
+				{
+					results.Put(i, std::vector<PairScore>());
+					recycle_job(std::move(job));
+					continue;
+				}
+				PairData::ReadPairFiles(FsUtil::JoinPath(datasetDir, pair.name), files, job->gtBytes, true);
+			}
+			// uncompressed flows outside packs are mapped and their pages read here, not copied
+			job->resultBytes.resize(numMethods);
+			for (int m = 0; m < numMethods; m++)
+			if (pending[i][m])
+				PairData::ReadPairFiles(FsUtil::JoinPath(resultDirs[m], pair.name), scanned[m][pair.entry[m]].result, job->resultBytes[m], true);
+
+			if (!fetched.Push(std::move(job)))
+				return;
 		}
+	}, [&]{ fetched.Close(); }, abort);
+
+	decodeStage.Start(numThreads, [&]
+	{
+		Profiler::SetThreadName("decode");
+		JobPtr job;
+		while (fetched.Pop(job))
+		{
+			Profiler::Scope scope("decode pair", pairs[job->index].name);
+			job->cachedGT = gtCache.Get(pairs[job->index].name, job->gt);
+			if (!job->cachedGT)
+				PairData::DecodeGroundTruth(job->gtBytes, job->gt);
+			job->results.resize(numMethods);
+			for (int m = 0; m < numMethods; m++)
+			if (pending[job->index][m])
+			{
+				ResultData& r = job->results[m];
+				PairData::DecodeData(job->resultBytes[m], r.flow1, r.flow2, r.mask1, r.mask2);
+			}
 
-		if (!flow1.empty() && !flow2.empty())
-			CvUtils::ResizeFlowPair(flow1, flow2, flowGT1.size(), flowGT2.size());
+			if (!decoded.Push(std::move(job)))
+				return;
+		}
+	}, [&]{ decoded.Close(); }, abort);
 
-		if (autoFlip && !maskGT1.empty() && !maskGT2.empty() && !mask1.empty() && !mask2.empty())
+	scoreStage.Start(numThreads, [&]
+	{
+		Profiler::SetThreadName("score");
+		BufferArena::Arena arena;
+		long long scored = 0;
+		JobPtr job;
+		while (decoded.Pop(job))
 		{
-			double score1_1 = compute_score(maskGT1, cv::Mat(), mask1, cv::Mat(), cv::Mat_<double>(0, 1))(0);
-			double score2_1 = compute_score(maskGT2, cv::Mat(), mask2, cv::Mat(), cv::Mat_<double>(0, 1))(0);
-			double score1_0 = compute_score(maskGT1, cv::Mat(), ~mask1, cv::Mat(), cv::Mat_<double>(0, 1))(0);
-			double score2_0 = compute_score(maskGT2, cv::Mat(), ~mask2, cv::Mat(), cv::Mat_<double>(0, 1))(0);
-			if (score1_1 + score2_1 < score1_0 + score2_0){
-				mask1 = ~mask1;
-				mask2 = ~mask2;
+			Profiler::Scope scope("evaluate pair", pairs[job->index].name);
+			std::vector<PairScore> scores = reused[job->index];
+			for (int m = 0; m < numMethods; m++)
+			if (pending[job->index][m])
+			{
+				ResultData& r = job->results[m];
+				scores[m] = evaluator.Evaluate(job->gt, r.flow1, r.flow2, r.mask1, r.mask2, &arena);
 			}
+			results.Put(job->index, scores);
+			recycle_job(std::move(job));
+			scored++;
 		}
 
-		if (mask1.empty() || mask2.empty())
-			computeMaskFromFlow(flow1, flow2, mask1, mask2, 20);
+		std::lock_guard<std::mutex> lock(arenaMutex);
+		allocStats.pairs += scored;
+		allocStats.arenaRequests += arena.Requests();
+		allocStats.arenaAllocations += arena.Allocations();
+		allocStats.arenaRegrowths += arena.Regrowths();
+		allocStats.arenaBytes += arena.Bytes();
+	}, []{}, abort);
 
-		score = compute_score(maskGT1, flowGT1, mask1, flow1, thresholds / 100.0 * (double)std::max(flowGT2.rows, flowGT2.cols));
-		fprintf(scoreTable, "%s_1to2,%s,%s,%lf,%d", dirs[i].c_str(), name1.c_str(), name2.c_str(), score.at<double>(0), flip);
-		for (int j = 0; j < THRESHOLD; j++) { fprintf(scoreTable, ",%lf", score.at<double>(j + 1)); } fprintf(scoreTable, "\n");
-		meanScore += score;
-		if (flip == 0) meanNoFlipScore += score;
+	for (int i = 0; i < n; i++)
+	{
+		std::vector<PairScore> r;
+		if (!results.Take(i, r))
+			break;
+		for (int m = 0; m < (int)r.size(); m++)
+		if (r[m].valid)
+		{
+			write_pair_rows(tables[m], pairs[i].name, r[m]);
+			if (incremental)
+				newScores[m].Put(pairs[i].name, keys[i][m], r[m]);
+			if (saveHistograms)
+				newHists[m].Put(pairs[i].name, r[m]);
+		}
+	}
 
-		score = compute_score(maskGT2, flowGT2, mask2, flow2, thresholds / 100.0 * (double)std::max(flowGT1.rows, flowGT1.cols));
-		fprintf(scoreTable, "%s_1to2,%s,%s,%lf,%d", dirs[i].c_str(), name2.c_str(), name1.c_str(), score.at<double>(0), flip);
-		for (int j = 0; j < THRESHOLD; j++) { fprintf(scoreTable, ",%lf", score.at<double>(j + 1)); } fprintf(scoreTable, "\n");
-		meanScore += score;
-		if (flip == 0) meanNoFlipScore += score;
-		if (flip == 0) NoFlipCount++;
+	try {
+		prefetchStage.Join();
+		decodeStage.Join();
+		scoreStage.Join();
+	}
+	catch (...) {
+		for (ScoreTable& t : tables)
+			fclose(t.fp);
+		throw;
+	}
+	allocStats.mats.allocations = BufferArena::MatAllocations().allocations - matStart.allocations;
+	allocStats.mats.bytes = BufferArena::MatAllocations().bytes - matStart.bytes;
+	auto print_run_stats = [&]
+	{
+		if (maxMemoryMB > 0)
+			print_tiled_stats(tiledStats);
+		else
+		{
+			print_pipeline_stats(fetched.Stats(), decoded.Stats());
+			print_allocation_stats(allocStats);
+		}
+	};
 
-		count++;
+	for (ScoreTable& t : tables)
+		close_score_table(t);
+	if (incremental)
+	for (int m = 0; m < numMethods; m++)
+	if (!newScores[m].Save(FsUtil::JoinPath(FsUtil::OutputDir(resultDirs[m]), shard_file("scores", ".cache")), scoreSettings))
+		printf("Failed to write the score cache: %s\n", FsUtil::JoinPath(FsUtil::OutputDir(resultDirs[m]), shard_file("scores", ".cache")).c_str());
+	if (saveHistograms)
+	for (int m = 0; m < numMethods; m++)
+	{
+		newHists[m].SetSettings(histSettings);
+		if (!newHists[m].Save(FsUtil::JoinPath(FsUtil::OutputDir(resultDirs[m]), shard_file("epe_hist", ".bin"))))
+			printf("Failed to write the error histograms: %s\n", FsUtil::JoinPath(FsUtil::OutputDir(resultDirs[m]), shard_file("epe_hist", ".bin")).c_str());
 	}
-	meanScore = meanScore / (count * 2.0);
-	meanNoFlipScore = meanNoFlipScore / (NoFlipCount * 2.0);
-	score = meanScore;
-	fprintf(scoreTable, "%s,%s,%s,%lf,%d", "Average", "-", "-", score.at<double>(0), 1);
-	for (int i = 0; i < THRESHOLD; i++) { fprintf(scoreTable, ",%lf", score.at<double>(i + 1)); } fprintf(scoreTable, "\n");
-	fprintf(scoreTable, "%s,%s,%s,%lf,%d", "w/o flip", "-", "-", meanNoFlipScore.at<double>(0), 0);
-	for (int i = 0; i < THRESHOLD; i++) { fprintf(scoreTable, ",%lf", meanNoFlipScore.at<double>(i + 1)); } fprintf(scoreTable, "\n");
-	fclose(scoreTable);
 
-	printf("------------- Score Summary ----------------------\n");
-	printf("%8s %8s %8s %8s %8s %8s\n", smetric, "FA1", "FA2", "FA3", "FA4", "FA5");
-	printf("%8.3lf %8.3lf %8.3lf %8.3lf %8.3lf %8.3lf\n", score.at<double>(0), score.at<double>(1), score.at<double>(2), score.at<double>(3), score.at<double>(4), score.at<double>(5));
+	// the averages and the leaderboard are left to -mode merge
+	if (shardCount > 1)
+	{
+		for (const ScoreTable& t : tables)
+			printf("%d pairs scored: %s\n", t.count, FsUtil::JoinPath(FsUtil::OutputDir(t.resultDir), shard_file("scores", ".csv")).c_str());
+		print_run_stats();
+		return;
+	}
+
+	print_score_summary(tables);
+	if (numMethods > 1 || !leaderboardFile.empty())
+		write_leaderboard(tables, leaderboardFile.empty() ? "leaderboard.csv" : leaderboardFile, rankBy);
+	print_run_stats();
+}
+
+// Parses a threshold list of -mode rescore, e.g. "1:50" or "0.5,1,2,4px": values are
+// percentages of the image size as in the evaluation, or pixels with the suffix "px".
+// "a:b" and "a:b:step" give ranges.
+bool parse_thresholds(const string& spec, std::vector<double>& values, std::vector<char>& absolute, std::vector<string>& columns)
+{
+	values.clear();
+	absolute.clear();
+	columns.clear();
+	size_t start = 0;
+	while (start <= spec.size())
+	{
+		size_t end = spec.find(',', start);
+		if (end == string::npos)
+			end = spec.size();
+		string item = spec.substr(start, end - start);
+		start = end + 1;
+
+		const bool px = item.size() > 2 && item.compare(item.size() - 2, 2, "px") == 0;
+		if (px)
+			item.resize(item.size() - 2);
+		double a, b, step = 1;
+		char rest;
+		int n = sscanf(item.c_str(), "%lf:%lf:%lf%c", &a, &b, &step, &rest);
+		if (n == 1)
+			b = a;
+		else if (n != 2 && n != 3)
+			return false;
+		if (a < 0 || b < a || step <= 0)
+			return false;
+		for (int k = 0; a + k * step <= b + 1e-9; k++)
+		{
+			const double v = a + k * step;
+			char name[32];
+			sprintf(name, px ? "%gpx" : "T%g", v);
+			values.push_back(v);
+			absolute.push_back(px);
+			columns.push_back(name);
+		}
+	}
+	return !values.empty();
+}
+
+// Writes scores_rescored.csv of each results tree for another threshold list, from the error
+// histograms of an earlier evaluation with -saveHistograms (epe_hist.bin). The accuracy
+// is exact to the bin width of the histograms, 0.4% of the threshold, so the exact
+// scores.csv of the evaluation is left as it is.
+void run_rescore(const std::vector<string>& resultDirs, string thresholdSpec, string leaderboardFile = "", string rankBy = "")
+{
+	std::vector<double> values;
+	std::vector<char> absolute;
+	std::vector<string> columns;
+	if (!parse_thresholds(thresholdSpec, values, absolute, columns))
+	{
+		printf("Invalid -thresholds %s\n", thresholdSpec.c_str());
+		return;
+	}
+	printf("Rescoring with %d thresholds.......\n", (int)values.size());
+
+	std::vector<ScoreTable> tables;
+	std::vector<float> pixels(values.size());
+	for (const string& dir : resultDirs)
+	{
+		ScoreCache::HistogramStore store;
+		const string file = FsUtil::JoinPath(FsUtil::OutputDir(dir), "epe_hist.bin");
+		if (!store.Load(file))
+		{
+			printf("Failed to read %s (written by the evaluation with -saveHistograms 1)\n", file.c_str());
+			continue;
+		}
+		usePrec = store.Settings().find("usePrec=1") != string::npos;
+
+		ScoreTable t;
+		if (!open_score_table(t, dir, columns, "scores_rescored.csv"))
+			continue;
+		for (auto& it : store.Entries())
+		{
+			PairScore r = it.second;
+			for (int d = 0; d < 2; d++)
+			{
+				const EpeHistogram::Histogram& hist = d == 0 ? r.hist1 : r.hist2;
+				cv::Mat_<double>& score = d == 0 ? r.score1 : r.score2;
+				// thresholds in float precision, as in ComputeFlowAccuracy
+				for (size_t j = 0; j < values.size(); j++)
+					pixels[j] = (float)(absolute[j] ? values[j] : values[j] / 100.0 * hist.scale);
+				std::vector<double> accuracy = hist.Accuracy(pixels);
+				cv::Mat_<double> s((int)values.size() + 1, 1);
+				s(0) = score(0);
+				for (size_t j = 0; j < values.size(); j++)
+					s((int)j + 1) = accuracy[j];
+				score = s;
+			}
+			write_pair_rows(t, it.first, r);
+		}
+		close_score_table(t);
+		printf("%d pairs rescored: %s\n", t.count, FsUtil::JoinPath(FsUtil::OutputDir(dir), "scores_rescored.csv").c_str());
+		tables.push_back(t);
+	}
+
+	print_score_summary(tables);
+	if (tables.size() > 1 || !leaderboardFile.empty())
+		write_leaderboard(tables, leaderboardFile.empty() ? "leaderboard.csv" : leaderboardFile, rankBy);
+}
+
+// fields of a CSV line, which are not quoted
+std::vector<string> split_fields(const string& line)
+{
+	std::vector<string> fields;
+	for (size_t start = 0; start <= line.size();)
+	{
+		size_t end = std::min(line.find(',', start), line.size());
+		fields.push_back(line.substr(start, end - start));
+		start = end + 1;
+	}
+	return fields;
+}
+
+// Combines the outputs of the -shard i/N runs on a results tree: the rows of the shards in
+// order and their averages into scores.csv, and their score caches and error
+// histograms into scores.cache and epe_hist.bin.
+bool merge_shards(const string& resultDir, ScoreTable& t)
+{
+	const string outputDir = FsUtil::OutputDir(resultDir);
+	std::map<int, string> shardFiles;
+	int numShards = 0;
+	for (const string& name : FsUtil::GetFiles(outputDir))
+	{
+		int i = 0, count = 0, len = 0;
+		if (sscanf(name.c_str(), "scores.shard-%d-of-%d%n", &i, &count, &len) != 2 || name.substr(len) != ".csv")
+			continue;
+		if (numShards != 0 && count != numShards)
+		{
+			printf("Shard outputs of different -shard counts in %s. Remove the outdated ones.\n", outputDir.c_str());
+			return false;
+		}
+		numShards = count;
+		shardFiles[i] = name;
+	}
+	if (numShards == 0)
+	{
+		printf("No shard outputs (scores.shard-*.csv) in %s\n", outputDir.c_str());
+		return false;
+	}
+	for (int i = 0; i < numShards; i++)
+	if (shardFiles.count(i) == 0)
+	{
+		printf("Missing shard %d/%d in %s\n", i, numShards, outputDir.c_str());
+		return false;
+	}
+
+	string header;
+	std::vector<string> rows;
+	int count = 0, noFlipCount = 0;
+	for (int i = 0; i < numShards; i++)
+	{
+		const string file = FsUtil::JoinPath(outputDir, shardFiles[i]);
+		std::vector<uchar> data;
+		if (!FsUtil::ReadFile(file, data))
+		{
+			printf("Failed to read %s\n", file.c_str());
+			return false;
+		}
+		std::vector<string> lines;
+		string line;
+		for (uchar c : data)
+		{
+			if (c == '\n') { lines.push_back(line); line.clear(); }
+			else if (c != '\r') line += (char)c;
+		}
+		if (!line.empty())
+			lines.push_back(line);
+
+		// the sums are written last, so a shard that did not finish has none
+		int sums = 0;
+		for (size_t k = 0; k < lines.size(); k++)
+		{
+			if (k == 0)
+			{
+				if (i > 0 && lines[k] != header)
+				{
+					printf("Shard %d/%d has other columns: %s\n", i, numShards, file.c_str());
+					return false;
+				}
+				header = lines[k];
+			}
+			else if (lines[k].compare(0, 5, "#sum,") == 0 || lines[k].compare(0, 11, "#noflipsum,") == 0)
+			{
+				const bool noFlip = lines[k][1] == 'n';
+				(noFlip ? noFlipCount : count) += atoi(lines[k].c_str() + (noFlip ? 11 : 5));
+				sums++;
+			}
+			else
+				rows.push_back(lines[k]);
+		}
+		if (sums != 2)
+		{
+			printf("Shard %d/%d is incomplete: %s\n", i, numShards, file.c_str());
+			return false;
+		}
+	}
+
+	// columns after Row,Src,Ref,<metric>,Flip
+	std::vector<string> fields = split_fields(header);
+	if (fields.size() < 5)
+	{
+		printf("Unexpected columns in the shard outputs of %s\n", outputDir.c_str());
+		return false;
+	}
+	usePrec = fields[3] == "SegPrec";
+
+	const string file = FsUtil::JoinPath(outputDir, "scores.csv");
+	t.resultDir = resultDir;
+	t.columns.assign(fields.begin() + 5, fields.end());
+	t.fp = fopen(file.c_str(), "w");
+	if (t.fp == nullptr)
+	{
+		printf("Failed to open the output file: %s\n", file.c_str());
+		return false;
+	}
+	fprintf(t.fp, "%s\n", header.c_str());
+
+	// The scores of the rows are added again in the order of a single run, rather than the
+	// sums of the shards, so that the averages match those of a single run.
+	const int numScores = (int)t.columns.size() + 1;
+	t.meanScore = cv::Mat_<double>::zeros(numScores, 1);
+	t.meanNoFlipScore = cv::Mat_<double>::zeros(numScores, 1);
+	for (const string& row : rows)
+	{
+		// the names are those before the last columns, which are numbers
+		fields = split_fields(row);
+		const int n = (int)fields.size();
+		if (n < numScores + 4)
+		{
+			printf("Broken row in the shard outputs of %s: %s\n", outputDir.c_str(), row.c_str());
+			fclose(t.fp);
+			t.fp = NULL;
+			return false;
+		}
+		string name = fields[0];
+		for (int j = 1; j < n - numScores - 3; j++)
+			name += "," + fields[j];
+		cv::Mat_<double> score(numScores, 1);
+		score(0) = atof(fields[n - numScores - 1].c_str());
+		for (int j = 1; j < numScores; j++)
+			score(j) = atof(fields[n - numScores + j].c_str());
+		write_score_row(t, name, fields[n - numScores - 3], fields[n - numScores - 2], score, atoi(fields[n - numScores].c_str()));
+	}
+	t.count = count;
+	t.noFlipCount = noFlipCount;
+	close_score_table(t);
+	printf("%d shards, %d pairs merged: %s\n", numShards, count, file.c_str());
+
+	// caches and histograms of the shards, where they were written
+	ScoreCache::Cache cache;
+	ScoreCache::HistogramStore hists;
+	string cacheSettings;
+	int numCaches = 0, numHists = 0;
+	for (int i = 0; i < numShards; i++)
+	{
+		char suffix[64];
+		sprintf(suffix, ".shard-%d-of-%d", i, numShards);
+		const string cacheFile = FsUtil::JoinPath(outputDir, string("scores") + suffix + ".cache");
+		ScoreCache::Cache shardCache;
+		string settings;
+		if (ScoreCache::Cache::ReadSettings(cacheFile, settings) && (numCaches == 0 || settings == cacheSettings) && shardCache.Load(cacheFile, settings))
+		{
+			cacheSettings = settings;
+			cache.Merge(shardCache);
+			numCaches++;
+		}
+		ScoreCache::HistogramStore shardHists;
+		if (shardHists.Load(FsUtil::JoinPath(outputDir, string("epe_hist") + suffix + ".bin")) && (numHists == 0 || shardHists.Settings() == hists.Settings()))
+		{
+			hists.SetSettings(shardHists.Settings());
+			hists.Merge(shardHists);
+			numHists++;
+		}
+	}
+	if (numCaches > 0 && !cache.Save(FsUtil::JoinPath(outputDir, "scores.cache"), cacheSettings))
+		printf("Failed to write the score cache: %s\n", FsUtil::JoinPath(outputDir, "scores.cache").c_str());
+	if (numCaches > 0 && numCaches < numShards)
+		printf("Score caches of %d of %d shards merged\n", numCaches, numShards);
+	if (numHists > 0 && !hists.Save(FsUtil::JoinPath(outputDir, "epe_hist.bin")))
+		printf("Failed to write the error histograms: %s\n", FsUtil::JoinPath(outputDir, "epe_hist.bin").c_str());
+	if (numHists > 0 && numHists < numShards)
+		printf("Error histograms of %d of %d shards merged, -mode rescore covers only their pairs\n", numHists, numShards);
+	return true;
+}
+
+void run_merge(const std::vector<string>& resultDirs, string leaderboardFile = "", string rankBy = "")
+{
+	printf("Merging shards.......\n");
+	std::vector<ScoreTable> tables;
+	for (const string& dir : resultDirs)
+	{
+		ScoreTable t;
+		if (merge_shards(dir, t))
+			tables.push_back(t);
+	}
+
+	print_score_summary(tables);
+	if (tables.size() > 1 || !leaderboardFile.empty())
+		write_leaderboard(tables, leaderboardFile.empty() ? "leaderboard.csv" : leaderboardFile, rankBy);
+}
+
+// Ground truth of a dataset kept in memory by -mode serve, by pair name
+typedef std::map<string, GTCache::PairGT> ResidentGT;
+
+static cv::Mat get_image(BufferReader& reader, int type)
+{
+	const int rows = reader.Get<int>(), cols = reader.Get<int>();
+	if (!reader.ok || rows < 0 || cols < 0 || (rows == 0) != (cols == 0) || (long long)rows * cols > (1LL << 28))
+	{
+		reader.ok = false;
+		return cv::Mat();
+	}
+	cv::Mat image(rows, cols, type);
+	if (rows > 0)
+		reader.GetBytes(image.data, image.total() * image.elemSize());
+	return image;
+}
+
+static void put_scores(BufferWriter& writer, const cv::Mat_<double>& score)
+{
+	writer.PutBytes(score.ptr<double>(), score.total() * sizeof(double));
+}
+
+// Handles one request of a client of -mode serve (see EvalProtocol.h).
+std::vector<uchar> serve_request(const std::vector<uchar>& request, const ResidentGT& resident, const string& datasetDir, bool& shutdown)
+{
+	BufferReader reader(request.data(), request.data() + request.size());
+	const int type = reader.Get<int>();
+
+	string error, message;
+	std::vector<string> names;
+	std::vector<PairScore> scores;
+	const Evaluation::Evaluator evaluator = make_evaluator();
+
+	if (type == EvalProtocol::EVALUATE_DIR)
+	{
+		const string dir = reader.GetString();
+		std::vector<string> dirs = FsUtil::GetDirectories(dir);
+		for (const string& name : dirs)
+		if (resident.count(name))
+			names.push_back(name);
+		if (!reader.ok)
+			error = "Broken request";
+		else if (dirs.empty())
+			error = "No pair directories in " + dir;
+		else
+		{
+			scores.resize(names.size());
+			ParallelUtils::ParallelFor((int)names.size(), numThreads, [&](int i)
+			{
+				const string pairDir = FsUtil::JoinPath(dir, names[i]);
+				cv::Mat flow1, flow2, mask1, mask2;
+				PairData::LoadData(pairDir, FsUtil::ScanPairFiles(pairDir), flow1, flow2, mask1, mask2, numThreads);
+				scores[i] = evaluator.Evaluate(resident.find(names[i])->second, flow1, flow2, mask1, mask2);
+			});
+			message = std::to_string(names.size()) + " of " + std::to_string(dirs.size()) + " pairs scored";
+		}
+	}
+	else if (type == EvalProtocol::EVALUATE_FLOWS)
+	{
+		const int count = reader.Get<int>();
+		struct FlowPair { string name; cv::Mat flow1, flow2, mask1, mask2; };
+		std::vector<FlowPair> pairs;
+		for (int i = 0; i < count && reader.ok; i++)
+		{
+			FlowPair p;
+			p.name = reader.GetString();
+			p.flow1 = get_image(reader, CV_32FC2);
+			p.flow2 = get_image(reader, CV_32FC2);
+			p.mask1 = get_image(reader, CV_8U);
+			p.mask2 = get_image(reader, CV_8U);
+			if (reader.ok && resident.count(p.name))
+				pairs.push_back(p);
+		}
+		if (!reader.ok || count < 0 || !reader.AtEnd())
+			error = "Broken request";
+		else
+		{
+			names.resize(pairs.size());
+			scores.resize(pairs.size());
+			ParallelUtils::ParallelFor((int)pairs.size(), numThreads, [&](int i)
+			{
+				FlowPair& p = pairs[i];
+				names[i] = p.name;
+				if (p.flow1.empty() || p.flow2.empty())
+					p.flow1 = p.flow2 = cv::Mat();
+				scores[i] = evaluator.Evaluate(resident.find(p.name)->second, p.flow1, p.flow2, p.mask1, p.mask2);
+			});
+			message = std::to_string(pairs.size()) + " of " + std::to_string(count) + " pairs scored";
+		}
+	}
+	else if (type == EvalProtocol::STATUS)
+		message = std::to_string(resident.size()) + " pairs of " + datasetDir + " resident";
+	else if (type == EvalProtocol::SHUTDOWN)
+	{
+		message = "Shutting down";
+		shutdown = true;
+	}
+	else
+		error = "Unknown request";
+
+	BufferWriter reply;
+	reply.Put(error.empty() ? 0 : 1);
+	reply.PutString(error.empty() ? message : error);
+	if (!error.empty() || (type != EvalProtocol::EVALUATE_DIR && type != EvalProtocol::EVALUATE_FLOWS))
+		return reply.buffer;
+
+	// rows and averages as written to scores.csv
+	cv::Mat_<double> meanScore = cv::Mat_<double>::zeros(THRESHOLD + 1, 1);
+	cv::Mat_<double> meanNoFlipScore = cv::Mat_<double>::zeros(THRESHOLD + 1, 1);
+	int count = 0, noFlipCount = 0;
+	for (const PairScore& r : scores)
+		count += r.valid;
+	reply.Put((int)usePrec);
+	reply.Put((int)autoFlip);
+	reply.Put(THRESHOLD);
+	reply.Put(count);
+	for (size_t i = 0; i < scores.size(); i++)
+	if (scores[i].valid)
+	{
+		const PairScore& r = scores[i];
+		reply.PutString(names[i]);
+		reply.PutString(r.name1);
+		reply.PutString(r.name2);
+		reply.Put(r.flip);
+		put_scores(reply, r.score1);
+		put_scores(reply, r.score2);
+		meanScore += r.score1;
+		meanScore += r.score2;
+		if (r.flip == 0)
+		{
+			meanNoFlipScore += r.score1;
+			meanNoFlipScore += r.score2;
+			noFlipCount++;
+		}
+	}
+	reply.Put(noFlipCount);
+	put_scores(reply, meanScore / (count * 2.0));
+	put_scores(reply, meanNoFlipScore / (noFlipCount * 2.0));
+	return reply.buffer;
+}
+
+// Loads the ground truth of a dataset once and evaluates the requests of clients connecting
+// to socketPath, each on one of serveThreads workers, until a client asks it to shut down.
+void run_server(string datasetDir, string socketPath, int serveThreads)
+{
+	printf("Loading ground truth.......\n");
+	const auto start = std::chrono::steady_clock::now();
+	GTCache::Cache gtCache;
+	open_gt_cache(gtCache, datasetDir);
+	const std::vector<string> names = FsUtil::GetDirectories(datasetDir);
+	std::vector<GTCache::PairGT> gts(names.size());
+	ParallelUtils::ParallelFor((int)names.size(), numThreads, [&](int i)
+	{
+		if (gtCache.Get(names[i], gts[i]))
+			return;
+		const string dir = FsUtil::JoinPath(datasetDir, names[i]);
+		const FsUtil::PairFiles files = FsUtil::ScanPairFiles(dir);
+		if (files.Has(FsUtil::FLOW1_FLO) && files.Has(FsUtil::FLOW2_FLO) && files.Has(FsUtil::MASK1_PNG) && files.Has(FsUtil::MASK2_PNG))
+			PairData::LoadGroundTruth(dir, files, gts[i]);
+	});
+	ResidentGT resident;
+	for (size_t i = 0; i < names.size(); i++)
+	if (!gts[i].empty())
+		resident[names[i]] = gts[i];
+	gts.clear();
+	printf("%d pairs resident (%.1lf s)\n", (int)resident.size(), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+	LocalSocket::Server server;
+	if (!server.Listen(socketPath))
+	{
+		printf("Failed to listen on %s (is another server running?)\n", socketPath.c_str());
+		return;
+	}
+	printf("Listening on %s with %d workers\n", socketPath.c_str(), serveThreads);
+
+	// Connections are handed to the workers through a queue. The worker that receives a
+	// shutdown request wakes the accepting thread by connecting once more; the connections
+	// still open then are shut down so that their workers stop waiting for requests.
+	typedef std::unique_ptr<LocalSocket::Connection> ConnectionPtr;
+	ParallelUtils::BoundedQueue<ConnectionPtr> clients(serveThreads);
+	std::mutex activeMutex;
+	std::set<LocalSocket::Connection*> active;
+	std::atomic<bool> stop(false);
+	std::atomic<int> numRequests(0);
+	ParallelUtils::ThreadGroup workers;
+	workers.Start(serveThreads, [&]
+	{
+		Profiler::SetThreadName("serve");
+		ConnectionPtr client;
+		while (clients.Pop(client))
+		{
+			{
+				std::lock_guard<std::mutex> lock(activeMutex);
+				if (stop)
+					continue;
+				active.insert(client.get());
+			}
+			std::vector<uchar> request;
+			bool shutdown = false;
+			while (!shutdown && client->Receive(request))
+			{
+				numRequests++;
+				if (!client->Send(serve_request(request, resident, datasetDir, shutdown)))
+					break;
+			}
+			{
+				std::lock_guard<std::mutex> lock(activeMutex);
+				active.erase(client.get());
+			}
+			client.reset();
+			if (shutdown && !stop.exchange(true))
+				LocalSocket::Connect(socketPath);
+		}
+	}, []{}, [&]{ clients.Abort(); });
+
+	for (;;)
+	{
+		ConnectionPtr client = server.Accept();
+		if (!client || stop || !clients.Push(std::move(client)))
+			break;
+	}
+	server.Close();
+	{
+		std::lock_guard<std::mutex> lock(activeMutex);
+		stop = true;
+		for (LocalSocket::Connection* c : active)
+			c->Shutdown();
+	}
+	clients.Close();
+	workers.Join();
+	printf("Server stopped after %d requests\n", (int)numRequests);
+}
+
+// Sends a request to a running server and prints the reply. The scores of an evaluation are
+// written to scores.csv of the results tree as by -mode evaluation.
+int run_query(string socketPath, int type, string resultsDir)
+{
+	std::unique_ptr<LocalSocket::Connection> server = LocalSocket::Connect(socketPath);
+	if (!server)
+	{
+		printf("No server listening on %s\n", socketPath.c_str());
+		return 1;
+	}
+	BufferWriter request;
+	request.Put(type);
+	if (type == EvalProtocol::EVALUATE_DIR)
+		request.PutString(FsUtil::AbsolutePath(resultsDir));
+	std::vector<uchar> reply;
+	if (!server->Send(request.buffer) || !server->Receive(reply))
+	{
+		printf("The server closed the connection\n");
+		return 1;
+	}
+
+	BufferReader reader(reply.data(), reply.data() + reply.size());
+	const int status = reader.Get<int>();
+	printf("%s\n", reader.GetString().c_str());
+	if (status != 0 || type != EvalProtocol::EVALUATE_DIR)
+		return status != 0 || !reader.ok ? 1 : 0;
 
+	// the table is labeled with the settings of the server, which scored the pairs
+	usePrec = reader.Get<int>() != 0;
+	autoFlip = reader.Get<int>() != 0;
+	const int T = reader.Get<int>();
+	const int count = reader.Get<int>();
+	if (!reader.ok || T != THRESHOLD)
+	{
+		printf("Unexpected reply\n");
+		return 1;
+	}
+	printf("Scored by the server with %s%s\n", usePrec ? "precision (SegPrec)" : "intersection-over-union (SegIUR)", autoFlip ? " and autoFlip" : "");
+	ScoreTable t;
+	if (!open_score_table(t, resultsDir))
+		return 1;
+	for (int i = 0; i < count && reader.ok; i++)
+	{
+		PairScore r;
+		const string name = reader.GetString();
+		r.name1 = reader.GetString();
+		r.name2 = reader.GetString();
+		r.flip = reader.Get<int>();
+		r.score1 = cv::Mat_<double>(T + 1, 1);
+		r.score2 = cv::Mat_<double>(T + 1, 1);
+		reader.GetBytes(r.score1.ptr<double>(), (T + 1) * sizeof(double));
+		reader.GetBytes(r.score2.ptr<double>(), (T + 1) * sizeof(double));
+		if (reader.ok)
+			write_pair_rows(t, name, r);
+	}
+	close_score_table(t);
+	if (!reader.ok)
+	{
+		printf("Unexpected reply\n");
+		return 1;
+	}
+	print_score_summary(std::vector<ScoreTable>(1, t));
+	return 0;
 }
 
 int main(int argn, char** args)
 {
 	ArgsParser argParser(argn, args);
 
+	std::string mode = "evaluation";
+	argParser.TryGetArgment("mode", mode);
+
+	// -mode pack bundles a dataset or results tree into one file, readable in place of the tree.
+	if (mode == "pack")
+	{
+		std::string input = "", output = "";
+		if (!argParser.TryGetArgment("input", input)){
+			std::cout << "Please specify the tree to pack by -input <dir> (and optionally -output <file.pack>)." << std::endl;
+			return 1;
+		}
+		while (input.size() > 1 && (input[input.size() - 1] == '/' || input[input.size() - 1] == '\\'))
+			input.resize(input.size() - 1);
+		if (!argParser.TryGetArgment("output", output))
+			output = input + ".pack";
+		return PackFile::Build(input, output) ? 0 : 1;
+	}
+
+	// -mode query sends one request to a running -mode serve.
+	if (mode == "query")
+	{
+		std::string socketPath = "evaltool.sock", resultsDir = "";
+		bool status = false, shutdown = false;
+		argParser.TryGetArgment("socket", socketPath);
+		argParser.TryGetArgment("status", status);
+		argParser.TryGetArgment("shutdown", shutdown);
+		if (!argParser.TryGetArgment("resultsDir", resultsDir) && !status && !shutdown){
+			std::cout << "Please specify -resultsDir <dir>, -status 1 or -shutdown 1 (and -socket <path> of the server)." << std::endl;
+			return 1;
+		}
+		return run_query(socketPath, shutdown ? EvalProtocol::SHUTDOWN : status ? EvalProtocol::STATUS : EvalProtocol::EVALUATE_DIR, resultsDir);
+	}
+
 	std::string resultsDir = "";
+	std::string resultsDirList = "";
 	std::string datasetDir = "";
 
 	bool dir1 = argParser.TryGetArgment("resultsDir", resultsDir);
+	bool dirs = argParser.TryGetArgment("resultsDirs", resultsDirList);
 	bool dir2 = argParser.TryGetArgment("datasetDir", datasetDir);
 
-	if (!dir1 || !dir2){
-		std::cout << "Please specify -resultsDir and -datasetDir argments." << std::endl;
+	// -mode rescore and -mode merge read only what was written in the results trees,
+	// and -mode serve takes its results trees from the requests.
+	const bool needsResults = mode != "serve";
+	const bool needsDataset = mode != "rescore" && mode != "merge";
+	if ((needsResults && !dir1 && !dirs) || (needsDataset && !dir2)){
+		std::cout << "Please specify -resultsDir (or -resultsDirs) and -datasetDir argments." << std::endl;
 		return 1;
 	}
 
-	std::cout << "Root Directory of Results    : " << resultsDir << std::endl;
-	std::cout << "Root Directory of Dataset    : " << datasetDir << std::endl;
+	// -resultsDirs evaluates several results trees, e.g. "resA;resB" or "results/*", in one pass.
+	std::vector<std::string> resultsDirs;
+	if (dirs)
+		resultsDirs = FsUtil::ExpandDirectoryList(resultsDirList);
+	else if (dir1)
+		resultsDirs.push_back(resultsDir);
+	if (resultsDirs.empty() && needsResults){
+		std::cout << "No results directory matches -resultsDirs " << resultsDirList << std::endl;
+		return 1;
+	}
 
-	std::string mode = "evaluation";
-	argParser.TryGetArgment("mode", mode);
+	for (const std::string& dir : resultsDirs)
+		std::cout << "Root Directory of Results    : " << dir << std::endl;
+	if (dir2)
+		std::cout << "Root Directory of Dataset    : " << datasetDir << std::endl;
+
+	// Pack files given in place of directories are mapped once and read like the trees they hold.
+	std::vector<std::string> roots = resultsDirs;
+	roots.push_back(datasetDir);
+	for (const std::string& root : roots)
+	if (PackFile::IsPack(root) && !FsUtil::IsPacked(root))
+	{
+		if (!FsUtil::MountPack(root)) {
+			std::cout << "Broken pack file: " << root << std::endl;
+			return 1;
+		}
+		std::cout << "Reading packed tree          : " << root << std::endl;
+	}
 	argParser.TryGetArgment("autoFlip", autoFlip); // Use only when cosegmentation methods are not aware which of 0/1 is the foreground label.
 	argParser.TryGetArgment("usePrec", usePrec);
 	std::cout << "Auto flip segmentation mask  : " << (autoFlip ? "on" : "off") << " (Use only when foreground label is not consistent. Enabled by -autoFlip 1)" << std::endl;
 	std::cout << "Evaluate by precision        : " << (usePrec ? "on" : "off") << " (Use precision instead of IUR for segmentation. Enabled by -usePrec 1)" << std::endl;
 
+	argParser.TryGetArgment("gtCache", gtCacheFile);
+	if (!gtCacheFile.empty())
+		std::cout << "Ground truth cache file      : " << gtCacheFile << std::endl;
+
+	argParser.TryGetArgment("ioThreads", ioThreads);
+	argParser.TryGetArgment("prefetchDepth", prefetchDepth);
+	argParser.TryGetArgment("decodeDepth", decodeDepth);
+
+	argParser.TryGetArgment("threads", numThreads);
+	numThreads = ParallelUtils::ResolveThreadCount(numThreads);
+	std::cout << "Number of worker threads     : " << numThreads << " (Pairs evaluated concurrently. Set by -threads N)" << std::endl;
+
+	bool profile = false;
+	std::string profileTrace = "profile_trace.json";
+	argParser.TryGetArgment("profile", profile);
+	argParser.TryGetArgment("profileTrace", profileTrace);
+	std::cout << "Profiling                    : " << (profile ? "on" : "off") << " (Stage timings and a Chrome trace. Enabled by -profile 1)" << std::endl;
+	Profiler::Enable(profile);
+
+	if (!Resampler::MatchesOpenCV())
+		std::cout << "Resizing                     : cv::resize (the single-pass resampler does not match OpenCV " << CV_VERSION << ")" << std::endl;
+	if (!FlowKernels::ConsistencyMatchesOpenCV())
+		std::cout << "Flow masks                   : cv::remap (the consistency kernel does not match OpenCV " << CV_VERSION << ")" << std::endl;
+
+	// Pairs already run on separate workers (one per core by default); keep OpenCV from
+	// oversubscribing the cores.
+	if (ParallelUtils::ResolveThreadCount(numThreads) > 1)
+		cv::setNumThreads(1);
 
 	if (mode == "evaluation")
 	{
+		std::string leaderboardFile = "";
+		std::string rankBy = "";
+		argParser.TryGetArgment("leaderboard", leaderboardFile);
+		argParser.TryGetArgment("rankBy", rankBy);
+		argParser.TryGetArgment("incremental", incremental);
+		std::cout << "Incremental evaluation       : " << (incremental ? "on" : "off") << " (Reuse scores of unchanged pairs from scores.cache. Enabled by -incremental 1)" << std::endl;
+		argParser.TryGetArgment("saveHistograms", saveHistograms);
+		std::cout << "Save error histograms        : " << (saveHistograms ? "on" : "off") << " (Store epe_hist.bin for -mode rescore. Enabled by -saveHistograms 1)" << std::endl;
+
+		std::string shard = "";
+		if (argParser.TryGetArgment("shard", shard))
+		{
+			if (sscanf(shard.c_str(), "%d/%d", &shardIndex, &shardCount) != 2 || shardCount < 1 || shardIndex < 0 || shardIndex >= shardCount) {
+				std::cout << "Invalid -shard " << shard << " (i/N with 0 <= i < N)" << std::endl;
+				return 1;
+			}
+			std::cout << "Shard                        : " << shardIndex << "/" << shardCount << " (Combine the shards by -mode merge)" << std::endl;
+		}
+		argParser.TryGetArgment("maxMemoryMB", maxMemoryMB);
+		if (maxMemoryMB > 0)
+			std::cout << "Tiled evaluation             : " << maxMemoryMB << " MB (Pairs scored one at a time, flows read in bands. Set by -maxMemoryMB N)" << std::endl;
+
+		printf("\n");
+		run_evaluation(resultsDirs, datasetDir, leaderboardFile, rankBy);
+	}
+	else if (mode == "rescore")
+	{
+		std::string thresholdSpec = "1:50";
+		std::string leaderboardFile = "";
+		std::string rankBy = "";
+		argParser.TryGetArgment("thresholds", thresholdSpec);
+		argParser.TryGetArgment("leaderboard", leaderboardFile);
+		argParser.TryGetArgment("rankBy", rankBy);
+		std::cout << "Thresholds                   : " << thresholdSpec << " (% of the image size, or pixels with px. Set by -thresholds)" << std::endl;
+
 		printf("\n");
-		run_evaluation(resultsDir, datasetDir);
+		run_rescore(resultsDirs, thresholdSpec, leaderboardFile, rankBy);
+	}
+	else if (mode == "serve")
+	{
+		std::string socketPath = "evaltool.sock";
+		int serveThreads = 4;
+		argParser.TryGetArgment("socket", socketPath);
+		argParser.TryGetArgment("serveThreads", serveThreads);
+		serveThreads = std::max(serveThreads, 1);
+		std::cout << "Socket                       : " << socketPath << " (Set by -socket)" << std::endl;
+		std::cout << "Concurrent clients           : " << serveThreads << " (Set by -serveThreads N)" << std::endl;
+
+		printf("\n");
+		run_server(datasetDir, socketPath, serveThreads);
+	}
+	else if (mode == "merge")
+	{
+		std::string leaderboardFile = "";
+		std::string rankBy = "";
+		argParser.TryGetArgment("leaderboard", leaderboardFile);
+		argParser.TryGetArgment("rankBy", rankBy);
+
+		printf("\n");
+		run_merge(resultsDirs, leaderboardFile, rankBy);
 	}
 	else if (mode == "visualization")
 	{
@@ -351,8 +1612,31 @@ int main(int argn, char** args)
 		printf("Background Color of Flow Map : (R:%03d, G:%03d, B:%03d)\n", (int)FLBGCOLOR[2], (int)FLBGCOLOR[1], (int)FLBGCOLOR[0]);
 		printf("Output Subdirectory Name     : %s\n", visSubDir.c_str());
 
+		std::string pngStrategy = "";
+		argParser.TryGetArgment("visFormat", imageWriterOptions.format);
+		argParser.TryGetArgment("pngCompression", imageWriterOptions.pngCompression);
+		if (argParser.TryGetArgment("pngStrategy", pngStrategy)) {
+			imageWriterOptions.pngStrategy = ImageWriter::ParsePngStrategy(pngStrategy);
+			if (imageWriterOptions.pngStrategy < 0)
+				printf("Unknown -pngStrategy %s (default, filtered, huffman, rle or fixed)\n", pngStrategy.c_str());
+		}
+		argParser.TryGetArgment("encodeThreads", imageWriterOptions.threads);
+		argParser.TryGetArgment("encodeQueueMB", imageWriterOptions.maxQueueMB);
+		printf("Output Image Format          : %s (Set by -visFormat png|bmp|ppm)\n", imageWriterOptions.format.c_str());
+		printf("Encoding Threads             : %d (Up to %d MB queued. Set by -encodeThreads N and -encodeQueueMB N)\n", imageWriterOptions.threads, imageWriterOptions.maxQueueMB);
+
 		printf("\n");
-		run_visualization(resultsDir, datasetDir, visSubDir);
+		for (const std::string& dir : resultsDirs)
+			run_visualization(dir, datasetDir, visSubDir);
+	}
+
+	if (profile)
+	{
+		Profiler::PrintSummary();
+		if (Profiler::WriteTrace(profileTrace))
+			printf("Trace written to %s (open in chrome://tracing)\n", profileTrace.c_str());
+		else
+			printf("Failed to write the trace: %s\n", profileTrace.c_str());
 	}
 
 	return 0;
@@ -0,0 +1,131 @@
+#include <opencv2/opencv.hpp>
+#include <stdio.h>
+#include <string.h>
+
+#include "../EvalTool/FlowIO.h"
+#include "../EvalTool/FsUtils.h"
+#include "../EvalTool/MappedFile.h"
+#include "../EvalTool/ArgsParser.h"
+
+using namespace std;
+
+float step = 0;
+bool decompress = false;
+bool verify = false;
+int numThreads = 0;
+
+long long numFiles = 0, numFailed = 0;
+long long inputBytes = 0, outputBytes = 0;
+
+bool is_flo(const string& name)
+{
+	return name.size() > 4 && name.compare(name.size() - 4, 4, ".flo") == 0;
+}
+
+// Converts one flow file. The result is written next to the output and renamed over it,
+// so converting in place never leaves a partial file behind.
+bool convert_file(const string& input, const string& output)
+{
+	const string temp = output.substr(0, output.size() - 4) + ".tmp.flo";
+	try
+	{
+		cv::Mat flow;
+		FlowIO::ReadFlowFile(flow, input.c_str());
+		if (decompress)
+			FlowIO::WriteFlowFile(flow, temp.c_str());
+		else
+			FlowIO::WriteCompressedFlowFile(flow, temp.c_str(), step, numThreads);
+
+		if (verify)
+		{
+			cv::Mat decoded;
+			FlowIO::ReadFlowFile(decoded, temp.c_str());
+			cv::Mat known = ~FlowIO::unknown_flow_mask(flow);
+			cv::Mat knownDecoded = ~FlowIO::unknown_flow_mask(decoded);
+			double maxError = cv::norm(flow, decoded, cv::NORM_INF, known);
+			double tolerance = step > 0 ? step / 2 + 1e-3 : 0;
+			if (cv::countNonZero(known != knownDecoded) > 0 || maxError > tolerance)
+			{
+				printf("Verification failed: %s (max error %g)\n", input.c_str(), maxError);
+				remove(temp.c_str());
+				return false;
+			}
+		}
+
+		const long long inSize = MappedFile::FileSize(input.c_str());
+		const long long outSize = MappedFile::FileSize(temp.c_str());
+		remove(output.c_str());
+		if (rename(temp.c_str(), output.c_str()) != 0)
+		{
+			printf("Failed to replace %s\n", output.c_str());
+			return false;
+		}
+		inputBytes += inSize;
+		outputBytes += outSize;
+		return true;
+	}
+	catch (FlowIO::CError& e)
+	{
+		printf("%s\n", e.message);
+		remove(temp.c_str());
+		return false;
+	}
+}
+
+// Converts every .flo file under inputDir into the same place under outputDir.
+void convert_tree(const string& inputDir, const string& outputDir)
+{
+	FsUtil::MakeDirectory(outputDir);
+	for (const string& name : FsUtil::GetFiles(inputDir))
+	if (is_flo(name))
+	{
+		numFiles++;
+		if (!convert_file(FsUtil::JoinPath(inputDir, name), FsUtil::JoinPath(outputDir, name)))
+			numFailed++;
+	}
+	for (const string& name : FsUtil::GetDirectories(inputDir))
+		convert_tree(FsUtil::JoinPath(inputDir, name), FsUtil::JoinPath(outputDir, name));
+}
+
+int main(int argn, char** args)
+{
+	ArgsParser argParser(argn, args);
+
+	string input = "", output = "";
+	if (!argParser.TryGetArgment("input", input))
+	{
+		std::cout << "Converts .flo files to the compressed flow container and back." << std::endl;
+		std::cout << "Usage: FlowConvert -input <file.flo or dir> [-output <file.flo or dir>] [-step S] [-decompress 1] [-verify 1] [-threads N]" << std::endl;
+		return 1;
+	}
+	argParser.TryGetArgment("output", output);
+	argParser.TryGetArgment("step", step);
+	argParser.TryGetArgment("decompress", decompress);
+	argParser.TryGetArgment("verify", verify);
+	argParser.TryGetArgment("threads", numThreads);
+	if (output.empty())
+		output = input;
+
+	std::cout << "Input                        : " << input << std::endl;
+	std::cout << "Output                       : " << output << (output == input ? " (in place)" : "") << std::endl;
+	if (decompress)
+		std::cout << "Conversion                   : to .flo" << std::endl;
+	else if (step > 0)
+		std::cout << "Conversion                   : to compressed, quantized to " << step << " pixels" << std::endl;
+	else
+		std::cout << "Conversion                   : to compressed, lossless" << std::endl;
+
+	if (is_flo(input))
+	{
+		numFiles++;
+		if (!convert_file(input, output))
+			numFailed++;
+	}
+	else
+		convert_tree(input, output);
+
+	printf("%lld files converted, %lld failed\n", numFiles - numFailed, numFailed);
+	if (inputBytes > 0)
+		printf("%.1lf MB -> %.1lf MB (%.1lf%%)\n", inputBytes / 1048576.0, outputBytes / 1048576.0, 100.0 * outputBytes / inputBytes);
+	return numFailed > 0 ? 1 : 0;
+}